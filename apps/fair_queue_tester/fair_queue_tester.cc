@@ -27,6 +27,7 @@
 #include "core/sleep.hh"
 #include "core/align.hh"
 #include "core/timer.hh"
+#include "core/fair_queue.hh"
 #include <chrono>
 #include <boost/range/irange.hpp>
 #include <boost/algorithm/string.hpp>
@@ -132,6 +133,67 @@ int context::class_data::idgen() {
     return id++;
 }
 
+// Measures the overhead of queueing and dispatching requests through a
+// fair_queue, with no I/O behind them: each class keeps a number of requests
+// in flight against a queue of smaller capacity, so that every request waits
+// for a dispatch decision.
+class dispatch_benchmark {
+    fair_queue _fq;
+    std::vector<uint32_t> _shares;
+    std::vector<priority_class_ptr> _classes;
+    std::vector<uint64_t> _served;
+    unsigned _parallelism;
+    uint64_t _requests;
+    uint64_t _issued = 0;
+
+    future<> run_class(unsigned idx) {
+        return repeat([this, idx] {
+            if (_issued == _requests) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            ++_issued;
+            return _fq.queue(_classes[idx], 1, [this, idx] {
+                ++_served[idx];
+            }).then([] {
+                return stop_iteration::no;
+            });
+        });
+    }
+public:
+    dispatch_benchmark(std::vector<uint32_t> shares, unsigned parallelism, uint64_t requests)
+            : _fq(parallelism)
+            , _shares(std::move(shares))
+            , _served(_shares.size(), 0)
+            , _parallelism(parallelism)
+            , _requests(requests) {
+        for (auto s: _shares) {
+            _classes.push_back(_fq.register_priority_class(s));
+        }
+    }
+
+    future<> run() {
+        auto start = std::chrono::steady_clock::now();
+        auto classes = boost::irange(0u, unsigned(_classes.size()));
+        return parallel_for_each(classes.begin(), classes.end(), [this] (unsigned idx) {
+            auto parallelism = boost::irange(0u, _parallelism);
+            return parallel_for_each(parallelism.begin(), parallelism.end(), [this, idx] (auto dummy) {
+                return this->run_class(idx);
+            });
+        }).then([this, start] {
+            auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+            std::stringstream ss;
+            ss << "Shard " << std::setw(2) << engine().cpu_id() << ": " << _requests << " requests, "
+               << std::setprecision(1) << std::fixed << elapsed * 1e9 / _requests << " ns/request";
+            for (auto idx = 0u; idx < _classes.size(); ++idx) {
+                ss << " Class " << idx << "(" << std::setw(2) << _shares[idx] << " shares): " << std::setw(8) << _served[idx];
+                _fq.unregister_priority_class(_classes[idx]);
+            }
+            ss << std::endl;
+            std::cout << ss.str();
+        });
+    }
+};
+
 int main(int ac, char** av) {
     namespace bpo = boost::program_options;
 
@@ -143,12 +205,29 @@ int main(int ac, char** av) {
         ("duration", bpo::value<unsigned>()->default_value(10), "for how long (in seconds) to run the test")
         ("reqsize", bpo::value<size_t>()->default_value(4096), "size of each read request")
         ("shares", bpo::value<sstring>()->default_value("10,10"), "comma-separated list of shares per each class (default: 10,10)")
+        ("dispatch-benchmark", "measure the fair_queue dispatch overhead alone, without doing any I/O")
+        ("requests", bpo::value<uint64_t>()->default_value(10000000), "number of requests per shard for --dispatch-benchmark")
     ;
 
 
     distributed<context> ctx;
     return app.run(ac, av, [&] {
         auto& opts = app.configuration();
+        if (opts.count("dispatch-benchmark")) {
+            auto& parallelism = opts["parallelism"].as<unsigned>();
+            auto& share_list = opts["shares"].as<sstring>();
+            auto& requests = opts["requests"].as<uint64_t>();
+
+            std::vector<sstring> strs;
+            boost::split(strs, share_list, boost::is_any_of(","));
+            std::vector<uint32_t> shares(strs.size(), 0);
+            std::transform(strs.begin(), strs.end(), shares.begin(), [] (sstring s) { return boost::lexical_cast<uint32_t>(s); });
+
+            return smp::invoke_on_all([shares, parallelism, requests] {
+                auto bench = make_lw_shared<dispatch_benchmark>(shares, parallelism, requests);
+                return bench->run().finally([bench] {});
+            });
+        }
         auto& directory = opts["directory"].as<sstring>();
         return file_system_at(directory).then([directory] (auto fs) {
             if (fs != fs_type::xfs) {
@@ -100,6 +100,9 @@ class iotune_manager {
     uint64_t file_size = 10ull << 30;
     static constexpr uint64_t wbuffer_size = 128ul << 10;
     static constexpr uint64_t rbuffer_size = 4ul << 10;
+    // Measured while generating the evaluation file, which is written with
+    // large sequential requests.
+    uint64_t write_bandwidth = 0;
 private:
     size_t _num_threads;
     // We need all threads to synchronize and start the various phases at the same time.
@@ -154,7 +157,13 @@ class iotune_manager {
     iotune_manager::clock::time_point _run_start_time;
     iotune_manager::clock::time_point _maximum_end_time;
 
-    run_stats issue_reads(size_t cpu_id, unsigned this_concurrency);
+    // The requests issued by the test runs. The concurrency discovery runs
+    // small reads, after which the same machinery measures the throughput of
+    // the other request shapes the I/O scheduler cost model needs.
+    uint64_t _request_size = rbuffer_size;
+    bool _write = false;
+
+    run_stats issue_requests(size_t cpu_id, unsigned this_concurrency);
 
     run_stats current_result(size_t cpu_id) {
         assert(cpu_id == 0);
@@ -395,7 +404,7 @@ class iotune_manager {
 
     void run_test(size_t cpu_id, unsigned concurrency) {
         if (concurrency != 0) {
-            auto r = issue_reads(cpu_id, concurrency);
+            auto r = issue_requests(cpu_id, concurrency);
             std::lock_guard<std::mutex> guard(_result_mutex);
             _test_result += r;
         } else {
@@ -420,6 +429,23 @@ class iotune_manager {
         return _test_done;
     }
 
+    // Sets up a single, long run of the given request shape at the
+    // concurrency that yielded the maximum throughput.
+    void prepare_measurement(uint64_t request_size, bool write) {
+        _request_size = request_size;
+        _write = write;
+        _next_concurrency = std::max<unsigned>(_best_result.concurrency, _num_threads);
+        _phase_timing = 2000ms;
+    }
+
+    uint64_t read_iops() const {
+        return _best_result.IOPS;
+    }
+
+    uint64_t measured_iops() {
+        return current_result(0).IOPS;
+    }
+
     uint32_t finish_estimate() {
         if (_best_critical_concurrency == 0) {
             std::cerr << "============= Cut here ===============" << std::endl;
@@ -461,6 +487,8 @@ static thread_local std::default_random_engine random_generator(std::chrono::dur
 class reader {
     uint64_t _opcount = 0;
     file_desc _file;
+    uint64_t _request_size;
+    bool _write;
     std::uniform_int_distribution<uint32_t> _pos_distribution;
     struct iocb _iocb;
     iotune_manager::clock::time_point _start_time;
@@ -468,17 +496,27 @@ class reader {
     iotune_manager::clock::time_point _end_time;
     std::unique_ptr<char[], free_deleter> _buf;
 public:
-    reader(file_desc f, uint64_t file_size, iotune_manager::clock::time_point start_time, iotune_manager::clock::time_point end_time)
+    reader(file_desc f, uint64_t file_size, uint64_t request_size, bool write,
+           iotune_manager::clock::time_point start_time, iotune_manager::clock::time_point end_time)
                 : _file(std::move(f))
-                , _pos_distribution(0, (file_size/ iotune_manager::rbuffer_size) - 1)
+                , _request_size(request_size)
+                , _write(write)
+                , _pos_distribution(0, (file_size / request_size) - 1)
                 , _start_time(start_time)
                 , _tstamp(iotune_manager::clock::now())
                 , _end_time(end_time)
-                , _buf(allocate_aligned_buffer<char>(iotune_manager::rbuffer_size, 4096))
-    {}
+                , _buf(allocate_aligned_buffer<char>(request_size, 4096))
+    {
+        memset(_buf.get(), 0, _request_size);
+    }
 
     iocb* issue() {
-        io_prep_pread(&_iocb, _file.get(), _buf.get(), iotune_manager::rbuffer_size, _pos_distribution(random_generator) * iotune_manager::rbuffer_size);
+        auto pos = _pos_distribution(random_generator) * _request_size;
+        if (_write) {
+            io_prep_pwrite(&_iocb, _file.get(), _buf.get(), _request_size, pos);
+        } else {
+            io_prep_pread(&_iocb, _file.get(), _buf.get(), _request_size, pos);
+        }
         _iocb.data = this;
         _tstamp = std::chrono::steady_clock::now();
         return &_iocb;
@@ -516,7 +554,7 @@ void sanity_check_ev(const io_event& ev, size_t size) {
     }
 }
 
-run_stats iotune_manager::issue_reads(size_t cpu_id, unsigned concurrency) {
+run_stats iotune_manager::issue_requests(size_t cpu_id, unsigned concurrency) {
     io_context_t io_context = {0};
     auto r = ::io_setup(concurrency, &io_context);
     assert(r >= 0);
@@ -534,7 +572,7 @@ run_stats iotune_manager::issue_reads(size_t cpu_id, unsigned concurrency) {
 
     auto fds = std::vector<reader>();
     for (unsigned i = 0u; i < concurrency; ++i) {
-        fds.emplace_back(_test_file.file.dup(), file_size, start_time, start_time + total_time);
+        fds.emplace_back(_test_file.file.dup(), file_size, _request_size, _write, start_time, start_time + total_time);
     }
 
     for (auto& r: fds) {
@@ -550,7 +588,7 @@ run_stats iotune_manager::issue_reads(size_t cpu_id, unsigned concurrency) {
         throw_kernel_error(n);
         unsigned new_req = 0;
         for (auto i = 0ul; i < size_t(n); ++i) {
-            sanity_check_ev(ev[i], iotune_manager::rbuffer_size);
+            sanity_check_ev(ev[i], _request_size);
             auto reader_ptr = reinterpret_cast<reader*>(ev[i].data);
             auto iocb_ptr = reader_ptr->req_finished();
             if (iocb_ptr == nullptr) {
@@ -653,33 +691,72 @@ void test_file::generate(iotune_manager& iotune_manager, std::chrono::seconds ti
 
     }
     iotune_manager.file_size = bytes_written;
+    auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(latest_tstamp - start_time).count();
+    iotune_manager.write_bandwidth = elapsed > 0 ? uint64_t(bytes_written / elapsed) : 0;
     std::cout << to_gb(iotune_manager.file_size) << "GB written in "
               << std::chrono::duration_cast<std::chrono::seconds>(latest_tstamp - start_time).count()
               << " seconds" << std::endl;
 }
 
-uint32_t io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
+// What the I/O scheduler needs to know about the disk: how many requests to
+// keep in flight, and the throughput of small and of large requests in each
+// direction, from which it weighs requests by the device time they take.
+struct io_properties {
+    uint32_t max_io_requests;
+    uint64_t read_iops;
+    uint64_t read_bandwidth;
+    uint64_t write_iops;
+    uint64_t write_bandwidth;
+};
+
+static void run_on_all_cpus(iotune_manager& iotune_manager, const std::vector<unsigned>& cpus) {
+    for (auto i = 0ul; i < cpus.size(); ++i) {
+        iotune_manager.spawn_new([&iotune_manager, &cpus, id = i] {
+           pin_this_thread(cpus[id]);
+           auto my_concurrency = iotune_manager.get_thread_concurrency(id);
+           iotune_manager.run_test(id, my_concurrency);
+        });
+    }
+    iotune_manager.wait_for_threads();
+}
+
+io_properties io_queue_discovery(sstring dir, std::vector<unsigned> cpus, std::chrono::seconds timeout) {
     iotune_manager iotune_manager(cpus.size(), dir, timeout);
 
     do {
-        for (auto i = 0ul; i < cpus.size(); ++i) {
-            iotune_manager.spawn_new([&iotune_manager, &cpus, id = i] {
-               pin_this_thread(cpus[id]);
-               auto my_concurrency = iotune_manager.get_thread_concurrency(id);
-               iotune_manager.run_test(id, my_concurrency);
-            });
-        }
-        iotune_manager.wait_for_threads();
+        run_on_all_cpus(iotune_manager, cpus);
     } while (iotune_manager.analyze_results() == iotune_manager::test_done::no);
 
-    return iotune_manager.finish_estimate();
+    io_properties props;
+    props.max_io_requests = iotune_manager.finish_estimate();
+    props.read_iops = iotune_manager.read_iops();
+    props.write_bandwidth = iotune_manager.write_bandwidth;
+
+    std::cout << "Measuring read bandwidth..." << std::flush;
+    iotune_manager.prepare_measurement(iotune_manager::wbuffer_size, false);
+    run_on_all_cpus(iotune_manager, cpus);
+    props.read_bandwidth = iotune_manager.measured_iops() * iotune_manager::wbuffer_size;
+    std::cout << " " << props.read_bandwidth << " bytes/s" << std::endl;
+
+    std::cout << "Measuring write IOPS..." << std::flush;
+    iotune_manager.prepare_measurement(iotune_manager::rbuffer_size, true);
+    run_on_all_cpus(iotune_manager, cpus);
+    props.write_iops = iotune_manager.measured_iops();
+    std::cout << " " << props.write_iops << " IOPS" << std::endl;
+
+    return props;
 }
 
-int write_configuration_file(std::string conf_file, std::string format, unsigned max_io_requests, std::experimental::optional<unsigned> num_io_queues = {}) {
+int write_configuration_file(std::string conf_file, std::string format, const io_properties& props, std::experimental::optional<unsigned> num_io_queues = {}) {
+    auto max_io_requests = props.max_io_requests;
     std::cout << "Recommended --max-io-requests: " << max_io_requests << std::endl;
     if (num_io_queues) {
         std::cout << "Recommended --num-io-queues: " << *num_io_queues << std::endl;
     }
+    std::cout << "Measured --io-read-iops: " << props.read_iops << std::endl;
+    std::cout << "Measured --io-read-bandwidth: " << props.read_bandwidth << std::endl;
+    std::cout << "Measured --io-write-iops: " << props.write_iops << std::endl;
+    std::cout << "Measured --io-write-bandwidth: " << props.write_bandwidth << std::endl;
 
     wordexp_t k;
     // Do tilde expansion if needed, but since we get the directory from the user, it
@@ -701,11 +778,19 @@ int write_configuration_file(std::string conf_file, std::string format, unsigned
                 if (num_io_queues) {
                     ofs_io << "num-io-queues=" << *num_io_queues << std::endl;
                 }
+                ofs_io << "io-read-iops=" << props.read_iops << std::endl;
+                ofs_io << "io-read-bandwidth=" << props.read_bandwidth << std::endl;
+                ofs_io << "io-write-iops=" << props.write_iops << std::endl;
+                ofs_io << "io-write-bandwidth=" << props.write_bandwidth << std::endl;
             } else {
                 ofs_io << "SEASTAR_IO=\"--max-io-requests=" << max_io_requests;
                 if (num_io_queues) {
                     ofs_io << " --num-io-queues=" << *num_io_queues;
                 }
+                ofs_io << " --io-read-iops=" << props.read_iops;
+                ofs_io << " --io-read-bandwidth=" << props.read_bandwidth;
+                ofs_io << " --io-write-iops=" << props.write_iops;
+                ofs_io << " --io-write-bandwidth=" << props.write_bandwidth;
                 ofs_io << "\"" << std::endl;
             }
         }
@@ -797,7 +882,8 @@ int main(int ac, char** av) {
     auto timeout = std::chrono::seconds(configuration["timeout"].as<uint64_t>());
 
     try {
-        auto iodepth = io_queue_discovery(directory, cpuvec, timeout);
+        auto props = io_queue_discovery(directory, cpuvec, timeout);
+        auto& iodepth = props.max_io_requests;
         auto num_io_queues = cpuvec.size();
         if (iodepth / num_io_queues < 4) {
             num_io_queues = iodepth / 4;
@@ -805,9 +891,9 @@ int main(int ac, char** av) {
 
         if (num_io_queues != cpuvec.size()) {
             iodepth = (iodepth / num_io_queues) * num_io_queues;
-            return write_configuration_file(conf_file, format, iodepth, num_io_queues);
+            return write_configuration_file(conf_file, format, props, num_io_queues);
         } else {
-            return write_configuration_file(conf_file, format, iodepth);
+            return write_configuration_file(conf_file, format, props);
         }
     } catch (iotune_timeout_exception &e) {
         // Otherwise we'll coredump on the exception, but this can happen
@@ -246,6 +246,9 @@ tests = [
     'tests/checked_ptr_test',
     'tests/slab_test',
     'tests/fstream_test',
+    'tests/block_cache_test',
+    'tests/relocatable_region_test',
+    'tests/work_stealing_test',
     'tests/distributed_test',
     'tests/rpc',
     'tests/semaphore_test',
@@ -316,6 +319,8 @@ arg_parser.add_argument('--static-boost', dest = 'staticboost', action = 'store_
 add_tristate(arg_parser, name = 'hwloc', dest = 'hwloc', help = 'hwloc support')
 arg_parser.add_argument('--enable-gcc6-concepts', dest='gcc6_concepts', action='store_true', default=False,
                         help='enable experimental support for C++ Concepts as implemented in GCC 6')
+arg_parser.add_argument('--enable-coroutines', dest='coroutines', action='store_true', default=False,
+                        help='enable support for C++ coroutines (co_await on futures)')
 arg_parser.add_argument('--enable-alloc-failure-injector', dest='alloc_failure_injector', action='store_true', default=False,
                         help='enable allocation failure injection')
 add_tristate(arg_parser, name = 'exception-scalability-workaround', dest='exception_workaround',
@@ -343,6 +348,9 @@ core = [
     'core/reactor.cc',
     'core/systemwide_memory_barrier.cc',
     'core/fstream.cc',
+    'core/block_cache.cc',
+    'core/relocatable_region.cc',
+    'core/work_stealing.cc',
     'core/posix.cc',
     'core/memory.cc',
     'core/resource.cc',
@@ -483,6 +491,9 @@ deps = {
     'tests/checked_ptr_test': ['tests/checked_ptr_test.cc'] + core,
     'tests/slab_test': ['tests/slab_test.cc'] + core,
     'tests/fstream_test': ['tests/fstream_test.cc'] + core,
+    'tests/block_cache_test': ['tests/block_cache_test.cc'] + core,
+    'tests/relocatable_region_test': ['tests/relocatable_region_test.cc'] + core,
+    'tests/work_stealing_test': ['tests/work_stealing_test.cc'] + core,
     'tests/distributed_test': ['tests/distributed_test.cc'] + core,
     'tests/rpc': ['tests/rpc.cc'] + core + libnet,
     'tests/rpc_test': ['tests/rpc_test.cc'] + core + libnet,
@@ -518,6 +529,9 @@ boost_tests = [
     'tests/httpd',
     'tests/output_stream_test',
     'tests/fstream_test',
+    'tests/block_cache_test',
+    'tests/relocatable_region_test',
+    'tests/work_stealing_test',
     'tests/rpc_test',
     'tests/connect_test',
     'tests/json_formatter_test',
@@ -687,6 +701,25 @@ if try_compile(args.cxx, source = textwrap.dedent('''\
         ''')):
     defines.append("HAVE_LZ4_COMPRESS_DEFAULT")
 
+if try_compile(args.cxx, source = textwrap.dedent('''\
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+
+        int x = IORING_OP_STATX + IORING_REGISTER_PROBE + IORING_ENTER_EXT_ARG + __NR_io_uring_setup + __NR_io_uring_enter + __NR_io_uring_register;
+        ''')):
+    defines.append("HAVE_IO_URING")
+
+if args.coroutines:
+    if not try_compile(args.cxx, flags=['-std=gnu++1y', '-fcoroutines'], source = textwrap.dedent('''\
+            #include <coroutine>
+
+            std::coroutine_handle<> h;
+            ''')):
+        print('Error: the compiler does not support coroutines')
+        sys.exit(1)
+    defines.append('SEASTAR_COROUTINES_ENABLED')
+    args.user_cflags += ' -fcoroutines'
+
 if try_compile_and_link(args.cxx, flags=['-fsanitize=address'], source = textwrap.dedent('''\
         #include <cstddef>
 
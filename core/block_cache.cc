@@ -0,0 +1,449 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#include "block_cache.hh"
+#include "metrics.hh"
+#include "align.hh"
+#include "reactor.hh"
+#include <experimental/optional>
+#include <string.h>
+
+namespace seastar {
+
+block_cache::block_cache(config cfg)
+        : _cfg(std::move(cfg))
+        , _reclaimer([this] { return reclaim(); }) {
+    assert(_cfg.block_size && _cfg.max_cached_read);
+    setup_metrics();
+}
+
+block_cache::~block_cache() {
+    _hand = _clock.end();
+    _clock.clear();
+}
+
+void block_cache::setup_metrics() {
+    namespace sm = seastar::metrics;
+    static auto cache_label = sm::label("cache");
+    _metrics.add_group("block_cache", {
+        // total_operations value:DERIVE:0:U
+        sm::make_derive("hits", _hits, sm::description("Reads served entirely from the cache"), {cache_label(_cfg.name)}),
+        // total_operations value:DERIVE:0:U
+        sm::make_derive("misses", _misses, sm::description("Cacheable reads that went to the disk"), {cache_label(_cfg.name)}),
+        // total_operations value:DERIVE:0:U
+        sm::make_derive("bypasses", _bypasses, sm::description("Reads too large to be cached"), {cache_label(_cfg.name)}),
+        // total_operations value:DERIVE:0:U
+        sm::make_derive("insertions", _insertions, sm::description("Blocks inserted into the cache"), {cache_label(_cfg.name)}),
+        // total_operations value:DERIVE:0:U
+        sm::make_derive("evictions", _evictions, sm::description("Blocks evicted from the cache, to make room or to free memory"), {cache_label(_cfg.name)}),
+        sm::make_total_bytes("reclaimed_bytes", _reclaimed_bytes, sm::description("Bytes evicted because the system ran low on memory"), {cache_label(_cfg.name)}),
+        sm::make_gauge("bytes", [this] { return _bytes; }, sm::description("Bytes of file data held by the cache"), {cache_label(_cfg.name)}),
+        sm::make_gauge("blocks", [this] { return _blocks.size(); }, sm::description("Number of blocks held by the cache"), {cache_label(_cfg.name)}),
+    });
+}
+
+block_cache::block* block_cache::find(uint64_t file_id, uint64_t index) {
+    auto it = _blocks.find(block_key{file_id, index});
+    if (it == _blocks.end()) {
+        return nullptr;
+    }
+    it->second->referenced = true;
+    return it->second.get();
+}
+
+void block_cache::insert(uint64_t file_id, uint64_t index, temporary_buffer<uint8_t> data) {
+    auto size = data.size();
+    auto it = _blocks.find(block_key{file_id, index});
+    if (it != _blocks.end()) {
+        auto& b = *it->second;
+        if (size > _cfg.capacity) {
+            evict(b);
+            return;
+        }
+        _bytes -= b.data.size();
+        while (_bytes + size > _cfg.capacity && evict_one(&b)) {
+        }
+        _bytes += size;
+        b.data = std::move(data);
+        b.referenced = true;
+        return;
+    }
+    if (size > _cfg.capacity) {
+        return;
+    }
+    while (_bytes + size > _cfg.capacity && evict_one()) {
+    }
+    auto b = std::make_unique<block>();
+    b->file_id = file_id;
+    b->index = index;
+    b->data = std::move(data);
+    _clock.insert(_hand, *b);
+    _files[file_id].push_back(*b);
+    _blocks.emplace(block_key{file_id, index}, std::move(b));
+    _bytes += size;
+    ++_insertions;
+}
+
+void block_cache::evict(block& b) {
+    if (_hand != _clock.end() && &*_hand == &b) {
+        ++_hand;
+    }
+    _bytes -= b.data.size();
+    ++_evictions;
+    auto f = _files.find(b.file_id);
+    auto last_of_file = &f->second.front() == &b && &f->second.back() == &b;
+    // Unlinks the block from the clock and from its file as well.
+    _blocks.erase(block_key{b.file_id, b.index});
+    if (last_of_file) {
+        _files.erase(f);
+    }
+}
+
+bool block_cache::evict_one(const block* keep) {
+    if (_clock.empty() || (&_clock.front() == keep && &_clock.back() == keep)) {
+        return false;
+    }
+    for (;;) {
+        if (_hand == _clock.end()) {
+            _hand = _clock.begin();
+        }
+        auto& b = *_hand;
+        if (&b == keep) {
+            ++_hand;
+            continue;
+        }
+        if (!b.referenced) {
+            evict(b);
+            return true;
+        }
+        b.referenced = false;
+        ++_hand;
+    }
+}
+
+void block_cache::invalidate(uint64_t file_id, uint64_t first, uint64_t last) {
+    if (last - first <= _blocks.size()) {
+        for (auto index = first; index < last; ++index) {
+            auto it = _blocks.find(block_key{file_id, index});
+            if (it != _blocks.end()) {
+                evict(*it->second);
+            }
+        }
+        return;
+    }
+    auto f = _files.find(file_id);
+    if (f == _files.end()) {
+        return;
+    }
+    auto& blocks = f->second;
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        auto& b = *it++;
+        if (b.index >= first && b.index < last) {
+            auto last_of_file = &blocks.front() == &b && &blocks.back() == &b;
+            evict(b);
+            if (last_of_file) {
+                // The list went away with it
+                return;
+            }
+        }
+    }
+}
+
+void block_cache::invalidate_file(uint64_t file_id) {
+    auto f = _files.find(file_id);
+    if (f == _files.end()) {
+        return;
+    }
+    auto& blocks = f->second;
+    while (&blocks.front() != &blocks.back()) {
+        evict(blocks.front());
+    }
+    // Drops the list as well
+    evict(blocks.front());
+}
+
+memory::reclaiming_result block_cache::reclaim() {
+    // Free memory in chunks, as the reclaimer is called again for as long as
+    // the system stays low on it.
+    static constexpr size_t reclaim_chunk = 256 << 10;
+    size_t freed = 0;
+    while (freed < reclaim_chunk && !_clock.empty()) {
+        auto bytes = _bytes;
+        evict_one();
+        freed += bytes - _bytes;
+    }
+    _reclaimed_bytes += freed;
+    return freed ? memory::reclaiming_result::reclaimed_something : memory::reclaiming_result::reclaimed_nothing;
+}
+
+// Serves reads from a block_cache, filling it from the wrapped file on misses.
+class cached_file_impl : public file_impl {
+    file _file;
+    block_cache& _cache;
+    uint64_t _id;
+    // Bumped by every operation that changes the contents or the size of the
+    // file, so that reads issued before it do not insert stale blocks.
+    uint64_t _generation = 0;
+    // The cached block at the end of the file, which grows stale as soon as the
+    // file grows, whichever blocks a write touched.
+    std::experimental::optional<uint64_t> _partial_block;
+private:
+    file_impl& impl() {
+        return *get_file_impl(_file);
+    }
+    size_t block_size() const {
+        return _cache.get_config().block_size;
+    }
+    bool cacheable(size_t len) const {
+        return len && len <= _cache.get_config().max_cached_read;
+    }
+    void invalidate(uint64_t first, uint64_t last);
+    void invalidate_range(uint64_t pos, uint64_t len) {
+        invalidate(pos / block_size(), align_up(pos + len, uint64_t(block_size())) / block_size());
+    }
+    template <typename Func>
+    auto modify(uint64_t first, uint64_t last, Func&& op);
+    // Copies [pos, pos + len) from the cache, if all of it is there. Stops
+    // short at the end of the file.
+    bool copy_cached(uint64_t pos, size_t len, uint8_t* dst, size_t& copied);
+    // Reads whole blocks from the file, inserting them into the cache, and
+    // returns their contents.
+    future<temporary_buffer<uint8_t>> read_blocks(uint64_t first, uint64_t last, const io_priority_class& pc);
+public:
+    cached_file_impl(file f, block_cache& cache)
+            : _file(std::move(f))
+            , _cache(cache)
+            , _id(cache.new_file_id()) {
+        _memory_dma_alignment = _file.memory_dma_alignment();
+        _disk_read_dma_alignment = _file.disk_read_dma_alignment();
+        _disk_write_dma_alignment = _file.disk_write_dma_alignment();
+    }
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override;
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override;
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override;
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override;
+    virtual future<> flush(void) override {
+        return impl().flush();
+    }
+    virtual future<struct stat> stat(void) override {
+        return impl().stat();
+    }
+    virtual future<> truncate(uint64_t length) override;
+    virtual future<> discard(uint64_t offset, uint64_t length) override;
+    virtual future<> allocate(uint64_t position, uint64_t length) override;
+    virtual future<uint64_t> size(void) override {
+        return impl().size();
+    }
+    virtual future<> close() override;
+    virtual std::unique_ptr<file_handle_impl> dup() override {
+        return impl().dup();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override {
+        return impl().list_directory(std::move(next));
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override;
+};
+
+void cached_file_impl::invalidate(uint64_t first, uint64_t last) {
+    ++_generation;
+    _cache.invalidate(_id, first, last);
+    if (_partial_block) {
+        _cache.invalidate(_id, *_partial_block, *_partial_block + 1);
+        _partial_block = {};
+    }
+}
+
+// Runs an operation that modifies blocks [first, last) of the file. They are
+// invalidated before it starts and again once it is done, to catch the reads
+// that ran concurrently with it.
+template <typename Func>
+auto cached_file_impl::modify(uint64_t first, uint64_t last, Func&& op) {
+    invalidate(first, last);
+    return op().finally([this, first, last] {
+        invalidate(first, last);
+    });
+}
+
+bool cached_file_impl::copy_cached(uint64_t pos, size_t len, uint8_t* dst, size_t& copied) {
+    auto bs = block_size();
+    copied = 0;
+    while (copied < len) {
+        auto b = _cache.find(_id, (pos + copied) / bs);
+        if (!b) {
+            return false;
+        }
+        auto offset = (pos + copied) % bs;
+        if (offset >= b->data.size()) {
+            break;
+        }
+        auto n = std::min(len - copied, b->data.size() - offset);
+        memcpy(dst + copied, b->data.get() + offset, n);
+        copied += n;
+        if (b->data.size() < bs) {
+            break;
+        }
+    }
+    return true;
+}
+
+future<temporary_buffer<uint8_t>>
+cached_file_impl::read_blocks(uint64_t first, uint64_t last, const io_priority_class& pc) {
+    _cache.account_miss();
+    auto bs = block_size();
+    auto generation = _generation;
+    return impl().dma_read_bulk(first * bs, (last - first) * bs, pc).then([this, first, bs, generation] (temporary_buffer<uint8_t> buf) {
+        if (generation != _generation) {
+            return buf;
+        }
+        for (size_t offset = 0; offset < buf.size(); offset += bs) {
+            auto n = std::min(bs, buf.size() - offset);
+            auto index = first + offset / bs;
+            temporary_buffer<uint8_t> data(n);
+            memcpy(data.get_write(), buf.get() + offset, n);
+            _cache.insert(_id, index, std::move(data));
+            if (n < bs) {
+                _partial_block = index;
+            }
+        }
+        return buf;
+    });
+}
+
+future<size_t>
+cached_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) {
+    if (!cacheable(len)) {
+        _cache.account_bypass();
+        return impl().read_dma(pos, buffer, len, pc);
+    }
+    auto dst = static_cast<uint8_t*>(buffer);
+    size_t copied;
+    if (copy_cached(pos, len, dst, copied)) {
+        _cache.account_hit();
+        return make_ready_future<size_t>(copied);
+    }
+    auto bs = block_size();
+    auto first = pos / bs;
+    return read_blocks(first, align_up(pos + len, uint64_t(bs)) / bs, pc).then([pos, len, dst, front = pos - first * bs] (temporary_buffer<uint8_t> buf) {
+        if (front >= buf.size()) {
+            return size_t(0);
+        }
+        auto n = std::min(len, buf.size() - front);
+        memcpy(dst, buf.get() + front, n);
+        return n;
+    });
+}
+
+future<size_t>
+cached_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) {
+    _cache.account_bypass();
+    return impl().read_dma(pos, std::move(iov), pc);
+}
+
+future<temporary_buffer<uint8_t>>
+cached_file_impl::dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) {
+    if (!cacheable(range_size)) {
+        _cache.account_bypass();
+        return impl().dma_read_bulk(offset, range_size, pc);
+    }
+    auto bs = block_size();
+    auto first = offset / bs;
+    auto last = align_up(offset + range_size, uint64_t(bs)) / bs;
+    if (last - first == 1) {
+        // Shares the cached block rather than copy it.
+        if (auto b = _cache.find(_id, first)) {
+            _cache.account_hit();
+            auto front = offset - first * bs;
+            if (front >= b->data.size()) {
+                return make_ready_future<temporary_buffer<uint8_t>>();
+            }
+            return make_ready_future<temporary_buffer<uint8_t>>(b->data.share(front, std::min(range_size, b->data.size() - front)));
+        }
+    } else {
+        temporary_buffer<uint8_t> buf(range_size);
+        size_t copied;
+        if (copy_cached(offset, range_size, buf.get_write(), copied)) {
+            _cache.account_hit();
+            buf.trim(copied);
+            return make_ready_future<temporary_buffer<uint8_t>>(std::move(buf));
+        }
+    }
+    return read_blocks(first, last, pc).then([range_size, front = offset - first * bs] (temporary_buffer<uint8_t> buf) {
+        if (front >= buf.size()) {
+            return temporary_buffer<uint8_t>();
+        }
+        buf.trim_front(front);
+        buf.trim(std::min(range_size, buf.size()));
+        return buf;
+    });
+}
+
+future<size_t>
+cached_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) {
+    auto bs = block_size();
+    return modify(pos / bs, align_up(pos + len, uint64_t(bs)) / bs, [this, pos, buffer, len, &pc] {
+        return impl().write_dma(pos, buffer, len, pc);
+    });
+}
+
+future<size_t>
+cached_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) {
+    size_t len = 0;
+    for (auto& v : iov) {
+        len += v.iov_len;
+    }
+    auto bs = block_size();
+    return modify(pos / bs, align_up(pos + len, uint64_t(bs)) / bs, [this, pos, iov = std::move(iov), &pc] () mutable {
+        return impl().write_dma(pos, std::move(iov), pc);
+    });
+}
+
+future<> cached_file_impl::truncate(uint64_t length) {
+    return modify(length / block_size(), std::numeric_limits<uint64_t>::max(), [this, length] {
+        return impl().truncate(length);
+    });
+}
+
+future<> cached_file_impl::discard(uint64_t offset, uint64_t length) {
+    auto bs = block_size();
+    return modify(offset / bs, align_up(offset + length, uint64_t(bs)) / bs, [this, offset, length] {
+        return impl().discard(offset, length);
+    });
+}
+
+future<> cached_file_impl::allocate(uint64_t position, uint64_t length) {
+    auto bs = block_size();
+    return modify(position / bs, align_up(position + length, uint64_t(bs)) / bs, [this, position, length] {
+        return impl().allocate(position, length);
+    });
+}
+
+future<> cached_file_impl::close() {
+    ++_generation;
+    _cache.invalidate_file(_id);
+    _partial_block = {};
+    return impl().close();
+}
+
+file make_cached_file(file f, block_cache& cache) {
+    return file(make_shared<cached_file_impl>(std::move(f), cache));
+}
+
+}
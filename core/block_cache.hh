@@ -0,0 +1,181 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// A cache of file blocks in memory, for the reads that files would otherwise
+// send to the disk every time, such as those of hot index blocks.
+
+#include "core/file.hh"
+#include "core/memory.hh"
+#include "core/metrics_registration.hh"
+#include "core/temporary_buffer.hh"
+#include <boost/intrusive/list.hpp>
+#include <unordered_map>
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// \brief A per-shard cache of file blocks
+///
+/// Holds up to \c capacity bytes worth of blocks of the files wrapped with
+/// \ref make_cached_file(), allocated from the seastar allocator. Blocks
+/// are evicted with the CLOCK algorithm, an approximation of LRU that only
+/// sets a bit on hits, when the cache is full or when the system runs low on
+/// memory.
+///
+/// The cache must outlive the files that use it.
+class block_cache {
+public:
+    struct config {
+        /// Name of the cache, labelling its metrics.
+        sstring name = "default";
+        /// Bytes of file data to cache at most.
+        size_t capacity = 64 << 20;
+        /// Size of the cached blocks; a multiple of the disk alignment.
+        size_t block_size = 4096;
+        /// Reads larger than this go to the file, uncached, so that scans
+        /// do not wipe the cache out.
+        size_t max_cached_read = 128 << 10;
+    };
+    /// \cond internal
+    struct block : public boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> {
+        // Links the blocks of the same file.
+        boost::intrusive::list_member_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink>> file_link;
+        uint64_t file_id;
+        uint64_t index;
+        temporary_buffer<uint8_t> data; // short for the block at the end of a file
+        bool referenced = false;
+    };
+    /// \endcond
+private:
+    struct block_key {
+        uint64_t file_id;
+        uint64_t index;
+        bool operator==(const block_key& o) const {
+            return file_id == o.file_id && index == o.index;
+        }
+    };
+    struct block_key_hash {
+        size_t operator()(const block_key& k) const {
+            return std::hash<uint64_t>()(k.file_id * 0x9e3779b97f4a7c15ull ^ k.index);
+        }
+    };
+    using clock_list = boost::intrusive::list<block, boost::intrusive::constant_time_size<false>>;
+    using file_list = boost::intrusive::list<block,
+            boost::intrusive::member_hook<block, decltype(block::file_link), &block::file_link>,
+            boost::intrusive::constant_time_size<false>>;
+
+    config _cfg;
+    std::unordered_map<block_key, std::unique_ptr<block>, block_key_hash> _blocks;
+    // The blocks in CLOCK order. New blocks are placed right behind the hand,
+    // so that it reaches them last.
+    clock_list _clock;
+    clock_list::iterator _hand = _clock.end();
+    // The blocks of each file, so that invalidating a file does not scan
+    // the whole cache. Files without cached blocks have no entry.
+    std::unordered_map<uint64_t, file_list> _files;
+    size_t _bytes = 0;
+    uint64_t _next_file_id = 0;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    uint64_t _bypasses = 0;
+    uint64_t _insertions = 0;
+    uint64_t _evictions = 0;
+    uint64_t _reclaimed_bytes = 0;
+    memory::reclaimer _reclaimer;
+    metrics::metric_groups _metrics;
+private:
+    void evict(block& b);
+    // Evicts a block other than keep, if there is one.
+    bool evict_one(const block* keep = nullptr);
+    memory::reclaiming_result reclaim();
+    void setup_metrics();
+public:
+    explicit block_cache(config cfg);
+    block_cache() : block_cache(config{}) {}
+    ~block_cache();
+    block_cache(const block_cache&) = delete;
+    block_cache(block_cache&&) = delete;
+
+    /// \cond internal
+    uint64_t new_file_id() {
+        return _next_file_id++;
+    }
+    const config& get_config() const {
+        return _cfg;
+    }
+    // Returns the block if cached, marking it as recently used.
+    block* find(uint64_t file_id, uint64_t index);
+    void insert(uint64_t file_id, uint64_t index, temporary_buffer<uint8_t> data);
+    // Drops the blocks of a file in [first, last).
+    void invalidate(uint64_t file_id, uint64_t first, uint64_t last);
+    void invalidate_file(uint64_t file_id);
+    void account_hit() {
+        ++_hits;
+    }
+    void account_miss() {
+        ++_misses;
+    }
+    void account_bypass() {
+        ++_bypasses;
+    }
+    /// \endcond
+
+    /// \return bytes of file data held by the cache
+    size_t bytes() const {
+        return _bytes;
+    }
+    /// \return reads served entirely from the cache
+    uint64_t hits() const {
+        return _hits;
+    }
+    /// \return cacheable reads that had to go to the disk
+    uint64_t misses() const {
+        return _misses;
+    }
+    /// \return number of blocks currently cached
+    size_t blocks() const {
+        return _blocks.size();
+    }
+    /// \return number of files with blocks currently cached
+    size_t files() const {
+        return _files.size();
+    }
+};
+
+/// Wraps \c f so that its small reads are served from \c cache when possible
+///
+/// Reads through \c read_dma() of a single buffer and through
+/// \c dma_read_bulk() (and so through input streams) are cached. Writes,
+/// truncations, discards and allocations through the returned file keep the
+/// cache coherent, but writes through other \ref file objects to the same
+/// file are not seen by it. The blocks of the file are dropped when it is
+/// closed.
+file make_cached_file(file f, block_cache& cache);
+
+/// @}
+
+}
@@ -0,0 +1,189 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// Lets functions returning future<> be written as C++ coroutines, which
+// co_await other futures instead of chaining continuations.
+
+#ifndef SEASTAR_COROUTINES_ENABLED
+#error Coroutines support disabled; configure with --enable-coroutines
+#endif
+
+#include "core/future.hh"
+#include "core/preempt.hh"
+#include <cassert>
+#include <coroutine>
+#include <new>
+
+namespace seastar {
+
+namespace internal {
+
+template <typename... T>
+class coroutine_promise_base {
+protected:
+    promise<T...> _promise;
+public:
+    future<T...> get_return_object() noexcept {
+        return _promise.get_future();
+    }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept {
+        _promise.set_exception(std::current_exception());
+    }
+};
+
+template <typename... T>
+class coroutine_promise : public coroutine_promise_base<T...> {
+public:
+    void return_value(std::tuple<T...>&& value) noexcept {
+        this->_promise.set_value(std::move(value));
+    }
+};
+
+template <typename T>
+class coroutine_promise<T> : public coroutine_promise_base<T> {
+public:
+    template <typename U>
+    void return_value(U&& value) {
+        this->_promise.set_value(std::forward<U>(value));
+    }
+};
+
+template <>
+class coroutine_promise<> : public coroutine_promise_base<> {
+public:
+    void return_void() noexcept {
+        _promise.set_value();
+    }
+};
+
+// What co_await returns for a future<T...>
+template <typename... T>
+struct await_result {
+    static std::tuple<T...> get(future<T...>& f) {
+        return f.get();
+    }
+};
+
+template <typename T>
+struct await_result<T> {
+    static T get(future<T>& f) {
+        return f.get0();
+    }
+};
+
+template <>
+struct await_result<> {
+    static void get(future<>& f) {
+        f.get();
+    }
+};
+
+// Suspends a coroutine until a future is available.
+//
+// A ready future is consumed without suspending, unless the task quota
+// has run out. Otherwise the coroutine is resumed by a task embedded in
+// the awaiter, which lives in the coroutine frame, so awaiting does not
+// allocate.
+template <typename... T>
+class future_awaiter {
+    class waker final : public continuation_base<T...> {
+        std::coroutine_handle<> _handle;
+    public:
+        explicit waker(std::coroutine_handle<> handle) : _handle(handle) {}
+        virtual void run() noexcept override {
+            _handle.resume();
+        }
+        // The awaiter destroys the waker once the coroutine is resumed.
+        virtual void run_and_dispose() noexcept override {
+            _handle.resume();
+        }
+        // Owned by the coroutine frame; a task queue or promise dropping
+        // it only destroys it.
+        static void operator delete(void*, size_t) {}
+    };
+    future<T...> _future;
+    union {
+        waker _waker;
+    };
+    bool _suspended = false;
+public:
+    explicit future_awaiter(future<T...>&& f) noexcept : _future(std::move(f)) {}
+    // Only moved before the coroutine awaits it
+    future_awaiter(future_awaiter&& x) noexcept : _future(std::move(x._future)) {
+        assert(!x._suspended);
+    }
+    future_awaiter(const future_awaiter&) = delete;
+    ~future_awaiter() {}
+
+    bool await_ready() noexcept {
+        return _future.available() && !need_preempt();
+    }
+    void await_suspend(std::coroutine_handle<> handle) noexcept {
+        ::new (&_waker) waker(handle);
+        _suspended = true;
+        _future.schedule(std::unique_ptr<continuation_base<T...>>(&_waker));
+    }
+    auto await_resume() {
+        if (_suspended) {
+            _future = future<T...>(std::move(_waker._state));
+            _waker.~waker();
+            _suspended = false;
+        }
+        return await_result<T...>::get(_future);
+    }
+};
+
+}
+
+/// \addtogroup future-module
+/// @{
+
+/// Waits for a future in a coroutine.
+///
+/// Awaiting a ready future does not suspend the coroutine, unless it has
+/// run out of its task quota, and awaiting does not allocate memory.
+///
+/// \return the value of the future, or nothing for \c future<>, or a
+///         tuple for futures holding several values
+/// \throws the exception of a failed future
+template <typename... T>
+auto operator co_await(future<T...> f) noexcept {
+    return internal::future_awaiter<T...>(std::move(f));
+}
+
+/// @}
+
+}
+
+namespace std {
+
+template <typename... T, typename... Args>
+struct coroutine_traits<seastar::future<T...>, Args...> {
+    using promise_type = seastar::internal::coroutine_promise<T...>;
+};
+
+}
@@ -25,12 +25,17 @@
 #include "semaphore.hh"
 #include "shared_ptr.hh"
 #include "print.hh"
-#include "circular_buffer.hh"
-#include <queue>
+#include "timer.hh"
+#include <vector>
+#include <limits>
+#include <algorithm>
 #include <type_traits>
 #include <experimental/optional>
 #include <chrono>
 #include <unordered_set>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <cmath>
 
 namespace seastar {
@@ -38,20 +43,261 @@ namespace seastar {
 /// \addtogroup io-module
 /// @{
 
+/// \brief Describes a request passed to a \ref fair_queue
+///
+/// The \c weight is what the request costs in terms of shares, while \c size
+/// (e.g. in bytes) is only charged against the bandwidth limits, if any.
+struct fair_queue_request_descriptor {
+    float weight = 1;
+    size_t size = 0;
+};
+
+/// \brief Two-dimensional cost of the requests of a given kind
+///
+/// A request costs \c op_cost for being issued at all plus \c byte_cost for
+/// each unit of its size. With coefficients derived from the measured
+/// throughput of a device, the resulting weight is proportional to the time
+/// the request keeps the device busy, and so shares split device time rather
+/// than request counts.
+struct fair_queue_cost {
+    float op_cost = 1;
+    float byte_cost = 0;
+
+    fair_queue_request_descriptor describe(size_t size) const {
+        return fair_queue_request_descriptor{op_cost + byte_cost * size, size};
+    }
+};
+
+/// \brief Absolute throughput ceilings, for a \ref priority_class or a whole \ref fair_queue
+///
+/// A zero field means no limit.
+struct fair_queue_limits {
+    uint64_t ops_per_second = 0;
+    uint64_t bytes_per_second = 0;
+};
+
+/// \brief Capacity shared by several \ref fair_queue instances
+///
+/// Queues that share capacity, possibly from different shards, never have more
+/// requests executing together than the capacity given here, in addition to
+/// their own limit. Each takes a unit when dispatching a request and returns it
+/// when the request completes, with no message passing involved.
+///
+/// A queue that finds none left and has no request of its own executing, whose
+/// completion would let it try again, registers as a waiter (see
+/// \ref fair_queue::wait_for_capacity()). The next unit returned by any queue
+/// then wakes one of the waiters up, in turn, so none of them has to poll.
+///
+/// Throughput limits of the device can be set on the shared capacity too (see
+/// \ref set_limits()). Requests dispatched by all the queues then draw from
+/// them together, so a single busy queue may use the whole of the limits.
+///
+/// Shares only arbitrate between the classes of each queue: units of shared
+/// capacity go to whichever queue asks first, so a busy queue can keep them to
+/// itself and delay a class with more shares in another one. Arbitrating between
+/// queues too would take a message per request, which sharing capacity is meant
+/// to avoid; waking waiters in turn at least keeps any of them from starving.
+class fair_queue_shared_capacity {
+    using clock_type = std::chrono::steady_clock;
+    // A token bucket like the queues' own ones, kept as the time at which it
+    // is ready again, so that queues take from it with an atomic operation.
+    class rate_limit {
+        std::atomic<int64_t> _ready_at{0}; // nanoseconds since the clock's epoch
+        double _ns_per_token = 0; // 0 for unlimited
+        // Ten milliseconds worth of tokens.
+        static constexpr int64_t burst_ns = 10000000;
+    public:
+        void set_rate(uint64_t rate) {
+            _ns_per_token = rate ? 1e9 / rate : 0;
+            _ready_at.store(0, std::memory_order_relaxed);
+        }
+        void consume(double tokens, int64_t now) {
+            if (!_ns_per_token) {
+                return;
+            }
+            auto cost = std::llround(tokens * _ns_per_token);
+            auto ready_at = _ready_at.load(std::memory_order_relaxed);
+            while (!_ready_at.compare_exchange_weak(ready_at, std::max(ready_at, now - burst_ns) + cost,
+                    std::memory_order_relaxed)) {
+            }
+        }
+        int64_t time_to_ready(int64_t now) const {
+            return _ns_per_token ? std::max<int64_t>(0, _ready_at.load(std::memory_order_relaxed) - now) : 0;
+        }
+    };
+
+    std::atomic<int> _available;
+    std::atomic<unsigned> _nr_waiting{0};
+    std::atomic<unsigned> _next_waiter{0};
+    std::unique_ptr<std::atomic<bool>[]> _waiting;
+    unsigned _nr_waiters;
+    std::function<void (unsigned)> _wake;
+    rate_limit _ops_limit;
+    rate_limit _bytes_limit;
+
+    static int64_t nanoseconds(clock_type::time_point t) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    }
+public:
+    /// Constructs the shared capacity
+    ///
+    /// \param capacity how many requests may execute at once, in all queues together
+    /// \param nr_waiters how many queues, numbered from 0, may wait for capacity
+    /// \param wake called, from the queue returning a unit, with the number of the
+    ///        waiter to wake up for it
+    explicit fair_queue_shared_capacity(unsigned capacity, unsigned nr_waiters = 0, std::function<void (unsigned)> wake = {})
+            : _available(capacity)
+            , _waiting(new std::atomic<bool>[nr_waiters])
+            , _nr_waiters(nr_waiters)
+            , _wake(std::move(wake)) {
+        for (unsigned i = 0; i < nr_waiters; ++i) {
+            _waiting[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    bool try_acquire() {
+        if (_available.load(std::memory_order_relaxed) <= 0) {
+            return false;
+        }
+        if (_available.fetch_sub(1, std::memory_order_acquire) > 0) {
+            return true;
+        }
+        _available.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    void release() {
+        // Pairs with wait(): either we see the waiter, or it sees our unit.
+        _available.fetch_add(1, std::memory_order_seq_cst);
+        if (!_nr_waiting.load(std::memory_order_seq_cst)) {
+            return;
+        }
+        auto start = _next_waiter.fetch_add(1, std::memory_order_relaxed);
+        for (unsigned i = 0; i < _nr_waiters; ++i) {
+            auto waiter = (start + i) % _nr_waiters;
+            if (_waiting[waiter].load(std::memory_order_relaxed)
+                    && _waiting[waiter].exchange(false, std::memory_order_relaxed)) {
+                _nr_waiting.fetch_sub(1, std::memory_order_relaxed);
+                _wake(waiter);
+                return;
+            }
+        }
+    }
+    bool available() const {
+        return _available.load(std::memory_order_relaxed) > 0;
+    }
+    /// Registers \c waiter to be woken up by the next unit returned.
+    ///
+    /// \return false, without registering, if a unit is available now
+    bool wait(unsigned waiter) {
+        _waiting[waiter].store(true, std::memory_order_relaxed);
+        _nr_waiting.fetch_add(1, std::memory_order_seq_cst);
+        if (_available.load(std::memory_order_seq_cst) > 0) {
+            cancel_wait(waiter);
+            return false;
+        }
+        return true;
+    }
+    /// Unregisters \c waiter, unless it has been woken up already.
+    void cancel_wait(unsigned waiter) {
+        if (_waiting[waiter].exchange(false, std::memory_order_relaxed)) {
+            _nr_waiting.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    /// Sets throughput limits shared by all the queues, zero fields meaning unlimited
+    ///
+    /// Must be called before any queue dispatches a request.
+    void set_limits(fair_queue_limits limits) {
+        _ops_limit.set_rate(limits.ops_per_second);
+        _bytes_limit.set_rate(limits.bytes_per_second);
+    }
+    /// \return how long until the shared limits let requests through again
+    clock_type::duration time_to_ready(clock_type::time_point now) const {
+        auto ns = nanoseconds(now);
+        return std::chrono::nanoseconds(std::max(_ops_limit.time_to_ready(ns), _bytes_limit.time_to_ready(ns)));
+    }
+    /// Charges a dispatched request of \c size bytes against the shared limits
+    void consume(size_t size, clock_type::time_point now) {
+        auto ns = nanoseconds(now);
+        _ops_limit.consume(1, ns);
+        _bytes_limit.consume(size, ns);
+    }
+};
+
 /// \cond internal
+// A token bucket that lets a short burst through and may go into debt, so that
+// requests bigger than the burst are still served, at the configured rate.
+class fair_queue_token_bucket {
+    using clock_type = std::chrono::steady_clock;
+    double _rate = 0; // tokens per second, 0 for unlimited
+    double _tokens = 0;
+    clock_type::time_point _last;
+
+    // Ten milliseconds worth of tokens.
+    double burst() const {
+        return _rate / 100;
+    }
+public:
+    void set_rate(uint64_t rate) {
+        _rate = rate;
+        _tokens = burst();
+        _last = clock_type::now();
+    }
+    bool limited() const {
+        return _rate;
+    }
+    void refill(clock_type::time_point now) {
+        if (limited()) {
+            auto elapsed = std::chrono::duration<double>(now - _last).count();
+            _tokens = std::min(_tokens + elapsed * _rate, burst());
+            _last = now;
+        }
+    }
+    bool ready() const {
+        return !limited() || _tokens >= 0;
+    }
+    void consume(double tokens) {
+        if (limited()) {
+            _tokens -= tokens;
+        }
+    }
+    // How long until ready() holds again, assuming a recent refill().
+    clock_type::duration time_to_ready() const {
+        if (ready()) {
+            return clock_type::duration(0);
+        }
+        auto t = std::chrono::duration<double>(-_tokens / _rate);
+        return std::max<clock_type::duration>(std::chrono::duration_cast<clock_type::duration>(t), std::chrono::microseconds(1));
+    }
+};
+
 class priority_class {
-    struct request {
-        promise<> pr;
-        unsigned weight;
-    };
     friend class fair_queue;
+    static constexpr uint32_t no_slot = std::numeric_limits<uint32_t>::max();
+    static constexpr unsigned not_queued = std::numeric_limits<unsigned>::max();
+
     uint32_t _shares = 0;
     float _accumulated = 0;
-    circular_buffer<request> _queue;
-    bool _queued = false;
+    // The normalization of the owning queue this class' _accumulated is
+    // expressed in; see fair_queue::normalize_stats().
+    unsigned _epoch = 0;
+    // FIFO of this class' requests, linked through the queue's request slots.
+    uint32_t _first = no_slot;
+    uint32_t _last = no_slot;
+    // Position in the queue's heap of classes with pending requests.
+    unsigned _heap_index = not_queued;
+    fair_queue_token_bucket _ops_bucket;
+    fair_queue_token_bucket _bytes_bucket;
 
     friend struct shared_ptr_no_esft<priority_class>;
     explicit priority_class(uint32_t shares) : _shares(shares) {}
+
+    bool throttled() const {
+        return !_ops_bucket.ready() || !_bytes_bucket.ready();
+    }
+    bool has_requests() const {
+        return _first != no_slot;
+    }
 };
 /// \endcond
 
@@ -84,81 +330,258 @@ using priority_class_ptr = lw_shared_ptr<priority_class>;
 /// When the classes that lag behind start seeing requests, the fair queue will serve
 /// them first, until balance is restored. This balancing is expected to happen within
 /// a certain time window that obeys an exponential decay.
+///
+/// On top of the shares, classes can be given absolute limits in operations
+/// and bytes per second (see \ref fair_queue_limits), and so can the queue as a
+/// whole, to model the throughput of the underlying device. A class that reached
+/// its limits is skipped, even if the device is otherwise idle, until enough time
+/// has passed.
 class fair_queue {
     friend priority_class;
 
-    struct class_compare {
-        bool operator() (const priority_class_ptr& lhs, const priority_class_ptr& rhs) const {
-            return lhs->_accumulated > rhs->_accumulated;
-        }
+    // Requests are kept in slots shared by all classes and recycled through a
+    // free list, so that queueing a request only allocates when the number of
+    // queued requests reaches a new high.
+    struct request {
+        promise<> pr;
+        fair_queue_request_descriptor desc;
+        // The next request of the same class, or the next free slot.
+        uint32_t next = priority_class::no_slot;
     };
 
-    semaphore _sem;
     unsigned _capacity;
+    unsigned _requests_executing = 0;
+    unsigned _requests_queued = 0;
     using clock_type = std::chrono::steady_clock::time_point;
     clock_type _base;
     std::chrono::microseconds _tau;
-    using prioq = std::priority_queue<priority_class_ptr, std::vector<priority_class_ptr>, class_compare>;
-    prioq _handles;
+    // Classes with pending requests, as a binary min-heap on _accumulated.
+    // Classes know their position, so they are sifted in place after being
+    // served and no reference counts are touched on the dispatch path.
+    std::vector<priority_class*> _handles;
+    std::vector<request> _requests;
+    uint32_t _free_requests = priority_class::no_slot;
+    unsigned _epoch = 0;
+    fair_queue_shared_capacity* _shared_capacity = nullptr;
+    unsigned _waiter_id = 0;
     std::unordered_set<priority_class_ptr> _all_classes;
+    fair_queue_token_bucket _ops_bucket;
+    fair_queue_token_bucket _bytes_bucket;
+    // Armed while requests are held back only by throttling.
+    timer<> _throttle_timer;
 
-    void push_priority_class(priority_class_ptr pc) {
-        if (!pc->_queued) {
-            _handles.push(pc);
-            pc->_queued = true;
+    uint32_t allocate_request() {
+        if (_free_requests == priority_class::no_slot) {
+            _requests.emplace_back();
+            return _requests.size() - 1;
         }
+        auto slot = _free_requests;
+        _free_requests = _requests[slot].next;
+        return slot;
     }
 
-    priority_class_ptr pop_priority_class() {
-        assert(!_handles.empty());
-        auto h = _handles.top();
-        _handles.pop();
-        assert(h->_queued);
-        h->_queued = false;
-        return h;
+    void free_request(uint32_t slot) {
+        _requests[slot].next = _free_requests;
+        _free_requests = slot;
     }
 
-    void execute_one() {
-        _sem.wait().then([this] {
-            priority_class_ptr h;
-            do {
-                h = pop_priority_class();
-            } while (h->_queue.empty());
-
-            auto req = std::move(h->_queue.front());
-            h->_queue.pop_front();
-
-            req.pr.set_value();
-            auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-            auto req_cost  = float(req.weight) / h->_shares;
-            auto cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
-            float next_accumulated = h->_accumulated + cost;
-            while (std::isinf(next_accumulated)) {
-                normalize_stats();
-                // If we have renormalized, our time base will have changed. This should happen very infrequently
-                delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-                cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
-                next_accumulated = h->_accumulated + cost;
+    void push_request(priority_class& pc, promise<> pr, fair_queue_request_descriptor desc) {
+        auto slot = allocate_request();
+        auto& req = _requests[slot];
+        req.pr = std::move(pr);
+        req.desc = desc;
+        req.next = priority_class::no_slot;
+        if (pc.has_requests()) {
+            _requests[pc._last].next = slot;
+        } else {
+            pc._first = slot;
+        }
+        pc._last = slot;
+    }
+
+    void place(unsigned idx, priority_class* pc) {
+        _handles[idx] = pc;
+        pc->_heap_index = idx;
+    }
+
+    void sift_up(unsigned idx) {
+        auto pc = _handles[idx];
+        while (idx) {
+            auto parent = (idx - 1) / 2;
+            if (_handles[parent]->_accumulated <= pc->_accumulated) {
+                break;
             }
-            h->_accumulated = next_accumulated;
+            place(idx, _handles[parent]);
+            idx = parent;
+        }
+        place(idx, pc);
+    }
 
-            if (!h->_queue.empty()) {
-                push_priority_class(h);
+    void sift_down(unsigned idx) {
+        auto pc = _handles[idx];
+        auto size = _handles.size();
+        for (;;) {
+            auto child = 2 * idx + 1;
+            if (child >= size) {
+                break;
             }
-            return make_ready_future<>();
-        });
+            if (child + 1 < size && _handles[child + 1]->_accumulated < _handles[child]->_accumulated) {
+                ++child;
+            }
+            if (pc->_accumulated <= _handles[child]->_accumulated) {
+                break;
+            }
+            place(idx, _handles[child]);
+            idx = child;
+        }
+        place(idx, pc);
+    }
+
+    void push_priority_class(priority_class& pc) {
+        if (pc._heap_index != priority_class::not_queued) {
+            return;
+        }
+        // Idle classes missed the normalizations that happened meanwhile.
+        if (pc._epoch != _epoch) {
+            pc._accumulated = _epoch - pc._epoch == 1 ? pc._accumulated * normalize_factor() : 0;
+            pc._epoch = _epoch;
+        }
+        _handles.push_back(&pc);
+        sift_up(_handles.size() - 1);
+    }
+
+    void remove_priority_class(priority_class& pc) {
+        auto idx = pc._heap_index;
+        auto last = _handles.back();
+        _handles.pop_back();
+        pc._heap_index = priority_class::not_queued;
+        if (last != &pc) {
+            place(idx, last);
+            sift_up(idx);
+            sift_down(last->_heap_index);
+        }
+    }
+
+    bool throttled() const {
+        return !_ops_bucket.ready() || !_bytes_bucket.ready();
+    }
+
+    void throttle_until(std::chrono::steady_clock::duration delay) {
+        auto when = std::chrono::steady_clock::now() + delay;
+        if (!_throttle_timer.armed() || _throttle_timer.get_timeout() > when) {
+            _throttle_timer.rearm(when);
+        }
+    }
+
+    // Finds the class that lags behind the most, among those that are not
+    // throttled. That is normally the top of the heap; only while some class
+    // is throttled do we have to look further.
+    priority_class* pick_priority_class(std::chrono::steady_clock::time_point now) {
+        if (_handles.empty()) {
+            return nullptr;
+        }
+        auto top = _handles.front();
+        top->_ops_bucket.refill(now);
+        top->_bytes_bucket.refill(now);
+        if (!top->throttled()) {
+            return top;
+        }
+        priority_class* h = nullptr;
+        auto delay = std::chrono::steady_clock::duration::max();
+        for (auto c : _handles) {
+            c->_ops_bucket.refill(now);
+            c->_bytes_bucket.refill(now);
+            if (c->throttled()) {
+                delay = std::min({delay, c->_ops_bucket.time_to_ready(), c->_bytes_bucket.time_to_ready()});
+            } else if (!h || c->_accumulated < h->_accumulated) {
+                h = c;
+            }
+        }
+        if (!h) {
+            throttle_until(delay);
+        }
+        return h;
+    }
+
+    void dispatch_one(priority_class& h, std::chrono::steady_clock::time_point now) {
+        auto slot = h._first;
+        auto& req = _requests[slot];
+        h._first = req.next;
+        if (!h.has_requests()) {
+            h._last = priority_class::no_slot;
+        }
+        --_requests_queued;
+        ++_requests_executing;
+
+        h._ops_bucket.consume(1);
+        h._bytes_bucket.consume(req.desc.size);
+        _ops_bucket.consume(1);
+        _bytes_bucket.consume(req.desc.size);
+        if (_shared_capacity) {
+            _shared_capacity->consume(req.desc.size, now);
+        }
+
+        auto req_cost  = req.desc.weight / h._shares;
+        auto pr = std::move(req.pr);
+        free_request(slot);
+        pr.set_value();
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+        auto cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
+        float next_accumulated = h._accumulated + cost;
+        while (std::isinf(next_accumulated)) {
+            normalize_stats();
+            // If we have renormalized, our time base will have changed. This should happen very infrequently
+            delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+            cost  = expf(1.0f/_tau.count() * delta.count()) * req_cost;
+            next_accumulated = h._accumulated + cost;
+        }
+        h._accumulated = next_accumulated;
+
+        if (h.has_requests()) {
+            sift_down(h._heap_index);
+        } else {
+            remove_priority_class(h);
+        }
+    }
+
+    void dispatch_requests() {
+        while (_requests_queued && _requests_executing < _capacity) {
+            auto now = std::chrono::steady_clock::now();
+            _ops_bucket.refill(now);
+            _bytes_bucket.refill(now);
+            if (throttled()) {
+                throttle_until(std::max(_ops_bucket.time_to_ready(), _bytes_bucket.time_to_ready()));
+                return;
+            }
+            if (_shared_capacity) {
+                auto delay = _shared_capacity->time_to_ready(now);
+                if (delay.count()) {
+                    throttle_until(delay);
+                    return;
+                }
+            }
+            auto h = pick_priority_class(now);
+            if (!h || (_shared_capacity && !_shared_capacity->try_acquire())) {
+                return;
+            }
+            dispatch_one(*h, now);
+        }
     }
 
     float normalize_factor() const {
         return std::numeric_limits<float>::min();
     }
 
+    // Only the classes with pending requests are scaled here. Idle ones catch
+    // up when they are queued again, by comparing their epoch to ours.
     void normalize_stats() {
         auto time_delta = std::log(normalize_factor()) * _tau;
         // time_delta is negative; and this may advance _base into the future
         _base -= std::chrono::duration_cast<clock_type::duration>(time_delta);
-        for (auto& pc: _all_classes) {
+        ++_epoch;
+        for (auto pc: _handles) {
             pc->_accumulated *= normalize_factor();
+            pc->_epoch = _epoch;
         }
     }
 public:
@@ -167,17 +590,21 @@ class fair_queue {
     /// \param capacity how many concurrent requests are allowed in this queue.
     /// \param tau the queue exponential decay parameter, as in exp(-1/tau * t)
     explicit fair_queue(unsigned capacity, std::chrono::microseconds tau = std::chrono::milliseconds(100))
-                                           : _sem(capacity)
-                                           , _capacity(capacity)
+                                           : _capacity(capacity)
                                            , _base(std::chrono::steady_clock::now())
-                                           , _tau(tau) {
+                                           , _tau(tau)
+                                           , _throttle_timer([this] { dispatch_requests(); }) {
+        _requests.reserve(capacity);
     }
+    fair_queue(const fair_queue&) = delete;
+    fair_queue(fair_queue&&) = delete;
 
     /// Registers a priority class against this fair queue.
     ///
     /// \param shares, how many shares to create this class with
     priority_class_ptr register_priority_class(uint32_t shares) {
         priority_class_ptr pclass = make_lw_shared<priority_class>(shares);
+        pclass->_epoch = _epoch;
         _all_classes.insert(pclass);
         return pclass;
     }
@@ -186,47 +613,131 @@ class fair_queue {
     ///
     /// It is illegal to unregister a priority class that still have pending requests.
     void unregister_priority_class(priority_class_ptr pclass) {
-        assert(pclass->_queue.empty());
+        assert(!pclass->has_requests());
         _all_classes.erase(pclass);
     }
 
     /// \return how many waiters are currently queued for all classes.
     size_t waiters() const {
-        return _sem.waiters();
+        return _requests_queued;
     }
 
-    /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight
+    /// \return how many requests are currently executing.
+    size_t requests_executing() const {
+        return _requests_executing;
+    }
+
+    /// Makes this queue draw from \c shared as well as from its own capacity.
+    ///
+    /// \param waiter_id the number \c shared knows this queue by as a waiter
+    ///
+    /// Must be called before any request is queued.
+    void share_capacity(fair_queue_shared_capacity& shared, unsigned waiter_id) {
+        assert(!_requests_queued && !_requests_executing);
+        _shared_capacity = &shared;
+        _waiter_id = waiter_id;
+    }
+
+    /// \return whether a request could be dispatched now, capacity-wise.
+    bool has_capacity() const {
+        return _requests_executing < _capacity && (!_shared_capacity || _shared_capacity->available());
+    }
+
+    /// Prepares for the owner of the queue to go to sleep
+    ///
+    /// Requests waiting for shared capacity are dispatched as our own ones
+    /// complete. If none is executing, the queue registers as a waiter of the
+    /// shared capacity, to be woken up by the next unit another queue returns.
+    ///
+    /// \return whether the owner may go to sleep; if not, capacity is available
+    ///         and \ref dispatch_waiting() should be called instead.
+    bool wait_for_capacity() {
+        if (!_shared_capacity || !_requests_queued || _requests_executing) {
+            return true;
+        }
+        return _shared_capacity->wait(_waiter_id);
+    }
+
+    /// Stops waiting for shared capacity, on wakeup or if the owner did not sleep
+    void stop_waiting_for_capacity() {
+        if (_shared_capacity) {
+            _shared_capacity->cancel_wait(_waiter_id);
+        }
+    }
+
+    /// Dispatches the requests that wait for capacity
+    ///
+    /// A queue dispatches requests by itself as its own ones complete, but
+    /// capacity shared with other queues may also be returned by them. Their
+    /// owner then has to call this.
+    ///
+    /// \return whether any request was dispatched
+    bool dispatch_waiting() {
+        auto queued = _requests_queued;
+        if (queued) {
+            dispatch_requests();
+        }
+        return _requests_queued != queued;
+    }
+
+    /// Executes the function \c func through this class' \ref fair_queue, as described by \c desc
     ///
     /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
     template <typename Func>
-    futurize_t<std::result_of_t<Func()>> queue(priority_class_ptr pc, unsigned weight, Func func) {
+    futurize_t<std::result_of_t<Func()>> queue(const priority_class_ptr& pc, fair_queue_request_descriptor desc, Func func) {
         // We need to return a future in this function on which the caller can wait.
         // Since we don't know which queue we will use to execute the next request - if ours or
         // someone else's, we need a separate promise at this point.
         promise<> pr;
         auto fut = pr.get_future();
 
-        push_priority_class(pc);
-        pc->_queue.push_back(priority_class::request{std::move(pr), weight});
-        try {
-            execute_one();
-        } catch (...) {
-            pc->_queue.pop_back();
-            throw;
-        }
+        push_request(*pc, std::move(pr), desc);
+        push_priority_class(*pc);
+        ++_requests_queued;
+        dispatch_requests();
         return fut.then([func = std::move(func)] {
             return func();
         }).finally([this] {
-            _sem.signal();
+            --_requests_executing;
+            if (_shared_capacity) {
+                _shared_capacity->release();
+            }
+            dispatch_requests();
         });
     }
 
+    /// Executes the function \c func through this class' \ref fair_queue, with weight \c weight
+    ///
+    /// \return \c func's return value, if \c func returns a future, or future<T> if \c func returns a non-future of type T.
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> queue(const priority_class_ptr& pc, unsigned weight, Func func) {
+        return queue(pc, fair_queue_request_descriptor{float(weight), 0}, std::move(func));
+    }
+
     /// Updates the current shares of this priority class
     ///
     /// \param new_shares the new number of shares for this priority class
-    static void update_shares(priority_class_ptr pc, uint32_t new_shares) {
+    static void update_shares(const priority_class_ptr& pc, uint32_t new_shares) {
         pc->_shares = new_shares;
     }
+
+    /// Updates the throughput limits of this priority class
+    ///
+    /// \param limits the new limits, zero fields meaning unlimited
+    void update_limits(const priority_class_ptr& pc, fair_queue_limits limits) {
+        pc->_ops_bucket.set_rate(limits.ops_per_second);
+        pc->_bytes_bucket.set_rate(limits.bytes_per_second);
+        dispatch_requests();
+    }
+
+    /// Updates the throughput limits of the queue as a whole, shared by all classes
+    ///
+    /// \param limits the new limits, zero fields meaning unlimited
+    void update_limits(fair_queue_limits limits) {
+        _ops_bucket.set_rate(limits.ops_per_second);
+        _bytes_bucket.set_rate(limits.bytes_per_second);
+        dispatch_requests();
+    }
 };
 /// @}
 
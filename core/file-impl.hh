@@ -62,6 +62,9 @@ class posix_file_impl : public file_impl {
     virtual std::unique_ptr<seastar::file_handle_impl> dup() override;
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override;
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc);
+    virtual int get_fd() override {
+        return _fd;
+    }
 private:
     void query_dma_alignment();
 
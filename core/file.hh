@@ -136,6 +136,11 @@ class file_impl {
     virtual std::unique_ptr<file_handle_impl> dup();
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) = 0;
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) = 0;
+    // The kernel file descriptor behind the file, for zero-copy transfers,
+    // or -1 if there is none.
+    virtual int get_fd() {
+        return -1;
+    }
 
     friend class reactor;
 };
@@ -430,6 +435,14 @@ class file {
     ///
     file_handle dup();
 
+    /// \cond internal
+    /// \return the kernel file descriptor behind the file, or -1 if the file
+    /// is not backed by one
+    int get_fd() {
+        return _file_impl->get_fd();
+    }
+    /// \endcond
+
     template <typename CharType>
     struct read_state;
 private:
@@ -23,12 +23,88 @@
 #include "align.hh"
 #include "circular_buffer.hh"
 #include "semaphore.hh"
+#include "shared_future.hh"
+#include "gate.hh"
 #include "reactor.hh"
+#include "do_with.hh"
+#include "future-util.hh"
 #include <malloc.h>
 #include <string.h>
 
 namespace seastar {
 
+void file_input_stream_history::read_completed(clock::time_point issued, clock::time_point now, uint64_t bytes) {
+    auto& w = current_device_window;
+    auto l = now - issued;
+    latency = w.samples + previous_device_window.samples ? latency + (l - latency) / 8 : l;
+    w.bytes += bytes;
+    w.min_latency = std::min(w.min_latency, l);
+    if (!--reads_in_flight) {
+        w.busy_time += now - busy_since;
+    }
+    if (++w.samples == device_window_samples) {
+        if (reads_in_flight) {
+            w.busy_time += now - busy_since;
+            busy_since = now;
+        }
+        // The latency of reads queued up in the device says nothing of the
+        // device's own, so the lowest one seen before is kept for a while.
+        // It is let go eventually, in case the device did get slower.
+        auto keep = saturated() && ++queued_windows <= max_queued_windows;
+        if (!keep) {
+            queued_windows = 0;
+        }
+        auto lowest = min_latency();
+        previous_device_window = w;
+        w = { };
+        if (keep) {
+            w.min_latency = lowest;
+        }
+    }
+}
+
+uint64_t file_input_stream_history::bandwidth() const {
+    auto bytes = current_device_window.bytes + previous_device_window.bytes;
+    auto busy = std::chrono::duration<double>(current_device_window.busy_time + previous_device_window.busy_time).count();
+    return busy > 0 ? bytes / busy : 0;
+}
+
+uint64_t file_input_stream_history::bandwidth_delay_product() const {
+    if (!current_device_window.samples && !previous_device_window.samples) {
+        return 0;
+    }
+    return bandwidth() * std::chrono::duration<double>(min_latency()).count();
+}
+
+uint64_t file_input_stream_history::read_ahead_budget(uint64_t max_bytes) const {
+    if (!saturated()) {
+        return max_bytes;
+    }
+    return std::min(max_bytes, bandwidth_delay_product() * 5 / 4);
+}
+
+file_access_pattern file_input_stream_history::classify_stream(uint64_t offset, uint64_t len) const {
+    auto n = std::min(recent_count, recent_streams);
+    if (!n) {
+        return file_access_pattern::unknown;
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        if (offset == recent[i].end) {
+            return file_access_pattern::sequential;
+        }
+    }
+    for (unsigned i = 0; i < n; ++i) {
+        if (offset < recent[i].start && recent[i].start - offset <= len) {
+            return file_access_pattern::backward;
+        }
+    }
+    return file_access_pattern::random;
+}
+
+void file_input_stream_history::stream_closed(uint64_t start, uint64_t end) {
+    recent[recent_count++ % recent_streams] = stream_range{start, end};
+}
+
 class file_data_source_impl : public data_source_impl {
     struct issued_read {
         uint64_t _pos;
@@ -42,8 +118,14 @@ class file_data_source_impl : public data_source_impl {
     reactor& _reactor = engine();
     file _file;
     file_input_stream_options _options;
+    bool _adaptive;
+    uint64_t _start;
+    // Position of the next read to issue and the bytes left after it.
     uint64_t _pos;
     uint64_t _remain;
+    // Position of the next byte the consumer expects. Read-ahead buffers
+    // start there, unless a skip was predicted.
+    uint64_t _consumer_pos;
     circular_buffer<issued_read> _read_buffers;
     unsigned _reads_in_progress = 0;
     unsigned _current_read_ahead;
@@ -51,8 +133,45 @@ class file_data_source_impl : public data_source_impl {
     std::experimental::optional<promise<>> _done;
     size_t _current_buffer_size;
     bool _in_slow_start = false;
+    // Strided access detection: the consumer reading _stride_read bytes,
+    // then skipping _stride_skip bytes, over and over.
+    uint64_t _consumed_since_skip = 0;
+    uint64_t _stride_read = 0;
+    uint64_t _stride_skip = 0;
+    unsigned _stride_repeats = 0;
+    uint64_t _run_remain = 0; // bytes to read before the next predicted skip
+    // With adaptive read-ahead, buffers are sized after the waste of the
+    // stream itself, starting from what the history learned, so that a
+    // stream dropping read-aheads does not shrink those of the others.
+    using window = file_input_stream_history::window;
+    window _current_window;
+    window _previous_window;
     using unused_ratio_target = std::ratio<25, 100>;
+    static constexpr unsigned stride_confirmations = 2;
 private:
+    static file_input_stream_options with_history(file_input_stream_options options) {
+        if (options.max_read_ahead_bytes && !options.dynamic_adjustments) {
+            options.dynamic_adjustments = make_lw_shared<file_input_stream_history>();
+        }
+        return options;
+    }
+    file_input_stream_history& history() const {
+        return *_options.dynamic_adjustments;
+    }
+    bool strided() const {
+        return _adaptive && _stride_repeats >= stride_confirmations;
+    }
+    // With adaptive read-ahead, the concurrent streams share the
+    // max_read_ahead_bytes budget, which shrinks to a little more than the
+    // bandwidth-delay product once the device starts queueing reads.
+    unsigned max_read_ahead() const {
+        if (!_adaptive) {
+            return _options.read_ahead;
+        }
+        auto& h = history();
+        auto budget = h.read_ahead_budget(_options.max_read_ahead_bytes) / std::max(h.active_streams, 1u);
+        return std::max(budget / _current_buffer_size, uint64_t(1));
+    }
     size_t minimal_buffer_size() const {
         return std::min(std::max(_options.buffer_size / 4, size_t(8192)), _options.buffer_size);
     }
@@ -61,7 +180,7 @@ class file_data_source_impl : public data_source_impl {
         // Read-ahead can be increased up to user-specified limit if the
         // consumer has to wait for a buffer and we are not in a slow start
         // phase.
-        if (_current_read_ahead < _options.read_ahead && !_in_slow_start) {
+        if (_current_read_ahead < max_read_ahead() && !_in_slow_start) {
             _current_read_ahead++;
             if (_options.dynamic_adjustments) {
                 auto& h = *_options.dynamic_adjustments;
@@ -75,17 +194,29 @@ class file_data_source_impl : public data_source_impl {
                : !!_options.read_ahead;
     }
 
-    void update_history(uint64_t unused, uint64_t total) {
+    const window& current_window() const {
+        return _adaptive ? _current_window : _options.dynamic_adjustments->current_window;
+    }
+    const window& previous_window() const {
+        return _adaptive ? _previous_window : _options.dynamic_adjustments->previous_window;
+    }
+    static void update_windows(window& current, window& previous, uint64_t unused, uint64_t total) {
         // We are maintaining two windows each no larger than window_size.
         // Dynamic adjustment logic uses data from both of them, which
         // essentially means that the actual window size is variable and
         // in the range [window_size, 2*window_size].
+        current.total_read += total;
+        current.unused_read += unused;
+        if (current.total_read >= file_input_stream_history::window_size) {
+            previous = current;
+            current = { };
+        }
+    }
+    void update_history(uint64_t unused, uint64_t total) {
         auto& h = *_options.dynamic_adjustments;
-        h.current_window.total_read += total;
-        h.current_window.unused_read += unused;
-        if (h.current_window.total_read >= h.window_size) {
-            h.previous_window = h.current_window;
-            h.current_window = { };
+        update_windows(h.current_window, h.previous_window, unused, total);
+        if (_adaptive) {
+            update_windows(_current_window, _previous_window, unused, total);
         }
     }
     static bool below_target(uint64_t unused, uint64_t total) {
@@ -96,13 +227,13 @@ class file_data_source_impl : public data_source_impl {
             return;
         }
         update_history(0, bytes);
+        _options.dynamic_adjustments->read_bytes += bytes;
         if (!_in_slow_start) {
             return;
         }
         unsigned new_size = std::min(_current_buffer_size * 2, _options.buffer_size);
-        auto& h = *_options.dynamic_adjustments;
-        auto total = h.current_window.total_read + h.previous_window.total_read + new_size;
-        auto unused = h.current_window.unused_read + h.previous_window.unused_read + new_size;
+        auto total = current_window().total_read + previous_window().total_read + new_size;
+        auto unused = current_window().unused_read + previous_window().unused_read + new_size;
         // Check whether we can safely increase the buffer size to new_size
         // and still be below unused_ratio_target even if it is entirely
         // dropped.
@@ -117,9 +248,8 @@ class file_data_source_impl : public data_source_impl {
         if (!_options.dynamic_adjustments) {
             return;
         }
-        auto& h = *_options.dynamic_adjustments;
-        int64_t total = h.current_window.total_read + h.previous_window.total_read;
-        int64_t unused = h.current_window.unused_read + h.previous_window.unused_read;
+        int64_t total = current_window().total_read + previous_window().total_read;
+        int64_t unused = current_window().unused_read + previous_window().unused_read;
         if (skip == after_skip::yes && below_target(unused, total)) {
             // Do not attempt to shrink buffer size if we are still below the
             // target. Otherwise, we could get a bad interaction with
@@ -147,6 +277,7 @@ class file_data_source_impl : public data_source_impl {
             return;
         }
         update_history(bytes, bytes);
+        _options.dynamic_adjustments->wasted_bytes += bytes;
         set_new_buffer_size(after_skip::yes);
     }
     // Safely ignores read future even if it is not resolved yet.
@@ -158,21 +289,90 @@ class file_data_source_impl : public data_source_impl {
         auto f = read_future.then_wrapped([] (auto f) { f.ignore_ready_future(); });
         _dropped_reads = _dropped_reads.then([f = std::move(f)] () mutable { return std::move(f); });
     }
+    uint64_t discard(issued_read& r) {
+        _reactor._io_stats.fstream_read_aheads_discarded += 1;
+        _reactor._io_stats.fstream_read_ahead_discarded_bytes += r._size;
+        ignore_read_future(std::move(r._ready));
+        return r._size;
+    }
+    // Drops all read-ahead buffers and reads on from the consumer position.
+    void discard_read_aheads() {
+        uint64_t dropped = 0;
+        while (!_read_buffers.empty()) {
+            dropped += discard(_read_buffers.front());
+            _read_buffers.pop_front();
+        }
+        update_history_unused(dropped);
+        reposition(_consumer_pos);
+    }
+    void reposition(uint64_t pos) {
+        auto end = _pos + _remain;
+        assert(pos <= end);
+        _pos = pos;
+        _remain = end - pos;
+        _run_remain = strided() ? _stride_read : 0;
+    }
+    // Returns true when the skip confirms a stride.
+    bool detect_stride(uint64_t n) {
+        auto consumed = std::exchange(_consumed_since_skip, 0);
+        if (n == _stride_skip && consumed == _stride_read && consumed) {
+            if (++_stride_repeats == stride_confirmations) {
+                history().pattern = file_access_pattern::strided;
+                return true;
+            }
+            return false;
+        }
+        _stride_read = consumed;
+        _stride_skip = n;
+        _stride_repeats = 0;
+        return false;
+    }
 public:
     file_data_source_impl(file f, uint64_t offset, uint64_t len, file_input_stream_options options)
-            : _file(std::move(f)), _options(options), _pos(offset), _remain(len), _current_read_ahead(get_initial_read_ahead())
+            : _file(std::move(f)), _options(with_history(std::move(options))), _adaptive(_options.max_read_ahead_bytes)
+            , _start(offset), _pos(offset), _remain(len), _consumer_pos(offset), _current_read_ahead(get_initial_read_ahead())
             , _current_buffer_size(_options.buffer_size) {
+        if (_adaptive) {
+            _current_window = history().current_window;
+            _previous_window = history().previous_window;
+        }
         // prevent wraparounds
         set_new_buffer_size(after_skip::no);
         _remain = std::min(std::numeric_limits<uint64_t>::max() - _pos, _remain);
+        if (_adaptive) {
+            auto& h = history();
+            ++h.active_streams;
+            h.pattern = h.classify_stream(_pos, _remain);
+            // A stream continuing earlier ones is likely to be read to its
+            // end, like them.
+            auto continues = h.pattern == file_access_pattern::sequential || h.pattern == file_access_pattern::backward;
+            _current_read_ahead = continues ? max_read_ahead() : std::min(_current_read_ahead, max_read_ahead());
+        }
+    }
+    ~file_data_source_impl() {
+        if (_adaptive) {
+            auto& h = history();
+            --h.active_streams;
+            h.stream_closed(_start, _consumer_pos);
+        }
     }
     virtual future<temporary_buffer<char>> get() override {
+        if (!_read_buffers.empty() && _read_buffers.front()._pos != _consumer_pos) {
+            // The consumer did not skip as predicted.
+            _stride_repeats = 0;
+            discard_read_aheads();
+        }
+        if (_adaptive) {
+            _current_read_ahead = std::min(_current_read_ahead, max_read_ahead());
+        }
         if (!_read_buffers.empty() && !_read_buffers.front()._ready.available()) {
             try_increase_read_ahead();
         }
         issue_read_aheads(1);
         auto ret = std::move(_read_buffers.front());
         _read_buffers.pop_front();
+        _consumer_pos += ret._size;
+        _consumed_since_skip += ret._size;
         update_history_consumed(ret._size);
         _reactor._io_stats.fstream_reads += 1;
         _reactor._io_stats.fstream_read_bytes += ret._size;
@@ -183,33 +383,40 @@ class file_data_source_impl : public data_source_impl {
         return std::move(ret._ready);
     }
     virtual future<temporary_buffer<char>> skip(uint64_t n) override {
+        auto stride_confirmed = _adaptive && detect_stride(n);
+        auto target = _consumer_pos + n;
+        _consumer_pos = target;
         uint64_t dropped = 0;
-        while (n) {
-            if (_read_buffers.empty()) {
-                assert(n <= _remain);
-                _pos += n;
-                _remain -= n;
-                break;
-            }
+        while (!_read_buffers.empty()) {
             auto& front = _read_buffers.front();
-            if (n < front._size) {
-                front._size -= n;
-                front._pos += n;
-                front._ready = front._ready.then([n] (temporary_buffer<char> buf) {
-                    buf.trim_front(n);
+            if (front._pos + front._size <= target) {
+                dropped += discard(front);
+                _read_buffers.pop_front();
+                continue;
+            }
+            if (front._pos < target) {
+                auto trim = target - front._pos;
+                front._size -= trim;
+                front._pos = target;
+                front._ready = front._ready.then([trim] (temporary_buffer<char> buf) {
+                    buf.trim_front(trim);
                     return buf;
                 });
-                break;
-            } else {
-                ignore_read_future(std::move(front._ready));
-                n -= front._size;
-                dropped += front._size;
-                _reactor._io_stats.fstream_read_aheads_discarded += 1;
-                _reactor._io_stats.fstream_read_ahead_discarded_bytes += front._size;
-                _read_buffers.pop_front();
             }
+            break;
         }
         update_history_unused(dropped);
+        if (_read_buffers.empty()) {
+            reposition(target);
+        } else if (_read_buffers.front()._pos != target) {
+            // Skipped less than predicted.
+            _stride_repeats = 0;
+            discard_read_aheads();
+        } else if (stride_confirmed) {
+            // The buffers were read ahead sequentially, before the stride
+            // was known; start over with the holes.
+            discard_read_aheads();
+        }
         return make_ready_future<temporary_buffer<char>>();
     }
     virtual future<> close() {
@@ -220,10 +427,7 @@ class file_data_source_impl : public data_source_impl {
         return _done->get_future().then([this] {
             uint64_t dropped = 0;
             for (auto&& c : _read_buffers) {
-                _reactor._io_stats.fstream_read_aheads_discarded += 1;
-                _reactor._io_stats.fstream_read_ahead_discarded_bytes += c._size;
-                dropped += c._size;
-                ignore_read_future(std::move(c._ready));
+                dropped += discard(c);
             }
             update_history_unused(dropped);
             return std::move(_dropped_reads);
@@ -237,6 +441,13 @@ class file_data_source_impl : public data_source_impl {
         auto ra = _current_read_ahead + additional;
         _read_buffers.reserve(ra); // prevent push_back() failure
         while (_read_buffers.size() < ra) {
+            if (strided() && !_run_remain) {
+                // Jump over the bytes the consumer is expected to skip.
+                auto gap = std::min(_stride_skip, _remain);
+                _pos += gap;
+                _remain -= gap;
+                _run_remain = _stride_read;
+            }
             if (!_remain) {
                 if (_read_buffers.size() >= additional) {
                     return;
@@ -250,22 +461,37 @@ class file_data_source_impl : public data_source_impl {
             uint64_t align = _file.disk_read_dma_alignment();
             auto start = align_down(_pos, align);
             auto end = std::min(align_up(start + _current_buffer_size, align), _pos + _remain);
+            if (strided()) {
+                end = std::min(end, _pos + _run_remain);
+                _run_remain -= end - _pos;
+            }
             auto len = end - start;
             auto actual_size = std::min(end - _pos, _remain);
+            auto issued = file_input_stream_history::clock::time_point();
+            if (_adaptive) {
+                issued = file_input_stream_history::clock::now();
+                history().read_issued(issued);
+            }
             _read_buffers.emplace_back(_pos, actual_size, futurize<future<temporary_buffer<char>>>::apply([&] {
                     return _file.dma_read_bulk<char>(start, len, _options.io_priority_class);
             }).then_wrapped(
-                    [this, start, pos = _pos, remain = _remain] (future<temporary_buffer<char>> ret) {
+                    [this, start, pos = _pos, remain = _remain, issued] (future<temporary_buffer<char>> ret) {
                 --_reads_in_progress;
                 if (_done && !_reads_in_progress) {
                     _done->set_value();
                 }
                 if (ret.failed()) {
+                    if (_adaptive) {
+                        history().read_completed(issued, file_input_stream_history::clock::now(), 0);
+                    }
                     // no games needed
                     return ret;
                 } else {
                     // first or last buffer, need trimming
                     auto tmp = ret.get0();
+                    if (_adaptive) {
+                        history().read_completed(issued, file_input_stream_history::clock::now(), tmp.size());
+                    }
                     auto real_end = start + tmp.size();
                     if (real_end <= pos) {
                         return make_ready_future<temporary_buffer<char>>();
@@ -308,6 +534,46 @@ input_stream<char> make_file_input_stream(
     return make_file_input_stream(std::move(f), 0, std::move(options));
 }
 
+static future<> put_file_buffers(data_sink_impl& sink, file f, uint64_t offset, uint64_t len) {
+    file_input_stream_options options;
+    options.buffer_size = 128 * 1024;
+    options.read_ahead = 1;
+    return do_with(make_file_input_stream(std::move(f), offset, len, std::move(options)), len, [&sink] (input_stream<char>& in, uint64_t& remain) {
+        return repeat([&sink, &in, &remain] {
+            return in.read().then([&sink, &remain] (temporary_buffer<char> buf) {
+                if (buf.empty()) {
+                    if (remain) {
+                        throw file::eof_error();
+                    }
+                    return make_ready_future<stop_iteration>(stop_iteration::yes);
+                }
+                remain -= buf.size();
+                return sink.put(std::move(buf)).then([] {
+                    return stop_iteration::no;
+                });
+            });
+        }).finally([&in] {
+            return in.close();
+        });
+    });
+}
+
+future<> file_range_data_sink_impl::put_buffers(file f, uint64_t offset, uint64_t len) {
+    return put_file_buffers(*this, std::move(f), offset, len);
+}
+
+future<> write_file(output_stream<char>& out, file f, uint64_t offset, uint64_t len) {
+    if (!len) {
+        return make_ready_future<>();
+    }
+    return out.put_direct([f = std::move(f), offset, len] (data_sink& sink) mutable {
+        auto impl = sink._dsi.get();
+        if (auto range_sink = dynamic_cast<file_range_data_sink_impl*>(impl)) {
+            return range_sink->put(std::move(f), offset, len);
+        }
+        return put_file_buffers(*impl, std::move(f), offset, len);
+    });
+}
 
 class file_data_sink_impl : public data_sink_impl {
     file _file;
@@ -436,5 +702,274 @@ output_stream<char> make_file_output_stream(file f, file_output_stream_options o
     return output_stream<char>(file_data_sink(std::move(f), options), options.buffer_size, true);
 }
 
+class file_appender::impl {
+    file _file;
+    file_appender_options _options;
+    size_t _alignment;
+    uint64_t _size;
+    // Buffer holding the data at [_buf_pos, _size), and the part of it
+    // already covered by an issued write.
+    temporary_buffer<char> _buf;
+    uint64_t _buf_pos;
+    size_t _buf_written = 0;
+    // A partially written buffer is written again once it has more data;
+    // the writes must not overlap, so each one waits for the previous.
+    future<> _tail_written = make_ready_future<>();
+    semaphore _write_behind_sem;
+    future<> _writes_done = make_ready_future<>();
+    std::exception_ptr _ex;
+    // File extents are allocated up to _allocated; writes wait for a
+    // pending allocation, since it zeroes the range it covers.
+    uint64_t _allocated;
+    shared_future<> _allocation = make_ready_future<>();
+    uint64_t _synced;
+    uint64_t _sync_target = 0;
+    std::experimental::optional<shared_promise<>> _current_sync;
+    std::experimental::optional<shared_promise<>> _next_sync;
+    gate _gate;
+    uint64_t _writes = 0;
+    uint64_t _syncs = 0;
+public:
+    impl(file f, file_appender_options options, uint64_t size)
+            : _file(std::move(f))
+            , _options(options)
+            , _alignment(_file.disk_write_dma_alignment())
+            , _size(size)
+            , _buf(temporary_buffer<char>::aligned(_file.memory_dma_alignment(), align_up<size_t>(_options.buffer_size, _alignment)))
+            , _buf_pos(align_down(size, _alignment))
+            , _write_behind_sem(std::max(_options.write_behind, 1u))
+            , _allocated(align_up(size, _alignment))
+            , _synced(size) {
+        _write_behind_sem.ensure_space_for_waiters(1); // So that wait() doesn't throw
+        preallocate();
+    }
+    future<> read_tail() {
+        if (_buf_pos == _size) {
+            return make_ready_future<>();
+        }
+        return _file.dma_read(_buf_pos, _buf.get_write(), _alignment, _options.io_priority_class).then([this] (size_t size) {
+            if (size < _size - _buf_pos) {
+                throw std::runtime_error("short read of the file tail");
+            }
+            _buf_written = _size - _buf_pos;
+            std::fill(_buf.get_write() + _buf_written, _buf.get_write() + _alignment, 0);
+        });
+    }
+    future<uint64_t> append(const char* data, size_t len) {
+        if (_ex) {
+            return make_exception_future<uint64_t>(_ex);
+        }
+        auto pos = _size;
+        bool filled = false;
+        while (len) {
+            auto off = _size - _buf_pos;
+            auto n = std::min(len, _buf.size() - off);
+            std::copy_n(data, n, _buf.get_write() + off);
+            _size += n;
+            data += n;
+            len -= n;
+            if (off + n == _buf.size()) {
+                write_buffer();
+                filled = true;
+            }
+        }
+        if (!filled) {
+            return make_ready_future<uint64_t>(pos);
+        }
+        // Waits behind the buffers which are yet to be written.
+        return _write_behind_sem.wait(0).then([pos] {
+            return pos;
+        });
+    }
+    future<> sync() {
+        if (_ex) {
+            return make_exception_future<>(_ex);
+        }
+        if (_size == _synced) {
+            return make_ready_future<>();
+        }
+        if (_current_sync && _size <= _sync_target) {
+            return _current_sync->get_shared_future();
+        }
+        if (!_next_sync) {
+            _next_sync.emplace();
+        }
+        auto ret = _next_sync->get_shared_future();
+        if (!_current_sync) {
+            start_sync();
+        }
+        return ret;
+    }
+    future<> close() {
+        return sync().then_wrapped([this] (future<> synced) {
+            auto ex = synced.failed() ? synced.get_exception() : std::exception_ptr();
+            // Even if the sync failed, writes may still be in flight, and
+            // they use this object and the file until they complete.
+            return _gate.close().then([this] {
+                return std::exchange(_writes_done, make_ready_future<>());
+            }).handle_exception([] (std::exception_ptr) {
+                // Reported by the sync
+            }).then([this] {
+                // The last preallocation may not be covered by any write
+                return _allocation.get_future();
+            }).then([this, ex] {
+                if (ex) {
+                    return make_exception_future<>(ex);
+                }
+                return _file.truncate(_size).then([this] {
+                    return _file.flush();
+                });
+            }).finally([this] {
+                return _file.close();
+            });
+        });
+    }
+    uint64_t size() const {
+        return _size;
+    }
+    uint64_t writes() const {
+        return _writes;
+    }
+    uint64_t syncs() const {
+        return _syncs;
+    }
+private:
+    void write_buffer() {
+        auto len = _buf.size();
+        submit(_buf_pos, std::exchange(_buf, temporary_buffer<char>::aligned(_file.memory_dma_alignment(), len)), len, false);
+        _buf_pos += len;
+        _buf_written = 0;
+        preallocate();
+    }
+    void write_tail() {
+        auto filled = _size - _buf_pos;
+        if (filled == _buf_written) {
+            return;
+        }
+        _buf_written = filled;
+        auto len = align_up(filled, _alignment);
+        std::fill(_buf.get_write() + filled, _buf.get_write() + len, 0);
+        submit(_buf_pos, _buf.share(), len, true);
+    }
+    void submit(uint64_t pos, temporary_buffer<char> buf, size_t len, bool partial) {
+        ++_writes;
+        auto prev = std::exchange(_tail_written, make_ready_future<>());
+        auto done = _write_behind_sem.wait().then([this, pos, buf = std::move(buf), len, prev = std::move(prev)] () mutable {
+            return prev.then([this, pos, buf = std::move(buf), len] () mutable {
+                return _allocation.get_future().then([this, pos, buf = std::move(buf), len] () mutable {
+                    return _file.dma_write(pos, buf.get(), len, _options.io_priority_class).then([buf = std::move(buf)] (size_t) {});
+                });
+            }).finally([this] {
+                _write_behind_sem.signal();
+            });
+        });
+        if (partial) {
+            promise<> pr;
+            _tail_written = pr.get_future();
+            done = done.finally([pr = std::move(pr)] () mutable {
+                pr.set_value();
+            });
+        }
+        _writes_done = when_all(std::move(_writes_done), std::move(done)).then([this] (std::tuple<future<>, future<>> possible_errors) {
+            // merge the two errors, preferring the first
+            auto& e1 = std::get<0>(possible_errors);
+            auto& e2 = std::get<1>(possible_errors);
+            if (e1.failed()) {
+                e2.ignore_ready_future();
+                return std::move(e1);
+            }
+            if (e2.failed() && !_ex) {
+                _ex = e2.get_exception();
+                return make_exception_future<>(_ex);
+            }
+            return std::move(e2);
+        });
+    }
+    void preallocate() {
+        auto end = _buf_pos + _buf.size();
+        if (!_options.preallocation_size || end + _options.preallocation_size / 2 <= _allocated) {
+            return;
+        }
+        auto from = _allocated;
+        auto len = align_up(std::max(_options.preallocation_size, end - from), uint64_t(_alignment));
+        _allocated += len;
+        // Best effort: a failure shows up again in the writes.
+        _allocation = _allocation.get_future().then([this, from, len] {
+            return _file.allocate(from, len);
+        }).handle_exception([] (std::exception_ptr) {});
+    }
+    void start_sync() {
+        _current_sync = std::move(_next_sync);
+        _next_sync = {};
+        _sync_target = _size;
+        write_tail();
+        ++_syncs;
+        with_gate(_gate, [this] {
+            return std::exchange(_writes_done, make_ready_future<>()).then([this] {
+                return _file.flush();
+            }).then_wrapped([this] (future<> f) {
+                if (f.failed()) {
+                    auto ex = f.get_exception();
+                    if (!_ex) {
+                        _ex = ex;
+                    }
+                    _current_sync->set_exception(ex);
+                } else {
+                    _synced = _sync_target;
+                    _current_sync->set_value();
+                }
+                _current_sync = {};
+                if (_next_sync) {
+                    if (_ex) {
+                        // close() may be waiting for the gate already
+                        _next_sync->set_exception(_ex);
+                        _next_sync = {};
+                    } else {
+                        start_sync();
+                    }
+                }
+            });
+        });
+    }
+};
+
+file_appender::file_appender(shared_ptr<impl> impl)
+        : _impl(std::move(impl)) {
+}
+
+future<uint64_t> file_appender::append(const char* data, size_t len) {
+    return _impl->append(data, len);
+}
+
+future<> file_appender::sync() {
+    return _impl->sync();
+}
+
+future<> file_appender::close() {
+    // Keep the state alive for the writes still in flight.
+    return _impl->close().finally([impl = _impl] {});
+}
+
+uint64_t file_appender::size() const {
+    return _impl->size();
+}
+
+uint64_t file_appender::writes() const {
+    return _impl->writes();
+}
+
+uint64_t file_appender::syncs() const {
+    return _impl->syncs();
+}
+
+future<file_appender> make_file_appender(file f, file_appender_options options) {
+    return f.size().then([f, options] (uint64_t size) {
+        auto impl = make_shared<file_appender::impl>(std::move(f), options, size);
+        return impl->read_tail().then([impl] {
+            return file_appender(impl);
+        });
+    });
+}
+
 }
 
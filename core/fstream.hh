@@ -33,18 +33,107 @@
 #include "file.hh"
 #include "iostream.hh"
 #include "shared_ptr.hh"
+#include <array>
+#include <chrono>
 
 namespace seastar {
 
+/// Access pattern of the streams sharing a \ref file_input_stream_history
+enum class file_access_pattern {
+    unknown,
+    sequential, ///< streams start where earlier ones stopped
+    strided,    ///< reads of a fixed size separated by skips of a fixed size
+    backward,   ///< each stream ends where an earlier one started
+    random,
+};
+
 class file_input_stream_history {
+    using clock = std::chrono::steady_clock;
     static constexpr uint64_t window_size = 4 * 1024 * 1024;
+    static constexpr unsigned device_window_samples = 64;
+    static constexpr unsigned max_queued_windows = 4;
+    static constexpr unsigned recent_streams = 4;
     struct window {
         uint64_t total_read = 0;
         uint64_t unused_read = 0;
     };
+    // Completed reads, kept over two windows like the reads above, from
+    // which the bandwidth-delay product of the device is estimated.
+    struct device_window {
+        uint64_t bytes = 0;
+        clock::duration busy_time = clock::duration::zero();
+        clock::duration min_latency = clock::duration::max();
+        unsigned samples = 0;
+    };
+    struct stream_range {
+        uint64_t start = 0;
+        uint64_t end = 0;
+    };
     window current_window;
     window previous_window;
     unsigned read_ahead = 1;
+    device_window current_device_window;
+    device_window previous_device_window;
+    clock::duration latency = clock::duration::zero(); // moving average
+    unsigned reads_in_flight = 0;
+    clock::time_point busy_since;
+    // Consecutive device windows over which reads queued up.
+    unsigned queued_windows = 0;
+    unsigned active_streams = 0;
+    // Where the last closed streams started and stopped, to tell how new
+    // streams relate to them.
+    std::array<stream_range, recent_streams> recent;
+    unsigned recent_count = 0;
+    file_access_pattern pattern = file_access_pattern::unknown;
+    uint64_t read_bytes = 0;
+    uint64_t wasted_bytes = 0;
+private:
+    clock::duration min_latency() const {
+        return std::min(current_device_window.min_latency, previous_device_window.min_latency);
+    }
+    // Whether reads queue up in the device, taking much longer than the
+    // fastest ones.
+    bool saturated() const {
+        return current_device_window.samples + previous_device_window.samples && latency > 2 * min_latency();
+    }
+    file_access_pattern classify_stream(uint64_t offset, uint64_t len) const;
+    void stream_closed(uint64_t start, uint64_t end);
+public:
+    /// Records a read issued to the device at \c now
+    void read_issued(clock::time_point now) {
+        if (!reads_in_flight++) {
+            busy_since = now;
+        }
+    }
+    /// Records the completion at \c now of a read issued at \c issued,
+    /// which returned \c bytes
+    void read_completed(clock::time_point issued, clock::time_point now, uint64_t bytes);
+    /// \return how many of \c max_bytes the streams sharing this history
+    /// may keep in flight together: all of them, until the device queues
+    /// reads; then a little more than the bandwidth-delay product
+    uint64_t read_ahead_budget(uint64_t max_bytes) const;
+    /// \return the access pattern detected by the last stream
+    file_access_pattern access_pattern() const {
+        return pattern;
+    }
+    /// \return number of streams currently open with this history
+    unsigned concurrent_streams() const {
+        return active_streams;
+    }
+    /// \return bytes per second read from the device while reads were in flight
+    uint64_t bandwidth() const;
+    /// \return bytes that must be in flight to keep the device busy, as
+    /// observed: the bandwidth times the lowest read latency
+    uint64_t bandwidth_delay_product() const;
+    /// \return bytes read by the streams
+    uint64_t total_read_bytes() const {
+        return read_bytes;
+    }
+    /// \return bytes read ahead by the streams and then dropped unused,
+    /// summed over the streams
+    uint64_t wasted_read_ahead_bytes() const {
+        return wasted_bytes;
+    }
 
     friend class file_data_source_impl;
 };
@@ -55,6 +144,13 @@ struct file_input_stream_options {
     unsigned read_ahead = 0;      ///< Maximum number of extra read-ahead operations
     ::seastar::io_priority_class io_priority_class = default_priority_class();
     lw_shared_ptr<file_input_stream_history> dynamic_adjustments = { }; ///< Input stream history, if null dynamic adjustments are disabled
+    /// If non-zero, read-ahead adapts to the device and to the access
+    /// pattern instead of being capped at \c read_ahead: up to this many
+    /// bytes, shared by the concurrent streams, are kept in flight as long
+    /// as the device keeps up, strided skips are predicted, and streams
+    /// continuing earlier ones start at full speed. Uses
+    /// \c dynamic_adjustments, or a private history if null.
+    uint64_t max_read_ahead_bytes = 0;
 };
 
 /// \brief Creates an input_stream to read a portion of a file.
@@ -102,4 +198,79 @@ output_stream<char> make_file_output_stream(
         file file,
         file_output_stream_options options);
 
+/// \brief A \ref data_sink_impl that can send ranges of files by itself
+///
+/// \ref write_file() hands file ranges to such sinks as they are, instead
+/// of reading them into buffers and putting those.
+class file_range_data_sink_impl : public data_sink_impl {
+public:
+    using data_sink_impl::put;
+    /// Sends [offset, offset + len) of \c f, failing with
+    /// \ref file::eof_error if the file ends before.
+    virtual future<> put(file f, uint64_t offset, uint64_t len) = 0;
+protected:
+    /// Sends the range by reading it into buffers and putting them, for
+    /// files the sink cannot send by itself.
+    future<> put_buffers(file f, uint64_t offset, uint64_t len);
+};
+
+/// Writes \c len bytes of a file starting at \c offset to \c out. Data
+/// written to the stream earlier is sent first. Fails with
+/// \ref file::eof_error if the file ends before, leaving the stream with
+/// only part of the range.
+///
+/// Over the posix network stack, the bytes go from the file to the socket
+/// with sendfile(2), without being copied into userspace. Sinks that are not
+/// a \ref file_range_data_sink_impl get the file read into buffers.
+future<> write_file(output_stream<char>& out, file f, uint64_t offset, uint64_t len);
+
+struct file_appender_options {
+    unsigned buffer_size = 128 << 10; ///< Size of the coalesced writes
+    unsigned write_behind = 4; ///< Number of buffers to write in parallel
+    uint64_t preallocation_size = 32 << 20; ///< Extent allocated ahead of the tail, 0 to disable
+    ::seastar::io_priority_class io_priority_class = default_priority_class();
+};
+
+/// Appends records to the end of a file on behalf of any number of
+/// concurrent producers, as a commit log does.
+///
+/// Records are copied into aligned buffers which are written once full,
+/// so many small appends become few large writes.  Extents are
+/// allocated ahead of the tail with \ref file::allocate(), so that the
+/// writes do not have to allocate blocks themselves.
+///
+/// sync() commits groups: while an fdatasync() is in progress, further
+/// sync() calls wait for one common fdatasync() issued after it.
+///
+/// The file may be padded with zeroes past the appended data until
+/// close() trims it.
+class file_appender {
+    class impl;
+    shared_ptr<impl> _impl;
+    explicit file_appender(shared_ptr<impl> impl);
+public:
+    /// Appends \c len bytes from \c data, which are copied.
+    ///
+    /// \returns the file position of the record.  The future is ready
+    ///          at once, unless the record filled a buffer and more than
+    ///          \ref file_appender_options::write_behind buffers are
+    ///          being written.
+    future<uint64_t> append(const char* data, size_t len);
+    /// Makes all the records appended so far durable.
+    future<> sync();
+    /// Syncs, trims the padding and closes the file.  No appends may follow.
+    future<> close();
+    /// Position past the last appended record.
+    uint64_t size() const;
+    /// Number of writes issued to the file.
+    uint64_t writes() const;
+    /// Number of fdatasync() calls issued to the file.
+    uint64_t syncs() const;
+
+    friend future<file_appender> make_file_appender(file f, file_appender_options options);
+};
+
+/// Creates a \ref file_appender which appends to the current end of \c f.
+future<file_appender> make_file_appender(file f, file_appender_options options = {});
+
 }
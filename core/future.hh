@@ -77,6 +77,13 @@ class promise;
 template <class... T>
 class future;
 
+namespace internal {
+
+template <typename... T>
+class future_awaiter;
+
+}
+
 template <typename... T>
 class shared_future;
 
@@ -388,14 +395,18 @@ struct future_state<> {
     void forward_to(promise<>& pr) noexcept;
 };
 
+// A task run when a future becomes available, with its state
+template <typename... T>
+struct continuation_base : task {
+    future_state<T...> _state;
+};
+
 template <typename Func, typename... T>
-struct continuation final : task {
-    continuation(Func&& func, future_state<T...>&& state) : _state(std::move(state)), _func(std::move(func)) {}
+struct continuation final : continuation_base<T...> {
     continuation(Func&& func) : _func(std::move(func)) {}
     virtual void run() noexcept override {
-        _func(std::move(_state));
+        _func(std::move(this->_state));
     }
-    future_state<T...> _state;
     Func _func;
 };
 
@@ -520,11 +531,9 @@ class promise {
         do_set_exception<urgent::yes>(std::move(ex));
     }
 private:
-    template <typename Func>
-    void schedule(Func&& func) {
-        auto tws = std::make_unique<continuation<Func, T...>>(std::move(func));
-        _state = &tws->_state;
-        _task = std::move(tws);
+    void schedule(std::unique_ptr<continuation_base<T...>> callback) {
+        _state = &callback->_state;
+        _task = std::move(callback);
     }
     template<urgent Urgent>
     __attribute__((always_inline))
@@ -722,11 +731,15 @@ class future {
     }
     template <typename Func>
     void schedule(Func&& func) {
+        schedule(std::unique_ptr<continuation_base<T...>>(new continuation<Func, T...>(std::move(func))));
+    }
+    void schedule(std::unique_ptr<continuation_base<T...>> callback) {
         if (state()->available()) {
-            ::seastar::schedule(std::make_unique<continuation<Func, T...>>(std::move(func), std::move(*state())));
+            callback->_state = std::move(*state());
+            ::seastar::schedule(std::move(callback));
         } else {
             assert(_promise);
-            _promise->schedule(std::move(func));
+            _promise->schedule(std::move(callback));
             _promise->_future = nullptr;
             _promise = nullptr;
         }
@@ -1139,6 +1152,8 @@ class future {
     friend future<U...> make_exception_future(std::exception_ptr ex) noexcept;
     template <typename... U, typename Exception>
     friend future<U...> make_exception_future(Exception&& ex) noexcept;
+    template <typename... U>
+    friend class internal::future_awaiter;
     /// \endcond
 };
 
@@ -152,6 +152,33 @@ future<> output_stream<CharType>::write(temporary_buffer<CharType> p) {
     return write(net::packet(std::move(p)));
 }
 
+// Sends what was written so far, then calls func with the sink, for data
+// that bypasses the buffers.
+template<typename CharType>
+template <typename Func>
+future<> output_stream<CharType>::put_direct(Func func) {
+    auto buffered = make_ready_future<>();
+    if (_end) {
+        _buf.trim(_end);
+        _end = 0;
+        buffered = put(std::move(_buf));
+    } else if (_zc_bufs) {
+        auto bufs = std::move(_zc_bufs);
+        buffered = zero_copy_put(std::move(bufs));
+    }
+    return buffered.then([this, func = std::move(func)] () mutable {
+        // if flush is scheduled, disable it, so it will not try to write in parallel
+        _flush = false;
+        if (_flushing) {
+            // flush in progress, wait for it to end before continuing
+            return _in_batch.value().get_future().then([this, func = std::move(func)] () mutable {
+                return func(_fd);
+            });
+        }
+        return func(_fd);
+    });
+}
+
 template <typename CharType>
 future<temporary_buffer<CharType>>
 input_stream<CharType>::read_exactly_part(size_t n, tmp_buf out, size_t completed) {
@@ -44,6 +44,9 @@ namespace seastar {
 
 namespace net { class packet; }
 
+class file;
+template <typename CharType> class output_stream;
+
 class data_source_impl {
 public:
     virtual ~data_source_impl() {}
@@ -136,6 +139,8 @@ class data_sink {
     }
     future<> close() { return _dsi->close(); }
     int get_fd() { return _dsi->get_fd(); }
+
+    friend future<> write_file(output_stream<char>& out, file f, uint64_t offset, uint64_t len);
 };
 
 template <typename CharType>
@@ -239,6 +244,8 @@ class output_stream final {
     size_t possibly_available() const { return _size - _begin; }
     future<> split_and_put(temporary_buffer<CharType> buf);
     future<> put(temporary_buffer<CharType> buf);
+    template <typename Func>
+    future<> put_direct(Func func);
     void poll_flush(bool one_more_flush= false);
     future<> zero_copy_put(net::packet p);
     future<> zero_copy_split_and_put(net::packet p);
@@ -280,6 +287,7 @@ class output_stream final {
     int get_fd();
 private:
     friend class reactor;
+    friend future<> write_file(output_stream<char>& out, file f, uint64_t offset, uint64_t len);
 };
 
 }
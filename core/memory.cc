@@ -89,6 +89,9 @@ disable_abort_on_alloc_failure_temporarily::~disable_abort_on_alloc_failure_temp
 #include <experimental/optional>
 #include <functional>
 #include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
 #include <boost/intrusive/list.hpp>
 #include <sys/mman.h>
 #include "util/defer.hh"
@@ -100,9 +103,12 @@ disable_abort_on_alloc_failure_temporarily::~disable_abort_on_alloc_failure_temp
 
 namespace seastar {
 
+// With sampling, the counts and sizes are those of the sampled objects only.
 struct allocation_site {
     mutable size_t count = 0; // number of live objects allocated at backtrace.
     mutable size_t size = 0; // amount of bytes in live objects allocated at backtrace.
+    mutable size_t allocated_count = 0; // number of objects ever allocated at backtrace.
+    mutable size_t allocated_size = 0; // amount of bytes ever allocated at backtrace.
     mutable const allocation_site* next = nullptr;
     saved_backtrace backtrace;
 
@@ -136,7 +142,7 @@ namespace memory {
 
 seastar::logger seastar_memory_logger("seastar_memory");
 
-static allocation_site_ptr get_allocation_site() __attribute__((unused));
+static allocation_site_ptr get_allocation_site(size_t size) __attribute__((unused));
 
 static void on_allocation_failure(size_t size);
 
@@ -153,6 +159,8 @@ static std::atomic<bool> live_cpus[max_cpus];
 static thread_local uint64_t g_allocs;
 static thread_local uint64_t g_frees;
 static thread_local uint64_t g_cross_cpu_frees;
+static thread_local uint64_t g_cross_cpu_free_batches;
+static thread_local uint64_t g_remote_node_cross_cpu_frees;
 static thread_local uint64_t g_reclaims;
 
 using std::experimental::optional;
@@ -212,7 +220,10 @@ struct free_object {
 struct page {
     bool free;
     uint8_t offset_in_span;
-    uint16_t nr_small_alloc;
+    union {
+        uint16_t nr_small_alloc; // if used in a small_pool
+        uint16_t allocation_context; // of a large allocation, valid for head only
+    };
     uint32_t span_size; // in pages, if we're the head or the tail
     page_list_link link;
     small_pool* pool;  // if used in a small_pool
@@ -260,6 +271,12 @@ class page_list {
         }
         _front = ary[_front].link._next;
     }
+    template <typename Func>
+    void for_each(page* ary, Func func) {
+        for (auto n = _front; n; n = ary[n].link._next) {
+            func(ary[n]);
+        }
+    }
     page* find(uint32_t n_pages, page* ary) {
         auto n = _front;
         while (n && ary[n].span_size < n_pages) {
@@ -278,55 +295,67 @@ class small_pool {
         uint8_t preferred;
         uint8_t fallback;
     };
+    // Free objects are cached in two magazines, arrays which allocate()
+    // and deallocate() pop and push without touching the objects.  Only
+    // when both are empty, or both full, is a whole magazine exchanged
+    // with the span lists.  The second magazine keeps an alloc/free
+    // pattern around a magazine boundary from bouncing off the spans.
+    struct magazine {
+        static constexpr unsigned max_size = 64;
+        unsigned count = 0;
+        free_object* objects[max_size];
+    };
     unsigned _object_size;
+    unsigned _allocation_context;
     span_sizes _span_sizes;
-    free_object* _free = nullptr;
-    size_t _free_count = 0;
-    unsigned _min_free;
-    unsigned _max_free;
+    unsigned _magazine_size;
+    magazine* _loaded = &_magazines[0];
+    magazine* _previous = &_magazines[1];
+    magazine _magazines[2];
     unsigned _pages_in_use = 0;
     page_list _span_list;
-    static constexpr unsigned idx_frac_bits = 2;
 public:
-    explicit small_pool(unsigned object_size) noexcept;
+    small_pool(unsigned object_size, unsigned allocation_context) noexcept;
     ~small_pool();
-    void* allocate();
-    void deallocate(void* object);
+    void* allocate() {
+        if (__builtin_expect(!_loaded->count, false)) {
+            if (!refill()) {
+                return nullptr;
+            }
+        }
+        return _loaded->objects[--_loaded->count];
+    }
+    void deallocate(void* object) {
+        if (__builtin_expect(_loaded->count == _magazine_size, false)) {
+            spill();
+        }
+        _loaded->objects[_loaded->count++] = reinterpret_cast<free_object*>(object);
+    }
     unsigned object_size() const { return _object_size; }
+    // Objects of the pool are attributed to this allocation context
+    unsigned allocation_context() const { return _allocation_context; }
     bool objects_page_aligned() const { return is_page_aligned(_object_size); }
-    static constexpr unsigned size_to_idx(unsigned size);
-    static constexpr unsigned idx_to_size(unsigned idx);
+    size_t cached_objects() const { return _loaded->count + _previous->count; }
+    static constexpr unsigned size_to_idx(unsigned size) { return size_to_size_class(size); }
+    static constexpr unsigned idx_to_size(unsigned idx) { return size_class_to_size(idx); }
     allocation_site_ptr& alloc_site_holder(void* ptr);
 private:
-    void add_more_objects();
-    void trim_free_list();
+    bool refill();
+    void spill();
+    void add_more_objects(magazine& m);
+    void return_objects(magazine& m);
     friend void on_allocation_failure(size_t);
 };
 
-// index 0b0001'1100 -> size (1 << 4) + 0b11 << (4 - 2)
-
-constexpr unsigned
-small_pool::idx_to_size(unsigned idx) {
-    return (((1 << idx_frac_bits) | (idx & ((1 << idx_frac_bits) - 1)))
-              << (idx >> idx_frac_bits))
-                  >> idx_frac_bits;
-}
-
-constexpr unsigned
-small_pool::size_to_idx(unsigned size) {
-    return ((log2floor(size) << idx_frac_bits) - ((1 << idx_frac_bits) - 1))
-            + ((size - 1) >> (log2floor(size) - idx_frac_bits));
-}
-
 class small_pool_array {
 public:
-    static constexpr unsigned nr_small_pools = small_pool::size_to_idx(4 * page_size) + 1;
+    static constexpr unsigned nr_small_pools = nr_size_classes;
 private:
     union u {
         small_pool a[nr_small_pools];
-        u() {
+        explicit u(unsigned allocation_context) {
             for (unsigned i = 0; i < nr_small_pools; ++i) {
-                new (&a[i]) small_pool(small_pool::idx_to_size(i));
+                new (&a[i]) small_pool(small_pool::idx_to_size(i), allocation_context);
             }
         }
         ~u() {
@@ -335,12 +364,10 @@ class small_pool_array {
         }
     } _u;
 public:
+    explicit small_pool_array(unsigned allocation_context = 0) : _u(allocation_context) {}
     small_pool& operator[](unsigned idx) { return _u.a[idx]; }
 };
 
-static constexpr size_t max_small_allocation
-    = small_pool::idx_to_size(small_pool_array::nr_small_pools - 1);
-
 constexpr size_t object_size_with_alloc_site(size_t size) {
 #ifdef SEASTAR_HEAPPROF
     // For page-aligned sizes, allocation_site* lives in page::alloc_site, not with the object.
@@ -381,7 +408,7 @@ struct cpu_pages {
     unsigned cpu_id = -1U;
     std::function<void (std::function<void ()>)> reclaim_hook;
     std::vector<reclaimer*> reclaimers;
-    static constexpr unsigned nr_span_lists = 32;
+    static constexpr unsigned nr_span_lists = nr_span_classes;
     union pla {
         pla() {
             for (auto&& e : free_spans) {
@@ -393,8 +420,25 @@ struct cpu_pages {
         }
         page_list free_spans[nr_span_lists];  // contains spans with span_size >= 2^idx
     } fsu;
+    // Pools of allocation context 0; other contexts get their own pools on
+    // first use, so that every object is credited to the context that
+    // allocated it.
     small_pool_array small_pools;
+    small_pool_array* context_pools[max_allocation_contexts] = {};
     alignas(seastar::cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
+    // Objects freed on behalf of other cpus, chained per owner so that
+    // each chain is handed over with a single atomic operation.
+    struct cross_cpu_free_batch {
+        cross_cpu_free_item* head = nullptr;
+        cross_cpu_free_item* tail = nullptr;
+        unsigned count = 0;
+        bool pending = false;
+    };
+    unsigned nodeid = 0; // NUMA node of this cpu's memory
+    unsigned xcpu_batch_size = 0;
+    unsigned nr_xcpu_pending = 0;
+    uint8_t xcpu_pending[max_cpus];
+    cross_cpu_free_batch xcpu_batches[max_cpus];
     alignas(seastar::cache_line_size) std::vector<physical_address> virt_to_phys_map;
     static std::atomic<unsigned> cpu_id_gen;
     static cpu_pages* all_cpus[max_cpus];
@@ -408,6 +452,14 @@ struct cpu_pages {
     } asu;
     allocation_site_ptr alloc_site_list_head = nullptr; // For easy traversal of asu.alloc_sites from scylla-gdb.py
     bool collect_backtrace = false;
+    size_t heap_sample_period = default_heap_profiling_sample_period;
+    unsigned allocation_context = 0;
+    allocation_context_stats context_stats[max_allocation_contexts] = {};
+    size_t bytes_until_sample = 0;
+    std::minstd_rand heap_sample_rng;
+    bool hugetlbfs = false;
+    bool transparent_hugepages = true;
+    std::vector<numa_binding> numa_bindings;
     char* mem() { return memory; }
 
     void link(page_list& list, page* span);
@@ -427,11 +479,30 @@ struct cpu_pages {
     void free_span(pageidx start, uint32_t nr_pages);
     void free_span_no_merge(pageidx start, uint32_t nr_pages);
     void* allocate_small(unsigned size);
+    small_pool_array& pools() {
+        if (__builtin_expect(!allocation_context, true)) {
+            return small_pools;
+        }
+        auto p = context_pools[allocation_context];
+        return p ? *p : create_context_pools();
+    }
+    small_pool_array& create_context_pools();
+    // Attribute memory to the allocation context owning it
+    void charge(unsigned context, size_t size) {
+        context_stats[context].allocated_bytes += size;
+    }
+    void credit(unsigned context, size_t size) {
+        context_stats[context].freed_bytes += size;
+    }
     void free(void* ptr);
     void free(void* ptr, size_t size);
     bool try_cross_cpu_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
+    void push_cross_cpu(unsigned cpu_id, cross_cpu_free_item* head, cross_cpu_free_item* tail);
+    void flush_cross_cpu_batch(unsigned cpu_id);
+    bool flush_cross_cpu_frees();
+    void set_cross_cpu_free_batching(unsigned batch_size);
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
     page* to_page(void* p) {
@@ -448,6 +519,10 @@ struct cpu_pages {
     void do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void replace_memory_backing(allocate_system_memory_fn alloc_sys_mem);
     void init_virt_to_phys_map();
+    size_t free_memory_in_span_class(unsigned idx);
+    size_t largest_free_span();
+    void advise_huge_pages(char* start, size_t size);
+    memory::huge_page_coverage measure_huge_pages();
     void check_large_allocation(size_t size);
     void warn_large_allocation(size_t size);
     memory::memory_layout memory_layout();
@@ -473,6 +548,11 @@ void set_heap_profiling_enabled(bool enable) {
     cpu_mem.collect_backtrace = enable;
 }
 
+void set_heap_profiling_sample_period(size_t bytes) {
+    cpu_mem.heap_sample_period = bytes;
+    cpu_mem.bytes_until_sample = 0;
+}
+
 // Free spans are store in the largest index i such that nr_pages >= 1 << i.
 static inline
 unsigned index_of(unsigned pages) {
@@ -613,11 +693,13 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages, Trimmer trimmer) {
     span->span_size = span_end->span_size = t.nr_pages;
     span->pool = nullptr;
 #ifdef SEASTAR_HEAPPROF
-    auto alloc_site = get_allocation_site();
+    auto alloc_site = get_allocation_site(span->span_size * page_size);
     span->alloc_site = alloc_site;
     if (alloc_site) {
         ++alloc_site->count;
         alloc_site->size += span->span_size * page_size;
+        ++alloc_site->allocated_count;
+        alloc_site->allocated_size += span->span_size * page_size;
     }
 #endif
     maybe_reclaim();
@@ -682,11 +764,22 @@ saved_backtrace get_backtrace() noexcept {
     return current_backtrace();
 }
 
+// Samples allocations at exponentially distributed intervals of bytes
+// allocated, so that each byte has the same chance of being sampled and
+// the cost of taking backtraces is bounded by the allocation volume.
 static
-allocation_site_ptr get_allocation_site() {
+allocation_site_ptr get_allocation_site(size_t size) {
     if (!cpu_mem.is_initialized() || !cpu_mem.collect_backtrace) {
         return nullptr;
     }
+    if (cpu_mem.heap_sample_period) {
+        if (size < cpu_mem.bytes_until_sample) {
+            cpu_mem.bytes_until_sample -= size;
+            return nullptr;
+        }
+        std::exponential_distribution<double> interval(1.0 / cpu_mem.heap_sample_period);
+        cpu_mem.bytes_until_sample = interval(cpu_mem.heap_sample_rng);
+    }
     disable_backtrace_temporarily dbt;
     allocation_site new_alloc_site;
     new_alloc_site.backtrace = get_backtrace();
@@ -715,26 +808,40 @@ small_pool::alloc_site_holder(void* ptr) {
 void*
 cpu_pages::allocate_small(unsigned size) {
     auto idx = small_pool::size_to_idx(size);
-    auto& pool = small_pools[idx];
+    auto& pool = pools()[idx];
     assert(size <= pool.object_size());
     auto ptr = pool.allocate();
-#ifdef SEASTAR_HEAPPROF
     if (!ptr) {
         return nullptr;
     }
-    allocation_site_ptr alloc_site = get_allocation_site();
+    charge(pool.allocation_context(), pool.object_size());
+#ifdef SEASTAR_HEAPPROF
+    allocation_site_ptr alloc_site = get_allocation_site(pool.object_size());
     if (alloc_site) {
         ++alloc_site->count;
         alloc_site->size += pool.object_size();
+        ++alloc_site->allocated_count;
+        alloc_site->allocated_size += pool.object_size();
     }
     new (&pool.alloc_site_holder(ptr)) allocation_site_ptr{alloc_site};
 #endif
     return ptr;
 }
 
+small_pool_array& cpu_pages::create_context_pools() {
+    auto nr_pages = align_up(sizeof(small_pool_array), page_size) / page_size;
+    auto mem = allocate_large(nr_pages);
+    if (!mem) {
+        // Objects of the pools are attributed to their own context anyway
+        return small_pools;
+    }
+    return *(context_pools[allocation_context] = new (mem) small_pool_array(allocation_context));
+}
+
 void cpu_pages::free_large(void* ptr) {
     pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
     page* span = &pages[idx];
+    credit(span->allocation_context, span->span_size * page_size);
 #ifdef SEASTAR_HEAPPROF
     auto alloc_site = span->alloc_site;
     if (alloc_site) {
@@ -769,12 +876,66 @@ void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
         return;
     }
     auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
+    ++g_cross_cpu_frees;
+    if (all_cpus[cpu_id]->nodeid != nodeid) {
+        ++g_remote_node_cross_cpu_frees;
+    }
+    if (!xcpu_batch_size) {
+        push_cross_cpu(cpu_id, p, p);
+        return;
+    }
+    auto& b = xcpu_batches[cpu_id];
+    p->next = b.head;
+    if (!b.head) {
+        b.tail = p;
+    }
+    b.head = p;
+    if (!b.pending) {
+        b.pending = true;
+        xcpu_pending[nr_xcpu_pending++] = cpu_id;
+    }
+    if (++b.count >= xcpu_batch_size) {
+        flush_cross_cpu_batch(cpu_id);
+    }
+}
+
+void cpu_pages::push_cross_cpu(unsigned cpu_id, cross_cpu_free_item* head, cross_cpu_free_item* tail) {
+    if (!live_cpus[cpu_id].load(std::memory_order_relaxed)) {
+        return;
+    }
     auto& list = all_cpus[cpu_id]->xcpu_freelist;
     auto old = list.load(std::memory_order_relaxed);
     do {
-        p->next = old;
-    } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
-    ++g_cross_cpu_frees;
+        tail->next = old;
+    } while (!list.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+    ++g_cross_cpu_free_batches;
+}
+
+void cpu_pages::flush_cross_cpu_batch(unsigned cpu_id) {
+    auto& b = xcpu_batches[cpu_id];
+    if (b.head) {
+        push_cross_cpu(cpu_id, b.head, b.tail);
+        b.head = b.tail = nullptr;
+        b.count = 0;
+    }
+}
+
+bool cpu_pages::flush_cross_cpu_frees() {
+    if (!nr_xcpu_pending) {
+        return false;
+    }
+    for (unsigned i = 0; i < nr_xcpu_pending; ++i) {
+        auto cpu_id = xcpu_pending[i];
+        flush_cross_cpu_batch(cpu_id);
+        xcpu_batches[cpu_id].pending = false;
+    }
+    nr_xcpu_pending = 0;
+    return true;
+}
+
+void cpu_pages::set_cross_cpu_free_batching(unsigned batch_size) {
+    flush_cross_cpu_frees();
+    xcpu_batch_size = std::min(batch_size, unsigned(std::numeric_limits<decltype(cross_cpu_free_batch::count)>::max()));
 }
 
 bool cpu_pages::drain_cross_cpu_freelist() {
@@ -795,6 +956,7 @@ void cpu_pages::free(void* ptr) {
     page* span = to_page(ptr);
     if (span->pool) {
         small_pool& pool = *span->pool;
+        credit(pool.allocation_context(), pool.object_size());
 #ifdef SEASTAR_HEAPPROF
         allocation_site_ptr alloc_site = pool.alloc_site_holder(ptr);
         if (alloc_site) {
@@ -814,8 +976,9 @@ void cpu_pages::free(void* ptr, size_t size) {
         size = sizeof(free_object);
     }
     if (size <= max_small_allocation) {
-        size = object_size_with_alloc_site(size);
-        auto pool = &small_pools[small_pool::size_to_idx(size)];
+        // The pool of the allocation context owning the object
+        auto pool = to_page(ptr)->pool;
+        credit(pool->allocation_context(), pool->object_size());
 #ifdef SEASTAR_HEAPPROF
         allocation_site_ptr alloc_site = pool->alloc_site_holder(ptr);
         if (alloc_site) {
@@ -852,6 +1015,7 @@ void cpu_pages::shrink(void* ptr, size_t new_size) {
     if (new_size_pages == old_size_pages) {
         return;
     }
+    credit(span->allocation_context, (old_size_pages - new_size_pages) * page_size);
 #ifdef SEASTAR_HEAPPROF
     auto alloc_site = span->alloc_site;
     if (alloc_site) {
@@ -941,6 +1105,82 @@ void cpu_pages::replace_memory_backing(allocate_system_memory_fn alloc_sys_mem)
     std::memcpy(old_mem, relocated_old_mem.get(), bytes);
 }
 
+size_t cpu_pages::free_memory_in_span_class(unsigned idx) {
+    size_t free_pages = 0;
+    fsu.free_spans[idx].for_each(pages, [&] (page& span) {
+        free_pages += span.span_size;
+    });
+    return free_pages * page_size;
+}
+
+size_t cpu_pages::largest_free_span() {
+    uint32_t largest = 0;
+    for (unsigned idx = nr_span_lists; idx-- > 0 && !largest; ) {
+        fsu.free_spans[idx].for_each(pages, [&] (page& span) {
+            largest = std::max(largest, span.span_size);
+        });
+    }
+    return size_t(largest) * page_size;
+}
+
+void cpu_pages::advise_huge_pages(char* start, size_t size) {
+    if (hugetlbfs) {
+        return;
+    }
+    if (::madvise(start, size, transparent_hugepages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE) == -1) {
+        // The kernel lacks transparent huge page support; stay with small pages.
+        transparent_hugepages = false;
+    }
+}
+
+// Transparent huge pages are only used for madvise()d memory unless
+// disabled altogether.
+static bool transparent_hugepages_available() {
+    std::ifstream enabled("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string modes;
+    return std::getline(enabled, modes) && modes.find("[never]") == std::string::npos;
+}
+
+huge_page_coverage cpu_pages::measure_huge_pages() {
+    memory::huge_page_coverage ret;
+    ret.hugetlbfs = hugetlbfs;
+    ret.transparent_hugepages = transparent_hugepages;
+    auto lo = reinterpret_cast<uintptr_t>(mem());
+    auto hi = lo + nr_pages * page_size;
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    bool in_arena = false;
+    while (std::getline(smaps, line)) {
+        auto name_end = line.find(' ');
+        if (name_end == std::string::npos || !name_end) {
+            continue;
+        }
+        if (line[name_end - 1] != ':') {
+            // A mapping header: "start-end perms offset dev inode path"
+            char* end;
+            auto start = std::strtoull(line.c_str(), &end, 16);
+            auto stop = *end == '-' ? std::strtoull(end + 1, nullptr, 16) : 0;
+            in_arena = start >= lo && stop <= hi && start < stop;
+            continue;
+        }
+        if (!in_arena) {
+            continue;
+        }
+        auto field = line.substr(0, name_end - 1);
+        auto bytes = std::strtoull(line.c_str() + name_end, nullptr, 10) << 10;
+        if (field == "Rss") {
+            ret.resident_memory += bytes;
+        } else if (field == "AnonHugePages") {
+            ret.huge_page_memory += bytes;
+        } else if (field == "Shared_Hugetlb" || field == "Private_Hugetlb") {
+            // hugetlbfs pages are not accounted in Rss
+            ret.resident_memory += bytes;
+            ret.huge_page_memory += bytes;
+        }
+    }
+    return ret;
+}
+
 void cpu_pages::init_virt_to_phys_map() {
     auto nr_entries = nr_pages / (huge_page_size / page_size);
     virt_to_phys_map.resize(nr_entries);
@@ -983,7 +1223,7 @@ void cpu_pages::do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_m
     auto mmap_size = new_size - old_size;
     auto mem = alloc_sys_mem({mmap_start}, mmap_size);
     mem.release();
-    ::madvise(mmap_start, mmap_size, MADV_HUGEPAGE);
+    advise_huge_pages(mmap_start, mmap_size);
     // one past last page structure is a sentinel
     auto new_page_array_pages = align_up(sizeof(page[new_pages + 1]), page_size) / page_size;
     auto new_page_array
@@ -1076,8 +1316,8 @@ void cpu_pages::set_min_free_pages(size_t pages) {
     maybe_reclaim();
 }
 
-small_pool::small_pool(unsigned object_size) noexcept
-    : _object_size(object_size) {
+small_pool::small_pool(unsigned object_size, unsigned allocation_context) noexcept
+    : _object_size(object_size), _allocation_context(allocation_context) {
     unsigned span_size = 1;
     auto span_bytes = [&] { return span_size * page_size; };
     auto waste = [&] { return (span_bytes() % _object_size) / (1.0 * span_bytes()); };
@@ -1092,59 +1332,53 @@ small_pool::small_pool(unsigned object_size) noexcept
         ++span_size;
     }
     _span_sizes.preferred = span_size;
-    _max_free = std::max<unsigned>(100, span_bytes() * 2 / _object_size);
-    _min_free = _max_free / 2;
+    // Together, the two magazines cache as many objects as a free list
+    // trimmed at max(100, two spans' worth) objects would.
+    auto max_free = std::max<unsigned>(100, span_bytes() * 2 / _object_size);
+    _magazine_size = std::min(magazine::max_size, max_free / 2);
 }
 
 small_pool::~small_pool() {
-    _min_free = _max_free = 0;
-    trim_free_list();
+    return_objects(*_loaded);
+    return_objects(*_previous);
 }
 
 // Should not throw in case of running out of memory to avoid infinite recursion,
 // becaue throwing std::bad_alloc requires allocation. __cxa_allocate_exception
 // falls back to the emergency pool in case malloc() returns nullptr.
-void*
-small_pool::allocate() {
-    if (!_free) {
-        add_more_objects();
-    }
-    if (!_free) {
-        return nullptr;
+bool
+small_pool::refill() {
+    if (_previous->count) {
+        // _previous is only ever full or empty
+        std::swap(_loaded, _previous);
+    } else {
+        add_more_objects(*_loaded);
     }
-    auto* obj = _free;
-    _free = _free->next;
-    --_free_count;
-    return obj;
+    return _loaded->count;
 }
 
 void
-small_pool::deallocate(void* object) {
-    auto o = reinterpret_cast<free_object*>(object);
-    o->next = _free;
-    _free = o;
-    ++_free_count;
-    if (_free_count >= _max_free) {
-        trim_free_list();
+small_pool::spill() {
+    if (_previous->count) {
+        return_objects(*_previous);
     }
+    std::swap(_loaded, _previous);
 }
 
 void
-small_pool::add_more_objects() {
-    auto goal = (_min_free + _max_free) / 2;
-    while (!_span_list.empty() && _free_count < goal) {
+small_pool::add_more_objects(magazine& m) {
+    while (!_span_list.empty() && m.count < _magazine_size) {
         page& span = _span_list.front(cpu_mem.pages);
-        _span_list.pop_front(cpu_mem.pages);
-        while (span.freelist) {
-            auto obj = span.freelist;
+        while (span.freelist && m.count < _magazine_size) {
+            m.objects[m.count++] = span.freelist;
             span.freelist = span.freelist->next;
-            obj->next = _free;
-            _free = obj;
-            ++_free_count;
             ++span.nr_small_alloc;
         }
+        if (!span.freelist) {
+            _span_list.pop_front(cpu_mem.pages);
+        }
     }
-    while (_free_count < goal) {
+    while (m.count < _magazine_size) {
         disable_backtrace_temporarily dbt;
         auto span_size = _span_sizes.preferred;
         auto data = reinterpret_cast<char*>(cpu_mem.allocate_large(span_size));
@@ -1163,23 +1397,28 @@ small_pool::add_more_objects() {
         }
         span->nr_small_alloc = 0;
         span->freelist = nullptr;
+        // Objects the magazine has no room for stay on the span
         for (unsigned offset = 0; offset <= span_size * page_size - _object_size; offset += _object_size) {
             auto h = reinterpret_cast<free_object*>(data + offset);
-            h->next = _free;
-            _free = h;
-            ++_free_count;
-            ++span->nr_small_alloc;
+            if (m.count < _magazine_size) {
+                m.objects[m.count++] = h;
+                ++span->nr_small_alloc;
+            } else {
+                h->next = span->freelist;
+                span->freelist = h;
+            }
+        }
+        if (span->freelist) {
+            new (&span->link) page_list_link();
+            _span_list.push_front(cpu_mem.pages, *span);
         }
     }
 }
 
 void
-small_pool::trim_free_list() {
-    auto goal = (_min_free + _max_free) / 2;
-    while (_free && _free_count > goal) {
-        auto obj = _free;
-        _free = _free->next;
-        --_free_count;
+small_pool::return_objects(magazine& m) {
+    for (unsigned i = 0; i < m.count; ++i) {
+        auto obj = m.objects[i];
         page* span = cpu_mem.to_page(obj);
         span -= span->offset_in_span;
         if (!span->freelist) {
@@ -1194,6 +1433,7 @@ small_pool::trim_free_list() {
             cpu_mem.free_span(span - cpu_mem.pages, span->span_size);
         }
     }
+    m.count = 0;
 }
 
 void
@@ -1210,7 +1450,12 @@ void* allocate_large(size_t size) {
     if ((size_t(size_in_pages) << page_bits) < size) {
         throw std::bad_alloc();
     }
-    return cpu_mem.allocate_large(size_in_pages);
+    auto ptr = cpu_mem.allocate_large(size_in_pages);
+    if (ptr) {
+        cpu_mem.to_page(ptr)->allocation_context = cpu_mem.allocation_context;
+        cpu_mem.charge(cpu_mem.allocation_context, size_t(size_in_pages) << page_bits);
+    }
+    return ptr;
 
 }
 
@@ -1218,7 +1463,12 @@ void* allocate_large_aligned(size_t align, size_t size) {
     abort_on_underflow(size);
     unsigned size_in_pages = (size + page_size - 1) >> page_bits;
     unsigned align_in_pages = std::max(align, page_size) >> page_bits;
-    return cpu_mem.allocate_large_aligned(align_in_pages, size_in_pages);
+    auto ptr = cpu_mem.allocate_large_aligned(align_in_pages, size_in_pages);
+    if (ptr) {
+        cpu_mem.to_page(ptr)->allocation_context = cpu_mem.allocation_context;
+        cpu_mem.charge(cpu_mem.allocation_context, size_t(size_in_pages) << page_bits);
+    }
+    return ptr;
 }
 
 void free_large(void* ptr) {
@@ -1270,6 +1520,23 @@ void* allocate_aligned(size_t align, size_t size) {
     return ptr;
 }
 
+void* allocate_from_size_class(unsigned idx) {
+    on_alloc_point();
+#ifdef SEASTAR_HEAPPROF
+    return allocate(size_class_to_size(idx));
+#else
+    auto& pool = cpu_mem.pools()[idx];
+    auto ptr = pool.allocate();
+    if (!ptr) {
+        on_allocation_failure(size_class_to_size(idx));
+    } else {
+        cpu_mem.charge(pool.allocation_context(), size_class_to_size(idx));
+    }
+    ++g_allocs;
+    return ptr;
+#endif
+}
+
 void free(void* obj) {
     if (cpu_mem.try_cross_cpu_free(obj)) {
         return;
@@ -1278,6 +1545,20 @@ void free(void* obj) {
     cpu_mem.free(obj);
 }
 
+void free_to_size_class(void* obj, unsigned idx) {
+    if (cpu_mem.try_cross_cpu_free(obj)) {
+        return;
+    }
+    ++g_frees;
+#ifdef SEASTAR_HEAPPROF
+    cpu_mem.free(obj);
+#else
+    auto pool = cpu_mem.to_page(obj)->pool;
+    cpu_mem.credit(pool->allocation_context(), size_class_to_size(idx));
+    pool->deallocate(obj);
+#endif
+}
+
 void free(void* obj, size_t size) {
     if (cpu_mem.try_cross_cpu_free(obj)) {
         return;
@@ -1320,11 +1601,15 @@ void disable_large_allocation_warning() {
 }
 
 void configure(std::vector<resource::memory> m, bool mbind,
-        optional<std::string> hugetlbfs_path) {
+        optional<std::string> hugetlbfs_path, bool transparent_hugepages) {
     size_t total = 0;
     for (auto&& x : m) {
         total += x.bytes;
     }
+    cpu_mem.hugetlbfs = bool(hugetlbfs_path);
+    cpu_mem.transparent_hugepages = transparent_hugepages && !hugetlbfs_path && transparent_hugepages_available();
+    // Also covers the bootstrap memory, advised before the configuration was known.
+    cpu_mem.advise_huge_pages(cpu_mem.mem(), cpu_mem.nr_pages * page_size);
     allocate_system_memory_fn sys_alloc = allocate_anonymous_memory;
     if (hugetlbfs_path) {
         // std::function is copyable, but file_desc is not, so we must use
@@ -1336,6 +1621,10 @@ void configure(std::vector<resource::memory> m, bool mbind,
         cpu_mem.replace_memory_backing(sys_alloc);
     }
     cpu_mem.resize(total, sys_alloc);
+    if (!m.empty()) {
+        // The first chunk is taken from the node local to the cpu
+        cpu_mem.nodeid = m.front().nodeid;
+    }
     size_t pos = 0;
     for (auto&& x : m) {
 #ifdef HAVE_NUMA
@@ -1346,6 +1635,7 @@ void configure(std::vector<resource::memory> m, bool mbind,
                             &nodemask, std::numeric_limits<unsigned long>::digits,
                             MPOL_MF_MOVE);
 
+            cpu_mem.numa_bindings.push_back(numa_binding{x.nodeid, x.bytes, r != -1});
             if (r == -1) {
                 char err[1000] = {};
                 strerror_r(errno, err, sizeof(err));
@@ -1362,14 +1652,90 @@ void configure(std::vector<resource::memory> m, bool mbind,
 }
 
 statistics stats() {
-    return statistics{g_allocs, g_frees, g_cross_cpu_frees,
+    return statistics{g_allocs, g_frees, g_cross_cpu_frees, g_cross_cpu_free_batches, g_remote_node_cross_cpu_frees,
         cpu_mem.nr_pages * page_size, cpu_mem.nr_free_pages * page_size, g_reclaims};
 }
 
+huge_page_coverage get_huge_page_coverage() {
+    return cpu_mem.measure_huge_pages();
+}
+
+size_t free_memory_in_span_class(unsigned idx) {
+    return cpu_mem.free_memory_in_span_class(idx);
+}
+
+unsigned get_allocation_context() {
+    return cpu_mem.allocation_context;
+}
+
+unsigned set_allocation_context(unsigned context) {
+    assert(context < max_allocation_contexts);
+    return std::exchange(cpu_mem.allocation_context, context);
+}
+
+allocation_context_stats get_allocation_context_stats(unsigned context) {
+    return cpu_mem.context_stats[context];
+}
+
+// A sample of an object of size s taken every P bytes on average stands
+// for 1 / (1 - e^(-s/P)) such objects.
+static size_t unsample(size_t count, size_t size, size_t period) {
+    if (!period || !count) {
+        return size;
+    }
+    double object_size = double(size) / count;
+    return size / -std::expm1(-object_size / period);
+}
+
+std::vector<heap_profile_site> get_heap_profile() {
+    std::vector<heap_profile_site> ret;
+    // Keep the allocations below from adding sites while we iterate.
+    disable_backtrace_temporarily dbt;
+    auto period = cpu_mem.heap_sample_period;
+    for (auto site = cpu_mem.alloc_site_list_head; site; site = site->next) {
+        if (!site->allocated_count) {
+            continue;
+        }
+        heap_profile_site p;
+        std::ostringstream os;
+        os << site->backtrace;
+        std::istringstream frames(os.str());
+        std::string frame;
+        while (frames >> frame) {
+            if (!p.backtrace.empty()) {
+                p.backtrace += ' ';
+            }
+            p.backtrace += frame;
+        }
+        p.live_bytes = unsample(site->count, site->size, period);
+        p.live_objects = site->size ? site->count * (double(p.live_bytes) / site->size) : 0;
+        p.allocated_bytes = unsample(site->allocated_count, site->allocated_size, period);
+        p.allocated_objects = site->allocated_count * (double(p.allocated_bytes) / site->allocated_size);
+        ret.push_back(std::move(p));
+    }
+    return ret;
+}
+
+size_t largest_free_span() {
+    return cpu_mem.largest_free_span();
+}
+
+const std::vector<numa_binding>& get_numa_bindings() {
+    return cpu_mem.numa_bindings;
+}
+
 bool drain_cross_cpu_freelist() {
     return cpu_mem.drain_cross_cpu_freelist();
 }
 
+void set_cross_cpu_free_batching(unsigned batch_size) {
+    cpu_mem.set_cross_cpu_free_batching(batch_size);
+}
+
+bool flush_cross_cpu_frees() {
+    return cpu_mem.flush_cross_cpu_frees();
+}
+
 translation
 translate(const void* addr, size_t size) {
     auto cpu_id = object_cpu_id(addr);
@@ -1424,13 +1790,19 @@ void on_allocation_failure(size_t size) {
         auto total_mem = cpu_mem.nr_pages * page_size;
         seastar_memory_logger.debug("Used memory: {} Free memory: {} Total memory: {}", total_mem - free_mem, free_mem, total_mem);
         seastar_memory_logger.debug("Small pools:");
-        seastar_memory_logger.debug("objsz spansz usedobj   memory       wst%");
-        for (unsigned i = 0; i < cpu_mem.small_pools.nr_small_pools; i++) {
-            auto& sp = cpu_mem.small_pools[i];
-            auto use_count = sp._pages_in_use * page_size / sp.object_size() - sp._free_count;
-            auto memory = sp._pages_in_use * page_size;
-            auto wasted_percent = memory ? sp._free_count * sp.object_size() * 100.0 / memory : 0;
-            seastar_memory_logger.debug("{} {} {} {} {}", sp.object_size(), sp._span_sizes.preferred * page_size, use_count, memory, wasted_percent);
+        seastar_memory_logger.debug("ctx objsz spansz usedobj   memory       wst%");
+        for (unsigned c = 0; c < max_allocation_contexts; c++) {
+            auto pools = c ? cpu_mem.context_pools[c] : &cpu_mem.small_pools;
+            if (!pools) {
+                continue;
+            }
+            for (unsigned i = 0; i < pools->nr_small_pools; i++) {
+                auto& sp = (*pools)[i];
+                auto use_count = sp._pages_in_use * page_size / sp.object_size() - sp.cached_objects();
+                auto memory = sp._pages_in_use * page_size;
+                auto wasted_percent = memory ? sp.cached_objects() * sp.object_size() * 100.0 / memory : 0;
+                seastar_memory_logger.debug("{} {} {} {} {} {}", c, sp.object_size(), sp._span_sizes.preferred * page_size, use_count, memory, wasted_percent);
+            }
         }
         seastar_memory_logger.debug("Page spans:");
         seastar_memory_logger.debug("index size [B]     free [B]");
@@ -1744,6 +2116,25 @@ void set_heap_profiling_enabled(bool enabled) {
     seastar_logger.warn("Seastar compiled with default allocator, heap profiler not supported");
 }
 
+void set_heap_profiling_sample_period(size_t bytes) {
+}
+
+unsigned get_allocation_context() {
+    return 0;
+}
+
+unsigned set_allocation_context(unsigned context) {
+    return 0;
+}
+
+allocation_context_stats get_allocation_context_stats(unsigned context) {
+    return {};
+}
+
+std::vector<heap_profile_site> get_heap_profile() {
+    return {};
+}
+
 void enable_abort_on_allocation_failure() {
     seastar_logger.warn("Seastar compiled with default allocator, will not abort on bad_alloc");
 }
@@ -1757,17 +2148,50 @@ reclaimer::~reclaimer() {
 void set_reclaim_hook(std::function<void (std::function<void ()>)> hook) {
 }
 
-void configure(std::vector<resource::memory> m, bool mbind, std::experimental::optional<std::string> hugepages_path) {
+void configure(std::vector<resource::memory> m, bool mbind, std::experimental::optional<std::string> hugepages_path,
+        bool transparent_hugepages) {
 }
 
 statistics stats() {
-    return statistics{0, 0, 0, 1 << 30, 1 << 30, 0};
+    return statistics{0, 0, 0, 0, 0, 1 << 30, 1 << 30, 0};
+}
+
+huge_page_coverage get_huge_page_coverage() {
+    return {};
+}
+
+size_t free_memory_in_span_class(unsigned idx) {
+    return 0;
+}
+
+size_t largest_free_span() {
+    return 0;
+}
+
+const std::vector<numa_binding>& get_numa_bindings() {
+    static const std::vector<numa_binding> none;
+    return none;
+}
+
+void* allocate_from_size_class(unsigned idx) {
+    return ::malloc(size_class_to_size(idx));
+}
+
+void free_to_size_class(void* ptr, unsigned idx) {
+    ::free(ptr);
 }
 
 bool drain_cross_cpu_freelist() {
     return false;
 }
 
+void set_cross_cpu_free_batching(unsigned batch_size) {
+}
+
+bool flush_cross_cpu_frees() {
+    return false;
+}
+
 translation
 translate(const void* addr, size_t size) {
     return {};
@@ -25,7 +25,9 @@
 #include "resource.hh"
 #include "bitops.hh"
 #include <new>
+#include <algorithm>
 #include <functional>
+#include <string>
 #include <vector>
 
 namespace seastar {
@@ -66,7 +68,8 @@ static constexpr size_t page_bits = log2ceil(page_size);
 static constexpr size_t huge_page_size = 1 << 21; // 2M
 
 void configure(std::vector<resource::memory> m, bool mbind,
-        std::experimental::optional<std::string> hugetlbfs_path = {});
+        std::experimental::optional<std::string> hugetlbfs_path = {},
+        bool transparent_hugepages = true);
 
 void enable_abort_on_allocation_failure();
 
@@ -78,6 +81,74 @@ class disable_abort_on_alloc_failure_temporarily {
 
 void set_heap_profiling_enabled(bool);
 
+/// Number of allocation contexts memory can be attributed to.
+static constexpr unsigned max_allocation_contexts = 32;
+
+/// Memory attributed to an allocation context of an lcore.
+///
+/// Objects are charged to the context current when they are allocated,
+/// and credited to that same context when they are freed, whichever
+/// context or cpu frees them.  To know the owner of small objects, each
+/// context allocates them from pools of its own, so objects of different
+/// contexts do not share pages.
+struct allocation_context_stats {
+    uint64_t allocated_bytes = 0; ///< total bytes allocated in the context
+    uint64_t freed_bytes = 0; ///< total bytes of the context freed
+    /// Bytes of the context currently allocated
+    int64_t live_bytes() const { return allocated_bytes - freed_bytes; }
+};
+
+/// Returns the allocation context of this lcore.
+unsigned get_allocation_context();
+
+/// Sets the allocation context that memory allocated and freed on this
+/// lcore is attributed to, and returns the previous one.
+///
+/// The reactor runs the tasks of each scheduling group in the context
+/// numbered after the group, from 0 up to max_scheduling_groups(), so
+/// allocations are accounted per scheduling group unless overridden.
+/// Higher numbers are free for applications to use.
+unsigned set_allocation_context(unsigned context);
+
+/// Attributes memory allocated and freed during its lifetime to an
+/// allocation context.  Since the reactor switches contexts between tasks,
+/// it only covers synchronous code.
+class scoped_allocation_context {
+    unsigned _prev;
+public:
+    explicit scoped_allocation_context(unsigned context) : _prev(set_allocation_context(context)) {}
+    ~scoped_allocation_context() { set_allocation_context(_prev); }
+    scoped_allocation_context(const scoped_allocation_context&) = delete;
+    scoped_allocation_context& operator=(const scoped_allocation_context&) = delete;
+};
+
+/// Returns the memory attributed to an allocation context of this lcore.
+allocation_context_stats get_allocation_context_stats(unsigned context);
+
+/// Mean number of bytes allocated between two allocations sampled by
+/// the heap profiler.
+static constexpr size_t default_heap_profiling_sample_period = 512 << 10;
+
+/// Sets the mean number of bytes allocated on this lcore between two
+/// allocations whose backtrace the heap profiler records.  Sampling keeps
+/// the profiler cheap enough to leave enabled in production; 0 records
+/// every allocation.
+void set_heap_profiling_sample_period(size_t bytes);
+
+/// Allocation site recorded by the heap profiler.  Counts and sizes are
+/// estimated from the sampled allocations.
+struct heap_profile_site {
+    std::string backtrace; ///< space separated frames
+    size_t live_objects = 0;
+    size_t live_bytes = 0;
+    size_t allocated_objects = 0; ///< including those since freed
+    size_t allocated_bytes = 0; ///< including those since freed
+};
+
+/// Returns the allocation sites recorded by the heap profiler on this
+/// lcore.  Empty unless seastar is built with SEASTAR_HEAPPROF.
+std::vector<heap_profile_site> get_heap_profile();
+
 enum class reclaiming_result {
     reclaimed_nothing,
     reclaimed_something
@@ -123,6 +194,17 @@ class reclaimer {
 // Returns @true if any work was actually performed.
 bool drain_cross_cpu_freelist();
 
+// Batch objects freed on behalf of other cpus, handing them over once
+// \c batch_size objects for the same cpu accumulate or
+// flush_cross_cpu_frees() is called.  Only threads which call
+// flush_cross_cpu_frees() periodically may enable batching; 0 disables it.
+void set_cross_cpu_free_batching(unsigned batch_size);
+
+// Hands the batched cross-cpu frees over to their owning cpus.
+//
+// Returns @true if any work was actually performed.
+bool flush_cross_cpu_frees();
+
 
 // We don't want the memory code calling back into the rest of
 // the system, so allow the rest of the system to tell the memory
@@ -149,6 +231,58 @@ struct translation {
 // translation is not known.
 translation translate(const void* addr, size_t size);
 
+// Small objects are served from pools of size classes, four per power of two.
+static constexpr unsigned size_class_frac_bits = 2;
+
+// index 0b0001'1100 -> size (1 << 4) + 0b11 << (4 - 2)
+constexpr size_t size_class_to_size(unsigned idx) {
+    return (((1 << size_class_frac_bits) | (idx & ((1 << size_class_frac_bits) - 1)))
+              << (idx >> size_class_frac_bits))
+                  >> size_class_frac_bits;
+}
+
+constexpr unsigned size_to_size_class(size_t size) {
+    return ((log2floor(size) << size_class_frac_bits) - ((1 << size_class_frac_bits) - 1))
+            + ((size - 1) >> (log2floor(size) - size_class_frac_bits));
+}
+
+static constexpr unsigned nr_size_classes = size_to_size_class(4 * page_size) + 1;
+static constexpr size_t max_small_allocation = size_class_to_size(nr_size_classes - 1);
+
+// Allocate from, and free to, the pool of a size class, skipping the
+// size classification of malloc() and free().
+void* allocate_from_size_class(unsigned idx);
+void free_to_size_class(void* ptr, unsigned idx);
+
+// Allocates \c size bytes.  When \c size is a compile-time constant, as
+// in a class-specific operator new, the size class is selected at compile
+// time too.
+[[gnu::always_inline]]
+inline void* allocate_sized(size_t size) {
+#ifndef SEASTAR_HEAPPROF
+    if (__builtin_constant_p(size) && size <= max_small_allocation) {
+        auto ptr = allocate_from_size_class(size_to_size_class(std::max(size, sizeof(void*))));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+#endif
+    return ::operator new(size);
+}
+
+// Frees an object of \c size bytes allocated with allocate_sized().
+[[gnu::always_inline]]
+inline void free_sized(void* ptr, size_t size) {
+#ifndef SEASTAR_HEAPPROF
+    if (__builtin_constant_p(size) && size <= max_small_allocation) {
+        free_to_size_class(ptr, size_to_size_class(std::max(size, sizeof(void*))));
+        return;
+    }
+#endif
+    ::operator delete(ptr);
+}
+
 /// \endcond
 
 class statistics;
@@ -161,13 +295,16 @@ class statistics {
     uint64_t _mallocs;
     uint64_t _frees;
     uint64_t _cross_cpu_frees;
+    uint64_t _cross_cpu_free_batches;
+    uint64_t _remote_node_cross_cpu_frees;
     size_t _total_memory;
     size_t _free_memory;
     uint64_t _reclaims;
 private:
-    statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees,
-            uint64_t total_memory, uint64_t free_memory, uint64_t reclaims)
+    statistics(uint64_t mallocs, uint64_t frees, uint64_t cross_cpu_frees, uint64_t cross_cpu_free_batches,
+            uint64_t remote_node_cross_cpu_frees, uint64_t total_memory, uint64_t free_memory, uint64_t reclaims)
         : _mallocs(mallocs), _frees(frees), _cross_cpu_frees(cross_cpu_frees)
+        , _cross_cpu_free_batches(cross_cpu_free_batches), _remote_node_cross_cpu_frees(remote_node_cross_cpu_frees)
         , _total_memory(total_memory), _free_memory(free_memory), _reclaims(reclaims) {}
 public:
     /// Total number of memory allocations calls since the system was started.
@@ -177,6 +314,12 @@ class statistics {
     /// Total number of memory deallocations that occured on a different lcore
     /// than the one on which they were allocated.
     uint64_t cross_cpu_frees() const { return _cross_cpu_frees; }
+    /// Total number of batches in which cross-lcore deallocations were
+    /// handed over to the lcore owning the memory.
+    uint64_t cross_cpu_free_batches() const { return _cross_cpu_free_batches; }
+    /// Total number of cross-lcore deallocations of memory on another NUMA
+    /// node than that of this lcore.
+    uint64_t remote_node_cross_cpu_frees() const { return _remote_node_cross_cpu_frees; }
     /// Total number of objects which were allocated but not freed.
     size_t live_objects() const { return mallocs() - frees(); }
     /// Total free memory (in bytes)
@@ -190,6 +333,44 @@ class statistics {
     friend statistics stats();
 };
 
+/// Huge page backing of the memory of this lcore.
+struct huge_page_coverage {
+    size_t resident_memory = 0; ///< Bytes resident in RAM
+    size_t huge_page_memory = 0; ///< Resident bytes backed by huge pages
+    bool hugetlbfs = false; ///< Memory comes from hugetlbfs
+    bool transparent_hugepages = false; ///< Memory is advised to use transparent huge pages
+};
+
+/// Measures how much of the memory of this lcore is backed by huge pages.
+///
+/// Reads /proc/self/smaps, so it is not meant to be called often.
+huge_page_coverage get_huge_page_coverage();
+
+/// Result of binding a part of the memory of this lcore to its NUMA node.
+struct numa_binding {
+    unsigned nodeid;
+    size_t bytes;
+    bool bound; ///< Whether mbind() succeeded
+};
+
+/// Memory bindings attempted when this lcore was configured; empty
+/// when mbind is disabled or unsupported.
+const std::vector<numa_binding>& get_numa_bindings();
+
+/// Number of span classes; free spans of class \c i are at least
+/// 2^i and less than 2^(i+1) pages long.
+static constexpr unsigned nr_span_classes = 32;
+
+/// Free memory of this lcore, in bytes, in spans of span class \c idx.
+///
+/// Memory spread over many small spans cannot serve large allocations;
+/// see \ref relocatable_region for a way to keep it contiguous.
+size_t free_memory_in_span_class(unsigned idx);
+
+/// Size of the largest free span of this lcore, in bytes: the largest
+/// allocation that can be served without reclaiming memory.
+size_t largest_free_span();
+
 struct memory_layout {
     uintptr_t start;
     uintptr_t end;
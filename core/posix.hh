@@ -43,6 +43,10 @@
 #include <memory>
 #include <chrono>
 #include <sys/uio.h>
+#ifdef HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #include "net/socket_defs.hh"
 
@@ -120,6 +124,13 @@ class file_desc {
         throw_system_error_on(fd == -1, "timerfd_create");
         return file_desc(fd);
     }
+#ifdef HAVE_IO_URING
+    static file_desc io_uring_setup(unsigned entries, io_uring_params& params) {
+        int fd = ::syscall(__NR_io_uring_setup, entries, &params);
+        throw_system_error_on(fd == -1, "io_uring_setup");
+        return file_desc(fd);
+    }
+#endif
     static file_desc temporary(sstring directory);
     file_desc dup() const {
         int fd = ::dup(get());
@@ -29,6 +29,7 @@
 #include "scollectd-impl.hh"
 #include "metrics_api.hh"
 #include "http/function_handlers.hh"
+#include "memory.hh"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/range/algorithm_ext/erase.hpp>
 #include <boost/algorithm/string.hpp>
@@ -514,13 +515,77 @@ class metrics_handler : public handler_base  {
     }
 };
 
+using heap_profiles_per_shard = std::vector<foreign_ptr<std::unique_ptr<std::vector<memory::heap_profile_site>>>>;
 
+static future<> get_heap_profiles(heap_profiles_per_shard& vec) {
+    vec.resize(smp::count);
+    return parallel_for_each(boost::irange(0u, smp::count), [&vec] (auto cpu) {
+        return smp::submit_to(cpu, [] {
+            return make_foreign(std::make_unique<std::vector<memory::heap_profile_site>>(memory::get_heap_profile()));
+        }).then([&vec, cpu] (auto&& profile) {
+            vec[cpu] = std::move(profile);
+        });
+    });
+}
+
+/*!
+ * \brief writes the sites recorded by the heap profiler of every shard
+ *
+ * Each allocation site is a set of series labeled with its shard and
+ * backtrace.
+ */
+static void write_heap_profile(std::ostream& s, const heap_profiles_per_shard& profiles, const config& ctx) {
+    using site_value = size_t memory::heap_profile_site::*;
+    struct family {
+        const char* name;
+        const char* type;
+        const char* help;
+        site_value value;
+    };
+    static const family families[] = {
+        {"heap_profile_live_bytes", "gauge", "Estimated bytes in live objects allocated at the site", &memory::heap_profile_site::live_bytes},
+        {"heap_profile_live_objects", "gauge", "Estimated number of live objects allocated at the site", &memory::heap_profile_site::live_objects},
+        {"heap_profile_allocated_bytes", "counter", "Estimated bytes allocated at the site", &memory::heap_profile_site::allocated_bytes},
+        {"heap_profile_allocated_objects", "counter", "Estimated number of objects allocated at the site", &memory::heap_profile_site::allocated_objects},
+    };
+    for (auto& f : families) {
+        auto name = ctx.prefix + "_" + f.name;
+        s << "# HELP " << name << " " << f.help << "\n";
+        s << "# TYPE " << name << " " << f.type << "\n";
+        for (unsigned shard = 0; shard < profiles.size(); ++shard) {
+            for (auto& site : *profiles[shard]) {
+                add_name(s, name, {{"shard", to_sstring(shard)}, {"backtrace", site.backtrace}}, ctx);
+                s << site.*f.value << "\n";
+            }
+        }
+    }
+}
+
+class heap_profile_handler : public handler_base  {
+    config _ctx;
+
+public:
+    heap_profile_handler(config ctx) : _ctx(ctx) {}
+
+    future<std::unique_ptr<httpd::reply>> handle(const sstring& path,
+        std::unique_ptr<httpd::request> req, std::unique_ptr<httpd::reply> rep) override {
+        return do_with(heap_profiles_per_shard(), [this, rep = std::move(rep)] (heap_profiles_per_shard& profiles) mutable {
+            return get_heap_profiles(profiles).then([this, &profiles, rep = std::move(rep)] () mutable {
+                std::stringstream s;
+                write_heap_profile(s, profiles, _ctx);
+                rep->write_body("txt", s.str());
+                return make_ready_future<std::unique_ptr<httpd::reply>>(std::move(rep));
+            });
+        });
+    }
+};
 
 future<> add_prometheus_routes(http_server& server, config ctx) {
     if (ctx.hostname == "") {
         ctx.hostname = metrics::impl::get_local_impl()->get_config().hostname;
     }
     server._routes.put(GET, "/metrics", new metrics_handler(ctx));
+    server._routes.put(GET, "/heap_profile", new heap_profile_handler(ctx));
     return make_ready_future<>();
 }
 
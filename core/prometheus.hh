@@ -39,7 +39,9 @@ struct config {
 future<> start(httpd::http_server_control& http_server, config ctx);
 
 /// \defgroup add_prometheus_routes adds a /metrics endpoint that returns prometheus metrics
-///    both in txt format and in protobuf according to the prometheus spec
+///    both in txt format and in protobuf according to the prometheus spec,
+///    and a /heap_profile endpoint that returns the allocation sites sampled
+///    by the heap profiler in txt format
 /// @{
 future<> add_prometheus_routes(distributed<http_server>& server, config ctx);
 future<> add_prometheus_routes(http_server& server, config ctx);
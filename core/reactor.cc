@@ -25,6 +25,8 @@
 #include <sys/syscall.h>
 #include <sys/vfs.h>
 #include <sys/statfs.h>
+#include <sys/sysmacros.h>
+#include <sys/sendfile.h>
 #include "task.hh"
 #include "reactor.hh"
 #include "memory.hh"
@@ -46,6 +48,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/eventfd.h>
+#include <poll.h>
+#include <mutex>
+#include <numeric>
 #include <boost/filesystem.hpp>
 #include <boost/thread/barrier.hpp>
 #include <boost/algorithm/string/classification.hpp>
@@ -101,6 +106,7 @@
 
 #include "util/defer.hh"
 #include "core/alien.hh"
+#include "core/work_stealing.hh"
 #include "core/metrics.hh"
 #include "execution_stage.hh"
 #include "exception_hacks.hh"
@@ -382,6 +388,12 @@ reactor::task_queue::task_queue(unsigned id, sstring name, float shares)
         sm::make_gauge("shares", [this] { return _shares; },
                 sm::description("Shares allocated to this queue"),
                 {group_label}),
+        sm::make_gauge("allocated_memory", [this] { return memory::get_allocation_context_stats(_id).live_bytes(); },
+                sm::description("Bytes allocated by tasks of this group less the bytes they freed; indicates the group's memory footprint"),
+                {group_label}),
+        sm::make_counter("allocated_bytes", [this] { return memory::get_allocation_context_stats(_id).allocated_bytes; },
+                sm::description("Total bytes allocated by tasks of this group"),
+                {group_label}),
     });
 }
 
@@ -416,8 +428,8 @@ struct reactor::task_queue::indirect_compare {
     }
 };
 
-reactor::reactor(unsigned id)
-    : _backend()
+reactor::reactor(unsigned id, reactor_backend_selector rbs)
+    : _backend(rbs.create())
     , _id(id)
 #ifdef HAVE_OSV
     , _timer_thread(
@@ -438,6 +450,9 @@ reactor::reactor(unsigned id)
     seastar::thread_impl::init();
     auto r = ::io_setup(max_aio, &_io_context);
     assert(r >= 0);
+#ifdef HAVE_IO_URING
+    _uring = dynamic_cast<reactor_backend_uring*>(_backend.get());
+#endif
 #ifdef HAVE_OSV
     _timer_thread.start();
 #else
@@ -699,6 +714,15 @@ class network_stack_registry {
     static future<std::unique_ptr<network_stack>> create(sstring name, options opts);
 };
 
+static void report_huge_page_coverage(const memory::huge_page_coverage& c) {
+    if (!c.resident_memory) {
+        return;
+    }
+    auto backing = c.hugetlbfs ? "hugetlbfs" : c.transparent_hugepages ? "transparent huge pages" : "small pages only";
+    seastar_logger.info("{} of {} MB resident memory backed by huge pages ({}%, {})",
+            c.huge_page_memory >> 20, c.resident_memory >> 20, 100 * c.huge_page_memory / c.resident_memory, backing);
+}
+
 void reactor::configure(boost::program_options::variables_map vm) {
     auto network_stack_ready = vm.count("network-stack")
         ? network_stack_registry::create(sstring(vm["network-stack"].as<std::string>()), vm)
@@ -717,6 +741,10 @@ void reactor::configure(boost::program_options::variables_map vm) {
 
     _max_task_backlog = vm["max-task-backlog"].as<unsigned>();
     _max_poll_time = vm["idle-poll-time-us"].as<unsigned>() * 1us;
+    _smp_polling.max_poll_window = vm["smp-poll-window-us"].as<unsigned>() * 1us;
+    if (vm.count("work-stealing")) {
+        _idle_cpu_handler = steal_tasks;
+    }
     if (vm.count("poll-mode")) {
         smp::poll_mode = true;
         _max_poll_time = std::chrono::nanoseconds::max();
@@ -726,12 +754,25 @@ void reactor::configure(boost::program_options::variables_map vm) {
            && !vm.count("poll-mode")) {
         _max_poll_time = 0us;
     }
+    if (vm.count("overprovisioned") && vm["smp-poll-window-us"].defaulted()) {
+        _smp_polling.max_poll_window = 0us;
+    }
     set_strict_dma(!vm.count("relaxed-dma"));
     if (!vm["poll-aio"].as<bool>()
             || (vm["poll-aio"].defaulted() && vm.count("overprovisioned"))) {
         _aio_eventfd = pollable_fd(file_desc::eventfd(0, 0));
     }
     set_bypass_fsync(vm["unsafe-bypass-fsync"].as<bool>());
+#ifndef HAVE_OSV
+    _thread_pool.set_workers(std::max(vm["syscall-threads"].as<unsigned>(), 1u));
+    if (vm.count("syscall-work-stealing")) {
+        _thread_pool.enable_work_stealing();
+    }
+#endif
+    _io_balancing = vm["io-queue-balancing"].as<bool>();
+    _cross_cpu_free_batch = vm["cross-cpu-free-batch"].as<unsigned>();
+    _huge_page_coverage = memory::get_huge_page_coverage();
+    report_huge_page_coverage(_huge_page_coverage);
 }
 
 future<> reactor_backend_epoll::get_epoll_future(pollable_fd_state& pfd,
@@ -795,6 +836,16 @@ void reactor_backend_epoll::forget(pollable_fd_state& fd) {
     }
 }
 
+bool reactor_backend_epoll::forget_fd(int fd) {
+    // ev_del is a param that will be ignored by EPOLL_CTL_DEL
+    // so the last param in epoll_ctl can be null, but
+    // in kernel versions before 2.6.9, the EPOLL_CTL_DEL operation required
+    // a non-null pointer in event, even though this argument is ignored.
+    // so we use a empty param here.
+    ::epoll_event ev_del;
+    return ::epoll_ctl(_epollfd.get(), EPOLL_CTL_DEL, fd, &ev_del) == 0;
+}
+
 future<> reactor_backend_epoll::notified(reactor_notifier *n) {
     // Currently reactor_backend_epoll doesn't need to support notifiers,
     // because we add to it file descriptors instead. But this can be fixed
@@ -877,22 +928,102 @@ void reactor_backend_epoll::complete_epoll_event(pollable_fd_state& pfd, promise
     }
 }
 
+#ifdef HAVE_IO_URING
+
+class reactor::uring_io_completion final : public reactor_backend_uring::completion {
+    promise<io_event> _pr;
+public:
+    future<io_event> get_future() {
+        return _pr.get_future();
+    }
+    virtual void complete(int res) noexcept override {
+        std::unique_ptr<uring_io_completion> self(this);
+        // Same encoding as linux-aio: a negative errno in res
+        io_event ev = {};
+        ev.res = res;
+        _pr.set_value(ev);
+        engine()._io_context_available.signal(1);
+    }
+};
+
+static void prep_sqe_from_iocb(::io_uring_sqe& sqe, const iocb& io) {
+    sqe.fd = io.aio_fildes;
+    switch (io.aio_lio_opcode) {
+    case IO_CMD_PREAD:
+    case IO_CMD_PWRITE:
+        sqe.opcode = io.aio_lio_opcode == IO_CMD_PREAD ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe.addr = reinterpret_cast<uintptr_t>(io.u.c.buf);
+        sqe.len = io.u.c.nbytes;
+        sqe.off = io.u.c.offset;
+        break;
+    case IO_CMD_PREADV:
+    case IO_CMD_PWRITEV:
+        sqe.opcode = io.aio_lio_opcode == IO_CMD_PREADV ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe.addr = reinterpret_cast<uintptr_t>(io.u.v.vec);
+        sqe.len = io.u.v.nr;
+        sqe.off = io.u.v.offset;
+        break;
+    case IO_CMD_FSYNC:
+    case IO_CMD_FDSYNC:
+        sqe.opcode = IORING_OP_FSYNC;
+        sqe.fsync_flags = io.aio_lio_opcode == IO_CMD_FDSYNC ? IORING_FSYNC_DATASYNC : 0;
+        break;
+    default:
+        abort();
+    }
+}
+
+template <typename Func>
+future<io_event>
+reactor::submit_io(uring_request<Func> req) {
+    return _io_context_available.wait(1).then([this, prepare = std::move(req.prepare)] () mutable {
+        auto c = std::make_unique<uring_io_completion>();
+        auto f = c->get_future();
+        prepare(*_uring->get_sqe(c.get()));
+        c.release();
+        return f;
+    });
+}
+
+template <typename Func>
+future<io_event>
+reactor::submit_io_uring(const io_priority_class& pc, Func prepare_sqe) {
+    // fsync, fallocate and friends carry no data but keep the device busy
+    // the way a write does.
+    return io_queue::queue_request(pick_io_coordinator(), pc, io_cost_model::direction::write, 0,
+            make_uring_request(std::move(prepare_sqe)));
+}
+
+#endif
+
 template <typename Func>
 future<io_event>
 reactor::submit_io(Func prepare_io) {
+#ifdef HAVE_IO_URING
+    if (_uring) {
+        return submit_io(make_uring_request([prepare_io = std::move(prepare_io)] (::io_uring_sqe& sqe) mutable {
+            iocb io = {};
+            prepare_io(io);
+            prep_sqe_from_iocb(sqe, io);
+        }));
+    }
+#endif
     return _io_context_available.wait(1).then([this, prepare_io = std::move(prepare_io)] () mutable {
-        auto pr = std::make_unique<promise<io_event>>();
+        auto c = std::make_unique<aio_completion>();
         iocb io;
         prepare_io(io);
         if (_aio_eventfd) {
             io_set_eventfd(&io, _aio_eventfd->get_fd());
         }
-        auto f = pr->get_future();
-        io.data = pr.get();
+        auto f = c->pr.get_future();
+        io.data = c.get();
         _pending_aio.push_back(io);
-        pr.release();
-        if ((_io_queue->queued_requests() > 0) ||
-            (_pending_aio.size() >= std::min(max_aio / 4, _io_queue->_capacity / 2))) {
+        c.release();
+        _aio_batching.submitted();
+        auto max_batch = std::max<size_t>(1, std::min(max_aio / 4, _io_queue->_capacity / 2));
+        // Requests waiting in the IO queue mean the disk is the bottleneck:
+        // holding ours back would only leave it idle longer.
+        if (_io_queue->queued_requests() > 0 || _aio_batching.should_flush(_pending_aio.size(), max_batch)) {
             flush_pending_aio();
         }
         return f;
@@ -904,9 +1035,11 @@ reactor::flush_pending_aio() {
     bool did_work = false;
     while (!_pending_aio.empty()) {
         auto nr = _pending_aio.size();
+        auto now = aio_batch_controller::clock_type::now();
         struct iocb* iocbs[max_aio];
         for (size_t i = 0; i < nr; ++i) {
             iocbs[i] = &_pending_aio[i];
+            reinterpret_cast<aio_completion*>(iocbs[i]->data)->submitted = now;
         }
         auto r = ::io_submit(_io_context, nr, iocbs);
         size_t nr_consumed;
@@ -916,13 +1049,13 @@ reactor::flush_pending_aio() {
                 case EAGAIN:
                     return did_work;
                 case EBADF: {
-                    auto pr = reinterpret_cast<promise<io_event>*>(iocbs[0]->data);
+                    auto c = reinterpret_cast<aio_completion*>(iocbs[0]->data);
                     try {
                         throw_kernel_error(r);
                     } catch (...) {
-                        pr->set_exception(std::current_exception());
+                        c->pr.set_exception(std::current_exception());
                     }
-                    delete pr;
+                    delete c;
                     _io_context_available.signal(1);
                     // if EBADF, it means that the first request has a bad fd, so
                     // we will only remove it from _pending_aio and try again.
@@ -937,6 +1070,7 @@ reactor::flush_pending_aio() {
             nr_consumed = size_t(r);
         }
 
+        _aio_batching.flushed(now, nr_consumed);
         did_work = true;
         if (nr_consumed == nr) {
             _pending_aio.clear();
@@ -947,6 +1081,39 @@ reactor::flush_pending_aio() {
     return did_work;
 }
 
+metrics::histogram log2_histogram::get() const {
+    metrics::histogram h;
+    h.sample_count = _count;
+    h.sample_sum = _sum;
+    // The last bucket collects everything above the largest bound and
+    // is reported as +Inf, i.e. only through sample_count.
+    for (unsigned i = 0; i < nr_buckets - 1; ++i) {
+        h.buckets.push_back(metrics::histogram_bucket{_buckets[i], double(uint64_t(1) << i)});
+    }
+    return h;
+}
+
+constexpr std::chrono::microseconds aio_batch_controller::max_flush_interval;
+
+void aio_batch_controller::flushed(clock_type::time_point now, size_t batch) {
+    auto interval = std::min(std::chrono::duration_cast<std::chrono::microseconds>(now - _last_flush), max_flush_interval);
+    auto rate = double(_submitted_since_flush) / std::max<int64_t>(interval.count(), 1);
+    _rate = ewma_weight * rate + (1 - ewma_weight) * _rate;
+    _submitted_since_flush = 0;
+    _last_flush = now;
+    ++_flushes;
+    _batch_sizes.add(batch);
+    // Requests expected to arrive while we wait for no more than
+    // max_delay_fraction of the device latency.
+    _target = std::max<size_t>(1, _rate * _latency_us * max_delay_fraction);
+}
+
+void aio_batch_controller::completed(clock_type::duration latency) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+    _latency_us = ewma_weight * us + (1 - ewma_weight) * _latency_us;
+    _latencies.add(us);
+}
+
 const io_priority_class& default_priority_class() {
     static thread_local auto shard_default_class = [] {
         return engine().register_one_priority_class("default", 1);
@@ -954,12 +1121,27 @@ const io_priority_class& default_priority_class() {
     return shard_default_class;
 }
 
+shard_id reactor::pick_io_coordinator() {
+    if (!_io_balancing || _all_io_queues.size() < 2 || !_io_queue->backlogged()) {
+        return _io_coordinator;
+    }
+    // Compare against a single other queue, taken in turn, rather than look
+    // for the least loaded one on every request: two choices already spread
+    // the load well, and each look is a cache miss on a foreign shard's line.
+    auto candidate = _all_io_queues[_next_io_candidate++ % _all_io_queues.size()];
+    if (candidate == _io_queue || !candidate->has_spare_capacity()) {
+        return _io_coordinator;
+    }
+    ++_io_stats.io_redirected;
+    return candidate->coordinator();
+}
+
 template <typename Func>
 future<io_event>
 reactor::submit_io_read(const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_io_stats.aio_reads;
     _io_stats.aio_read_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return io_queue::queue_request(pick_io_coordinator(), pc, io_cost_model::direction::read, len, std::move(prepare_io));
 }
 
 template <typename Func>
@@ -967,7 +1149,7 @@ future<io_event>
 reactor::submit_io_write(const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_io_stats.aio_writes;
     _io_stats.aio_write_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, std::move(prepare_io));
+    return io_queue::queue_request(pick_io_coordinator(), pc, io_cost_model::direction::write, len, std::move(prepare_io));
 }
 
 bool reactor::process_io()
@@ -976,21 +1158,61 @@ bool reactor::process_io()
     struct timespec timeout = {0, 0};
     auto n = ::io_getevents(_io_context, 1, max_aio, ev, &timeout);
     assert(n >= 0);
+    auto now = aio_batch_controller::clock_type::now();
     for (size_t i = 0; i < size_t(n); ++i) {
-        auto pr = reinterpret_cast<promise<io_event>*>(ev[i].data);
-        pr->set_value(ev[i]);
-        delete pr;
+        auto c = reinterpret_cast<aio_completion*>(ev[i].data);
+        _aio_batching.completed(now - c->submitted);
+        c->pr.set_value(ev[i]);
+        delete c;
     }
     _io_context_available.signal(n);
     return n;
 }
 
-io_queue::io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology)
-        : _coordinator(coordinator)
-        , _capacity(capacity)
-        , _io_topology(std::move(topology))
+io_cost_model::io_cost_model()
+        : _read{1, 1.0f / (16 << 10)}
+        , _write(_read) {
+}
+
+io_cost_model::io_cost_model(throughput read, throughput write)
+        : io_cost_model() {
+    // A direction that was not measured is assumed to perform like the other.
+    if (!read.iops) {
+        read.iops = write.iops;
+    }
+    if (!write.iops) {
+        write.iops = read.iops;
+    }
+    if (!read.bandwidth) {
+        read.bandwidth = write.bandwidth;
+    }
+    if (!write.bandwidth) {
+        write.bandwidth = read.bandwidth;
+    }
+    if (!read.iops || !read.bandwidth) {
+        return;
+    }
+    auto op_time = 1.0 / read.iops;
+    auto cost = [op_time] (throughput t) {
+        return fair_queue_cost{float(1.0 / t.iops / op_time), float(1.0 / t.bandwidth / op_time)};
+    };
+    _read = cost(read);
+    _write = cost(write);
+}
+
+io_queue::io_queue(config cfg)
+        : _coordinator(cfg.coordinator)
+        , _capacity(cfg.capacity)
+        , _io_topology(std::move(cfg.topology))
+        , _limits_fraction(cfg.limits_fraction)
+        , _cost_model(cfg.cost_model)
+        , _shares_capacity(cfg.shared_capacity)
         , _priority_classes()
-        , _fq(capacity) {
+        , _fq(cfg.capacity) {
+    if (cfg.shared_capacity) {
+        _fq.share_capacity(*cfg.shared_capacity, _coordinator);
+    }
+    _fq.update_limits(local_limits(cfg.device_limits));
 }
 
 io_queue::~io_queue() {
@@ -1010,13 +1232,48 @@ std::array<std::atomic<uint32_t>, io_queue::_max_classes> io_queue::_registered_
 // structure is passed along all the time - and sometimes we can't help but copy it, better keep
 // it lean. The name won't really be used for anything other than monitoring.
 std::array<sstring, io_queue::_max_classes> io_queue::_registered_names;
+std::array<std::atomic<uint64_t>, io_queue::_max_classes> io_queue::_registered_ops_limits;
+std::array<std::atomic<uint64_t>, io_queue::_max_classes> io_queue::_registered_bytes_limits;
 
 void io_queue::fill_shares_array() {
     for (unsigned i = 0; i < _max_classes; ++i) {
         _registered_shares[i].store(0);
+        _registered_ops_limits[i].store(0);
+        _registered_bytes_limits[i].store(0);
     }
 }
 
+fair_queue_limits io_queue::local_limits(fair_queue_limits limits) const {
+    auto scale = [this] (uint64_t limit) {
+        return limit ? std::max<uint64_t>(1, limit * _limits_fraction) : 0;
+    };
+    return fair_queue_limits{scale(limits.ops_per_second), scale(limits.bytes_per_second)};
+}
+
+void io_queue::set_class_limits(const io_priority_class& pc, fair_queue_limits limits) {
+    _registered_ops_limits.at(pc.id()).store(limits.ops_per_second, std::memory_order_relaxed);
+    _registered_bytes_limits.at(pc.id()).store(limits.bytes_per_second, std::memory_order_relaxed);
+}
+
+void io_queue::update_class_limits(const io_priority_class& pc) {
+    // Classes not created yet will pick the limits up when they are.
+    auto it = _priority_classes.find(pc.id());
+    if (it != _priority_classes.end()) {
+        _fq.update_limits(it->second->ptr, local_limits(fair_queue_limits{
+                _registered_ops_limits[pc.id()].load(std::memory_order_relaxed),
+                _registered_bytes_limits[pc.id()].load(std::memory_order_relaxed)}));
+    }
+}
+
+future<> reactor::update_io_priority_class_limits(const io_priority_class& pc, fair_queue_limits limits) {
+    io_queue::set_class_limits(pc, limits);
+    return smp::invoke_on_all([pc] {
+        if (engine().my_io_queue) {
+            engine().my_io_queue->update_class_limits(pc);
+        }
+    });
+}
+
 io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares) {
     for (unsigned i = 0; i < _max_classes; ++i) {
         uint32_t unused = 0;
@@ -1083,28 +1340,30 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
 
         auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(name, _fq.register_priority_class(shares), owner));
         it_pclass = ret.first;
+        update_class_limits(pc);
     }
     return *(it_pclass->second);
 }
 
 template <typename Func>
 future<io_event>
-io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func prepare_io) {
+io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, io_cost_model::direction dir, size_t len, Func prepare_io) {
     auto start = std::chrono::steady_clock::now();
-    return smp::submit_to(coordinator, [start, &pc, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
+    return smp::submit_to(coordinator, [start, &pc, dir, len, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
         auto& queue = *(engine()._io_queue);
-        unsigned weight = 1 + len/(16 << 10);
         // First time will hit here, and then we create the class. It is important
         // that we create the shared pointer in the same shard it will be used at later.
         auto& pclass = queue.find_or_create_class(pc, owner);
         pclass.bytes += len;
         pclass.ops++;
         pclass.nr_queued++;
-        return queue._fq.queue(pclass.ptr, weight, [&pclass, start, prepare_io = std::move(prepare_io)] {
+        auto f = queue._fq.queue(pclass.ptr, queue._cost_model.cost(dir).describe(len), [&pclass, start, prepare_io = std::move(prepare_io)] {
             pclass.nr_queued--;
             pclass.queue_time = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start);
             return engine().submit_io(std::move(prepare_io));
         });
+        queue.publish_load();
+        return f;
     });
 }
 
@@ -1761,6 +2020,28 @@ reactor::remove_file(sstring pathname) {
     });
 }
 
+future<size_t>
+reactor::sendfile(pollable_fd_state& fd, int in_fd, uint64_t offset, size_t len) {
+    return writeable(fd).then([this, &fd, in_fd, offset, len] {
+        // sendfile() reads through the page cache and may wait for the disk,
+        // so it runs in the syscall thread pool. The socket is non-blocking,
+        // so it does not wait for the peer.
+        return _thread_pool.submit<syscall_result<ssize_t>>([out_fd = fd.fd.get(), in_fd, offset, len] {
+            off_t off = offset;
+            return wrap_syscall<ssize_t>(::sendfile(out_fd, in_fd, &off, len));
+        });
+    }).then([this, &fd, in_fd, offset, len] (syscall_result<ssize_t> sr) {
+        if (sr.result == -1 && sr.error == EAGAIN) {
+            return sendfile(fd, in_fd, offset, len);
+        }
+        sr.throw_if_error();
+        if (size_t(sr.result) == len) {
+            fd.speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(sr.result);
+    });
+}
+
 future<>
 reactor::rename_file(sstring old_pathname, sstring new_pathname) {
     return engine()._thread_pool.submit<syscall_result<int>>([old_pathname, new_pathname] {
@@ -1986,6 +2267,17 @@ posix_file_impl::flush(void) {
     if (engine()._bypass_fsync) {
         return make_ready_future<>();
     }
+#ifdef HAVE_IO_URING
+    if (engine().uring_file_io()) {
+        return engine().submit_io_uring(default_priority_class(), [fd = _fd] (::io_uring_sqe& sqe) {
+            sqe.opcode = IORING_OP_FSYNC;
+            sqe.fd = fd;
+            sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        }).then([] (io_event ev) {
+            throw_kernel_error(long(ev.res));
+        });
+    }
+#endif
     return engine()._thread_pool.submit<syscall_result<int>>([this] {
         return wrap_syscall<int>(::fdatasync(_fd));
     }).then([] (syscall_result<int> sr) {
@@ -1994,8 +2286,46 @@ posix_file_impl::flush(void) {
     });
 }
 
+#ifdef HAVE_IO_URING
+static struct stat stat_from_statx(const struct statx& stx) {
+    struct stat st = {};
+    st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st.st_ino = stx.stx_ino;
+    st.st_mode = stx.stx_mode;
+    st.st_nlink = stx.stx_nlink;
+    st.st_uid = stx.stx_uid;
+    st.st_gid = stx.stx_gid;
+    st.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st.st_size = stx.stx_size;
+    st.st_blksize = stx.stx_blksize;
+    st.st_blocks = stx.stx_blocks;
+    st.st_atim = timespec{stx.stx_atime.tv_sec, stx.stx_atime.tv_nsec};
+    st.st_mtim = timespec{stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+    st.st_ctim = timespec{stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+    return st;
+}
+#endif
+
 future<struct stat>
 posix_file_impl::stat(void) {
+#ifdef HAVE_IO_URING
+    if (engine().uring_file_io()) {
+        auto stx = std::make_unique<struct statx>();
+        auto stx_ptr = stx.get();
+        return engine().submit_io_uring(default_priority_class(), [fd = _fd, stx_ptr] (::io_uring_sqe& sqe) {
+            static const char empty_path[] = "";
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = fd;
+            sqe.addr = reinterpret_cast<uintptr_t>(empty_path);
+            sqe.len = STATX_BASIC_STATS;
+            sqe.statx_flags = AT_EMPTY_PATH;
+            sqe.addr2 = reinterpret_cast<uintptr_t>(stx_ptr);
+        }).then([stx = std::move(stx)] (io_event ev) {
+            throw_kernel_error(long(ev.res));
+            return stat_from_statx(*stx);
+        });
+    }
+#endif
     return engine()._thread_pool.submit<syscall_result_extra<struct stat>>([this] {
         struct stat st;
         auto ret = ::fstat(_fd, &st);
@@ -2025,8 +2355,27 @@ blockdev_file_impl::truncate(uint64_t length) {
     return make_ready_future<>();
 }
 
+#ifdef HAVE_IO_URING
+static future<> uring_fallocate(int fd, int mode, uint64_t offset, uint64_t length) {
+    return engine().submit_io_uring(default_priority_class(), [fd, mode, offset, length] (::io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_FALLOCATE;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = length;
+        sqe.len = mode;
+    }).then([] (io_event ev) {
+        throw_kernel_error(long(ev.res));
+    });
+}
+#endif
+
 future<>
 posix_file_impl::discard(uint64_t offset, uint64_t length) {
+#ifdef HAVE_IO_URING
+    if (engine().uring_file_io()) {
+        return uring_fallocate(_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, offset, length);
+    }
+#endif
     return engine()._thread_pool.submit<syscall_result<int>>([this, offset, length] () mutable {
         return wrap_syscall<int>(::fallocate(_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
             offset, length));
@@ -2044,6 +2393,16 @@ posix_file_impl::allocate(uint64_t position, uint64_t length) {
     if (!supported) {
         return make_ready_future<>();
     }
+#ifdef HAVE_IO_URING
+    if (engine().uring_file_io()) {
+        return uring_fallocate(_fd, FALLOC_FL_ZERO_RANGE|FALLOC_FL_KEEP_SIZE, position, length).handle_exception_type([] (std::system_error& e) {
+            if (e.code().value() != EOPNOTSUPP) {
+                throw;
+            }
+            supported = false; // Racy, but harmless.  At most we issue an extra call or two.
+        });
+    }
+#endif
     return engine()._thread_pool.submit<syscall_result<int>>([this, position, length] () mutable {
         auto ret = ::fallocate(_fd, FALLOC_FL_ZERO_RANGE|FALLOC_FL_KEEP_SIZE, position, length);
         if (ret == -1 && errno == EOPNOTSUPP) {
@@ -2371,8 +2730,33 @@ void reactor::register_metrics() {
             // total_operations value:DERIVE:0:U
             sm::make_derive("fsyncs", _fsyncs, sm::description("Total number of fsync operations")),
             // total_operations value:DERIVE:0:U
+            sm::make_derive("io_redirected", _io_stats.io_redirected,
+                    sm::description("Total number of disk requests sent to another IO queue than this shard's, because it was backlogged")),
+            // total_operations value:DERIVE:0:U
+            sm::make_derive("aio_submits", std::bind(&aio_batch_controller::flushes, &_aio_batching),
+                    sm::description("Total number of io_submit() calls")),
+            sm::make_gauge("aio_batch_target", std::bind(&aio_batch_controller::target, &_aio_batching),
+                    sm::description("Number of pending aio requests at which they are submitted without waiting for the aio poller")),
+            sm::make_histogram("aio_batch_size", std::bind(&aio_batch_controller::batch_sizes, &_aio_batching),
+                    sm::description("Number of requests submitted per io_submit() call")),
+            sm::make_histogram("aio_latency", std::bind(&aio_batch_controller::latencies, &_aio_batching),
+                    sm::description("Time (us) from io_submit() until the request completed")),
+            // total_operations value:DERIVE:0:U
             sm::make_derive("io_threaded_fallbacks", std::bind(&thread_pool::operation_count, &_thread_pool),
                     sm::description("Total number of io-threaded-fallbacks operations")),
+#ifndef HAVE_OSV
+            sm::make_queue_length("syscall_queue_length", std::bind(&thread_pool::queue_length, &_thread_pool),
+                    sm::description("Number of blocking system calls submitted to the syscall threads and not yet completed")),
+            sm::make_gauge("syscall_threads", std::bind(&thread_pool::workers, &_thread_pool),
+                    sm::description("Number of threads executing this shard's blocking system calls")),
+            // total_operations value:DERIVE:0:U
+            sm::make_derive("syscall_stolen", std::bind(&thread_pool::stolen_count, &_thread_pool),
+                    sm::description("Total number of this shard's blocking system calls executed by another shard's syscall threads")),
+            sm::make_histogram("syscall_queue_latency", std::bind(&thread_pool::queue_latency, &_thread_pool),
+                    sm::description("Time (us) blocking system calls waited before a syscall thread picked them up")),
+            sm::make_histogram("syscall_service_latency", std::bind(&thread_pool::service_latency, &_thread_pool),
+                    sm::description("Time (us) syscall threads spent executing blocking system calls")),
+#endif
 
     });
 
@@ -2381,17 +2765,66 @@ void reactor::register_metrics() {
                     sm::description("Total number of malloc operations")),
             sm::make_derive("free_operations", [] { return memory::stats().frees(); }, sm::description("Total number of free operations")),
             sm::make_derive("cross_cpu_free_operations", [] { return memory::stats().cross_cpu_frees(); }, sm::description("Total number of cross cpu free")),
+            sm::make_derive("cross_cpu_free_batches", [] { return memory::stats().cross_cpu_free_batches(); },
+                    sm::description("Total number of batches in which cross cpu frees were handed over to the owning cpu")),
+            sm::make_derive("remote_node_cross_cpu_free_operations", [] { return memory::stats().remote_node_cross_cpu_frees(); },
+                    sm::description("Total number of cross cpu frees of memory on another NUMA node")),
             sm::make_gauge("malloc_live_objects", [] { return memory::stats().live_objects(); }, sm::description("Number of live objects")),
             sm::make_current_bytes("free_memory", [] { return memory::stats().free_memory(); }, sm::description("Free memeory size in bytes")),
             sm::make_current_bytes("total_memory", [] { return memory::stats().total_memory(); }, sm::description("Total memeory size in bytes")),
             sm::make_current_bytes("allocated_memory", [] { return memory::stats().allocated_memory(); }, sm::description("Allocated memeory size in bytes")),
-            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations"))
+            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations")),
+            sm::make_current_bytes("resident_memory", [this] { return _huge_page_coverage.resident_memory; },
+                    sm::description("Memory of the shard resident in RAM, measured at startup")),
+            sm::make_current_bytes("huge_page_memory", [this] { return _huge_page_coverage.huge_page_memory; },
+                    sm::description("Resident memory of the shard backed by huge pages, measured at startup")),
+            sm::make_current_bytes("largest_free_span", [] { return memory::largest_free_span(); },
+                    sm::description("Largest allocation the shard can serve without reclaiming memory")),
+    });
+
+    static auto span_pages_label = sm::label("span_pages");
+    auto total_pages = memory::stats().total_memory() / memory::page_size;
+    for (unsigned i = 0; i < memory::nr_span_classes && (size_t(1) << i) <= total_pages; ++i) {
+        _metric_groups.add_group("memory", {
+            sm::make_current_bytes("span_class_free_memory", [i] { return memory::free_memory_in_span_class(i); },
+                    sm::description("Free memory in spans of at least this many pages, and less than twice as many"),
+                    {span_pages_label(size_t(1) << i)}),
+        });
+    }
+
+    _metric_groups.add_group("smp", {
+            sm::make_derive("remote_node_sent_messages", [] { return smp::remote_node_sent_messages(); },
+                    sm::description("Total number of messages sent to shards on another NUMA node")),
+            sm::make_derive("remote_node_received_messages", [] { return smp::remote_node_received_messages(); },
+                    sm::description("Total number of messages received from shards on another NUMA node")),
+            sm::make_derive("doorbell_polls", _smp_polling.doorbell_polls,
+                    sm::description("Total number of times the queues of a shard which rang the doorbell were polled")),
+            sm::make_derive("wasted_polls", _smp_polling.wasted_polls,
+                    sm::description("Total number of doorbell polls which found no messages")),
+            sm::make_derive("wakeups", _smp_polling.wakeups,
+                    sm::description("Total number of sleeping shards woken up to receive messages")),
+            sm::make_derive("coalesced_wakeups", _smp_polling.coalesced_wakeups,
+                    sm::description("Total number of wakeups of sleeping shards saved by coalescing them")),
+            sm::make_gauge("poll_window", [this] { return std::chrono::duration_cast<std::chrono::microseconds>(_smp_polling.poll_window).count(); },
+                    sm::description("Time in microseconds the shard keeps polling for messages after the last one")),
     });
 
+    static auto node_label = sm::label("node");
+    for (auto& b : memory::get_numa_bindings()) {
+        _metric_groups.add_group("memory", {
+            sm::make_current_bytes("numa_bound_memory", [b] { return b.bound ? b.bytes : 0; },
+                    sm::description("Memory of the shard bound to this NUMA node"), {node_label(b.nodeid)}),
+            sm::make_current_bytes("numa_unbound_memory", [b] { return b.bound ? 0 : b.bytes; },
+                    sm::description("Memory of the shard meant for this NUMA node which mbind() failed to bind"), {node_label(b.nodeid)}),
+        });
+    }
+
     _metric_groups.add_group("reactor", {
             sm::make_derive("logging_failures", [] { return logging_failures; }, sm::description("Total number of logging failures")),
             // total_operations value:DERIVE:0:U
             sm::make_derive("cpp_exceptions", _cxx_exceptions, sm::description("Total number of C++ exceptions")),
+            sm::make_derive("stolen_tasks", [] { return internal::stolen_tasks(); },
+                    sm::description("Total number of stealable tasks of other shards run by this shard")),
     });
 
     if (my_io_queue) {
@@ -2432,15 +2865,15 @@ void reactor::register_metrics() {
 void reactor::run_tasks(task_queue& tq) {
     // Make sure new tasks will inherit our scheduling group
     *internal::current_scheduling_group_ptr() = scheduling_group(tq._id);
+    memory::set_allocation_context(tq._id);
     auto& tasks = tq._q;
     while (!tasks.empty()) {
-        auto tsk = std::move(tasks.front());
+        auto tsk = tasks.front().release();
         tasks.pop_front();
 #ifdef HAVE_SDT
         STAP_PROBE(seastar, reactor_run_tasks_single_start);
 #endif
-        tsk->run();
-        tsk.reset();
+        tsk->run_and_dispose();
 #ifdef HAVE_SDT
         STAP_PROBE(seastar, reactor_run_tasks_single_end);
 #endif
@@ -2605,10 +3038,55 @@ class reactor::aio_batch_submit_pollfn final : public reactor::pollfn {
     }
 };
 
+// Keeps the load the coordinator publishes for the other shards up to date,
+// as requests complete.
+class reactor::io_queue_load_pollfn final : public reactor::pollfn {
+    io_queue& _queue;
+public:
+    io_queue_load_pollfn(io_queue& queue) : _queue(queue) {}
+    virtual bool poll() final override {
+        _queue.publish_load();
+        return false;
+    }
+    virtual bool pure_poll() override final {
+        return false;
+    }
+    virtual bool try_enter_interrupt_mode() override {
+        _queue.publish_load();
+        return true;
+    }
+    virtual void exit_interrupt_mode() override final {
+    }
+};
+
+// With direct submission, dispatches the requests that wait for capacity
+// other shards have returned.
+class reactor::io_queue_dispatch_pollfn final : public reactor::pollfn {
+    io_queue& _queue;
+public:
+    io_queue_dispatch_pollfn(io_queue& queue) : _queue(queue) {}
+    virtual bool poll() final override {
+        return _queue.dispatch_waiting();
+    }
+    virtual bool pure_poll() override final {
+        return _queue.can_dispatch();
+    }
+    virtual bool try_enter_interrupt_mode() override {
+        // Either our own completions or the next shard to return capacity
+        // will wake us up.
+        return _queue.wait_for_capacity();
+    }
+    virtual void exit_interrupt_mode() override final {
+        _queue.stop_waiting_for_capacity();
+    }
+};
+
 class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
 public:
     virtual bool poll() final override {
-        return memory::drain_cross_cpu_freelist();
+        // Also hand the items we freed for other cpus over to them
+        auto flushed = memory::flush_cross_cpu_frees();
+        return memory::drain_cross_cpu_freelist() | flushed;
     }
     virtual bool pure_poll() override final {
         return poll(); // actually performs work, but triggers no user continuations, so okay
@@ -2619,6 +3097,8 @@ class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
         // doesn't have any side effects.
         //
         // We'll take care of those items when we wake up for another reason.
+        // Items we batched for other cpus must not wait for us, though.
+        memory::flush_cross_cpu_frees();
         return true;
     }
     virtual void exit_interrupt_mode() override final {
@@ -2704,6 +3184,13 @@ class reactor::smp_pollfn final : public reactor::pollfn {
         return smp::pure_poll_queues();
     }
     virtual bool try_enter_interrupt_mode() override {
+        auto& polling = _r._smp_polling;
+        auto now = sched_clock::now();
+        // Messages tend to come in bursts, so keep polling for a while
+        // after the last one rather than paying for a wakeup.
+        if (now - polling.last_message < polling.poll_window) {
+            return false;
+        }
         // systemwide_memory_barrier() is very slow if run concurrently,
         // so don't go to sleep if it is running now.
         if (!_membarrier_lock.try_lock()) {
@@ -2717,10 +3204,25 @@ class reactor::smp_pollfn final : public reactor::pollfn {
             _r._sleeping.store(false, std::memory_order_relaxed);
             return false;
         }
+        polling.sleep_start = now;
         return true;
     }
     virtual void exit_interrupt_mode() override final {
         _r._sleeping.store(false, std::memory_order_relaxed);
+        auto& polling = _r._smp_polling;
+        // A poller registered after us may have refused to sleep, in
+        // which case there is nothing to learn from.
+        if (!std::exchange(polling.slept, false)) {
+            return;
+        }
+        // Widen the window if we were woken up soon after going to sleep,
+        // and narrow it if the sleep was long enough to be worth it.
+        auto slept = sched_clock::now() - polling.sleep_start;
+        if (slept < polling.max_poll_window) {
+            polling.poll_window = std::min(std::max(polling.poll_window * 2, std::chrono::nanoseconds(1us)), polling.max_poll_window);
+        } else {
+            polling.poll_window /= 2;
+        }
     }
 };
 
@@ -2935,6 +3437,7 @@ reactor::run_some_tasks(sched_clock::time_point& t_run_completed) {
     STAP_PROBE(seastar, reactor_run_tasks_end);
 #endif
     *internal::current_scheduling_group_ptr() = default_scheduling_group(); // Prevent inheritance from last group run
+    memory::set_allocation_context(0);
     sched_print("run_some_tasks: end");
 }
 
@@ -3016,6 +3519,15 @@ int reactor::run() {
     }
 
     poller syscall_poller(std::make_unique<syscall_pollfn>(*this));
+
+    std::experimental::optional<poller> io_queue_load_poller;
+    if (my_io_queue && _all_io_queues.size() > 1) {
+        io_queue_load_poller = poller(std::make_unique<io_queue_load_pollfn>(*my_io_queue));
+    }
+    std::experimental::optional<poller> io_queue_dispatch_poller;
+    if (my_io_queue && my_io_queue->shares_capacity()) {
+        io_queue_dispatch_poller = poller(std::make_unique<io_queue_dispatch_pollfn>(*my_io_queue));
+    }
 #ifndef HAVE_OSV
     _signals.handle_signal(alarm_signal(), [this] {
         complete_timers(_timers, _expired_timers, [this] {
@@ -3027,6 +3539,8 @@ int reactor::run() {
 #endif
 
     poller drain_cross_cpu_freelist(std::make_unique<drain_cross_cpu_freelist_pollfn>());
+    // The poller above flushes the batches
+    memory::set_cross_cpu_free_batching(_cross_cpu_free_batch);
 
     poller expire_lowres_timers(std::make_unique<lowres_timer_pollfn>(*this));
 
@@ -3103,6 +3617,7 @@ int reactor::run() {
                 idle = true;
             }
             bool go_to_sleep = true;
+            internal::stop_stealing();
             try {
                 // we can't run check_for_work(), because that can run tasks in the context
                 // of the idle handler which change its state, without the idle handler expecting
@@ -3141,6 +3656,7 @@ int reactor::run() {
     // the I/O queue happens to use any other infrastructure that is also kept this way (for
     // instance, collectd), we will not have any way to guarantee who is destroyed first.
     my_io_queue.reset(nullptr);
+    memory::set_cross_cpu_free_batching(0);
     return _return;
 }
 
@@ -3176,6 +3692,7 @@ reactor::sleep() {
         }
     }
     wait_and_process(-1, &_active_sigmask);
+    _smp_polling.slept = true;
     for (auto i = _pollers.rbegin(); i != _pollers.rend(); ++i) {
         (*i)->exit_interrupt_mode();
     }
@@ -3337,27 +3854,13 @@ syscall_work_queue::syscall_work_queue()
 }
 
 void syscall_work_queue::submit_item(std::unique_ptr<syscall_work_queue::work_item> item) {
+    item->_submitted = work_item::clock_type::now();
     _queue_has_room.wait().then([this, item = std::move(item)] () mutable {
         _pending.push(item.release());
         _start_eventfd.signal(1);
     });
 }
 
-unsigned syscall_work_queue::complete() {
-    std::array<work_item*, queue_length> tmp_buf;
-    auto end = tmp_buf.data();
-    auto nr = _completed.consume_all([&] (work_item* wi) {
-        *end++ = wi;
-    });
-    for (auto p = tmp_buf.data(); p != end; ++p) {
-        auto wi = *p;
-        wi->complete();
-        delete wi;
-    }
-    _queue_has_room.signal(nr);
-    return nr;
-}
-
 smp_message_queue::smp_message_queue(reactor* from, reactor* to)
     : _pending(to)
     , _completed(from)
@@ -3374,30 +3877,65 @@ void smp_message_queue::stop() {
     _metrics.clear();
 }
 
+smp_message_queue::work_item_cache::~work_item_cache() {
+    for (auto item : _free) {
+        while (item) {
+            ::operator delete(std::exchange(item, item->next));
+        }
+    }
+}
+
+void* smp_message_queue::work_item_cache::allocate(unsigned size_class, size_t size) {
+    if (size_class == uncached) {
+        return ::operator new(size);
+    }
+    auto item = _free[size_class];
+    if (!item) {
+        return ::operator new(min_item_size << size_class);
+    }
+    _free[size_class] = item->next;
+    --_nr_free[size_class];
+    return item;
+}
+
+void smp_message_queue::work_item_cache::free(void* item, unsigned size_class) {
+    if (size_class == uncached || _nr_free[size_class] == max_cached) {
+        ::operator delete(item);
+        return;
+    }
+    _free[size_class] = new (item) free_item{_free[size_class]};
+    ++_nr_free[size_class];
+}
+
+void smp_message_queue::free_item(work_item* wi) {
+    auto size_class = wi->_size_class;
+    wi->~work_item();
+    _tx.a.items.free(wi, size_class);
+}
+
 void smp_message_queue::move_pending() {
-    auto begin = _tx.a.pending_fifo.cbegin();
-    auto end = _tx.a.pending_fifo.cend();
-    end = _pending.push(begin, end);
+    auto& fifo = _tx.a.pending_fifo;
+    auto begin = fifo.cbegin();
+    auto end = _pending.push(begin, fifo.cend());
     if (begin == end) {
         return;
     }
     auto nr = end - begin;
     _pending.maybe_wakeup();
-    _tx.a.pending_fifo.erase(begin, end);
+    fifo.erase(fifo.begin(), fifo.begin() + nr);
     _current_queue_length += nr;
     _last_snt_batch = nr;
     _sent += nr;
 }
 
-bool smp_message_queue::pure_poll_tx() const {
-    // can't use read_available(), not available on older boost
-    // empty() is not const, so need const_cast.
-    return !const_cast<lf_queue&>(_completed).empty();
-}
-
-void smp_message_queue::submit_item(std::unique_ptr<smp_message_queue::work_item> item) {
-    _tx.a.pending_fifo.push_back(item.get());
-    item.release();
+void smp_message_queue::submit_item(smp_message_queue::work_item* item) {
+    try {
+        _tx.a.pending_fifo.push_back(item);
+    } catch (...) {
+        free_item(item);
+        throw;
+    }
+    engine()._smp_polling.unflushed.set(_pending.remote->_id);
     if (_tx.a.pending_fifo.size() >= batch_size) {
         move_pending();
     }
@@ -3405,6 +3943,7 @@ void smp_message_queue::submit_item(std::unique_ptr<smp_message_queue::work_item
 
 void smp_message_queue::respond(work_item* item) {
     _completed_fifo.push_back(item);
+    engine()._smp_polling.unflushed.set(_completed.remote->_id);
     if (_completed_fifo.size() >= batch_size || engine()._stopped) {
         flush_response_batch();
     }
@@ -3427,10 +3966,8 @@ bool smp_message_queue::has_unflushed_responses() const {
     return !_completed_fifo.empty();
 }
 
-bool smp_message_queue::pure_poll_rx() const {
-    // can't use read_available(), not available on older boost
-    // empty() is not const, so need const_cast.
-    return !const_cast<lf_queue&>(_pending).empty();
+bool smp_message_queue::has_unflushed_requests() const {
+    return !_tx.a.pending_fifo.empty();
 }
 
 void
@@ -3442,11 +3979,24 @@ smp_message_queue::lf_queue::maybe_wakeup() {
     // because seq_cst is so expensive.
     //
     // However, we do need a compiler barrier:
+    auto& r = engine();
+    remote->_smp_doorbell.ring(r._id);
     std::atomic_signal_fence(std::memory_order_seq_cst);
     if (remote->_sleeping.load(std::memory_order_relaxed)) {
-        // We are free to clear it, because we're sending a signal now
-        remote->_sleeping.store(false, std::memory_order_relaxed);
-        remote->wakeup();
+        auto& polling = r._smp_polling;
+        if (r._stopped || !polling.in_poll) {
+            // A task filled a batch, and our next poll may be a whole
+            // task quota away; or we may not poll again at all.
+            remote->_sleeping.store(false, std::memory_order_relaxed);
+            remote->wakeup();
+            return;
+        }
+        // Wake it up once at the end of the poll, however many batches
+        // we send it until then.
+        if (polling.pending_wakeups.test(remote->_id)) {
+            ++polling.coalesced_wakeups;
+        }
+        polling.pending_wakeups.set(remote->_id);
     }
 }
 
@@ -3474,9 +4024,9 @@ size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
 }
 
 size_t smp_message_queue::process_completions() {
-    auto nr = process_queue<prefetch_cnt*2>(_completed, [] (work_item* wi) {
+    auto nr = process_queue<prefetch_cnt*2>(_completed, [this] (work_item* wi) {
         wi->complete();
-        delete wi;
+        free_item(wi);
     });
     _current_queue_length -= nr;
     _compl += nr;
@@ -3525,8 +4075,121 @@ void smp_message_queue::start(unsigned cpuid) {
 
 /* not yet implemented for OSv. TODO: do the notification like we do class smp. */
 #ifndef HAVE_OSV
-thread_pool::thread_pool(sstring name) : _worker_thread([this, name] { work(name); }), _notify(pthread_self()) {
-    engine()._signals.handle_signal(SIGUSR1, [this] { inter_thread_wq.complete(); });
+// The pools which enabled work stealing
+struct thread_pool::registry {
+    std::mutex lock;
+    std::vector<thread_pool*> pools;
+    unsigned next_victim = 0;
+    unsigned next_thief = 0;
+};
+
+thread_pool::registry& thread_pool::pools() {
+    static registry r;
+    return r;
+}
+
+thread_pool::thread_pool(sstring name) : _name(std::move(name)), _notify(pthread_self()) {
+    ::fcntl(inter_thread_wq._start_eventfd.get_read_fd(), F_SETFL, O_NONBLOCK);
+    engine()._signals.handle_signal(SIGUSR1, [this] { complete(); });
+    set_workers(1);
+}
+
+void thread_pool::enable_work_stealing() {
+    if (_stealing.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto& r = pools();
+    std::lock_guard<std::mutex> g(r.lock);
+    r.pools.push_back(this);
+    _stealing.store(true, std::memory_order_relaxed);
+}
+
+void thread_pool::set_workers(unsigned nr_workers) {
+    while (_worker_threads.size() < nr_workers) {
+        auto name = _worker_threads.empty() ? _name : seastar::format("{}-{}", _name, _worker_threads.size());
+        _worker_threads.emplace_back([this, name] { work(name); });
+    }
+}
+
+void thread_pool::request_stealers() {
+    auto& r = pools();
+    // Best effort: the reactor must not block behind a stealer holding the
+    // lock, and our own workers run the request eventually anyway.
+    std::unique_lock<std::mutex> g(r.lock, std::try_to_lock);
+    if (!g.owns_lock()) {
+        return;
+    }
+    auto nr = r.pools.size();
+    for (unsigned i = 0; i < nr; ++i) {
+        auto p = r.pools[(r.next_thief + i) % nr];
+        if (p != this && p->_idle_workers.load(std::memory_order_relaxed)) {
+            r.next_thief = (r.next_thief + i + 1) % nr;
+            // Finding its own queue empty, the worker steals from us.
+            p->inter_thread_wq._start_eventfd.signal(1);
+            return;
+        }
+    }
+}
+
+void thread_pool::run(syscall_work_queue::work_item* wi) {
+    auto start = syscall_work_queue::work_item::clock_type::now();
+    wi->_queued = start - wi->_submitted;
+    wi->process();
+    wi->_service = syscall_work_queue::work_item::clock_type::now() - start;
+    inter_thread_wq._completed.push(wi);
+    if (_main_thread_idle.load(std::memory_order_seq_cst)) {
+        pthread_kill(_notify, SIGUSR1);
+    }
+}
+
+bool thread_pool::run_one() {
+    syscall_work_queue::work_item* wi;
+    if (!inter_thread_wq._pending.pop(wi)) {
+        return false;
+    }
+    if (!inter_thread_wq._pending.empty()) {
+        // More requests are queued than we can take, hand them to a sibling
+        // or, if all of them are busy, to another pool.
+        if (_idle_workers.load(std::memory_order_relaxed)) {
+            inter_thread_wq._start_eventfd.signal(1);
+        } else if (_stealing.load(std::memory_order_relaxed)) {
+            request_stealers();
+        }
+    }
+    run(wi);
+    return true;
+}
+
+bool thread_pool::steal_one() {
+    auto& r = pools();
+    thread_pool* victim = nullptr;
+    {
+        std::lock_guard<std::mutex> g(r.lock);
+        auto nr = r.pools.size();
+        for (unsigned i = 0; i < nr; ++i) {
+            auto p = r.pools[(r.next_victim + i) % nr];
+            if (p != this && !p->_idle_workers.load(std::memory_order_relaxed)
+                    && !p->inter_thread_wq._pending.empty()) {
+                victim = p;
+                r.next_victim = (r.next_victim + i + 1) % nr;
+                // Keeps the victim alive until we are done with its request,
+                // see ~thread_pool().
+                victim->_stealers.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+    syscall_work_queue::work_item* wi;
+    auto found = victim->inter_thread_wq._pending.pop(wi);
+    if (found) {
+        victim->_stolen.fetch_add(1, std::memory_order_relaxed);
+        victim->run(wi);
+    }
+    victim->_stealers.fetch_sub(1, std::memory_order_release);
+    return found;
 }
 
 void thread_pool::work(sstring name) {
@@ -3535,33 +4198,58 @@ void thread_pool::work(sstring name) {
     sigfillset(&mask);
     auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
     throw_pthread_error(r);
-    std::array<syscall_work_queue::work_item*, syscall_work_queue::queue_length> tmp_buf;
-    while (true) {
-        uint64_t count;
-        auto r = ::read(inter_thread_wq._start_eventfd.get_read_fd(), &count, sizeof(count));
-        assert(r == sizeof(count));
-        if (_stopped.load(std::memory_order_relaxed)) {
-            break;
+    pollfd pfd = { inter_thread_wq._start_eventfd.get_read_fd(), POLLIN, 0 };
+    while (!_stopped.load(std::memory_order_relaxed)) {
+        _idle_workers.fetch_add(1, std::memory_order_seq_cst);
+        auto nr = ::poll(&pfd, 1, -1);
+        _idle_workers.fetch_sub(1, std::memory_order_relaxed);
+        assert(nr > 0 || errno == EINTR);
+        if (pfd.revents & POLLIN) {
+            uint64_t count;
+            // Several workers share the eventfd, so losing the race here is fine.
+            ::read(pfd.fd, &count, sizeof(count));
         }
-        auto end = tmp_buf.data();
-        inter_thread_wq._pending.consume_all([&] (syscall_work_queue::work_item* wi) {
-            *end++ = wi;
-        });
-        for (auto p = tmp_buf.data(); p != end; ++p) {
-            auto wi = *p;
-            wi->process();
-            inter_thread_wq._completed.push(wi);
-        }
-        if (_main_thread_idle.load(std::memory_order_seq_cst)) {
-            pthread_kill(_notify, SIGUSR1);
+        while (!_stopped.load(std::memory_order_relaxed)
+                && (run_one() || (_stealing.load(std::memory_order_relaxed) && steal_one()))) {
         }
     }
+    // Our siblings may have missed the wakeup if we consumed it, pass it on.
+    inter_thread_wq._start_eventfd.signal(1);
+}
+
+unsigned thread_pool::complete() {
+    std::array<syscall_work_queue::work_item*, syscall_work_queue::queue_length> tmp_buf;
+    auto end = tmp_buf.data();
+    auto nr = inter_thread_wq._completed.consume_all([&] (syscall_work_queue::work_item* wi) {
+        *end++ = wi;
+    });
+    for (auto p = tmp_buf.data(); p != end; ++p) {
+        auto wi = *p;
+        _queue_latency.add(std::chrono::duration_cast<std::chrono::microseconds>(wi->_queued).count());
+        _service_latency.add(std::chrono::duration_cast<std::chrono::microseconds>(wi->_service).count());
+        wi->complete();
+        delete wi;
+    }
+    _queue_length -= nr;
+    inter_thread_wq._queue_has_room.signal(nr);
+    return nr;
 }
 
 thread_pool::~thread_pool() {
+    {
+        auto& r = pools();
+        std::lock_guard<std::mutex> g(r.lock);
+        r.pools.erase(std::remove(r.pools.begin(), r.pools.end(), this), r.pools.end());
+    }
+    // Nobody can start stealing from us anymore, wait for those already doing so.
+    while (_stealers.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
     _stopped.store(true, std::memory_order_relaxed);
     inter_thread_wq._start_eventfd.signal(1);
-    _worker_thread.join();
+    for (auto& t : _worker_threads) {
+        t.join();
+    }
 }
 #endif
 
@@ -3598,6 +4286,8 @@ future<size_t> readable_eventfd::wait() {
     });
 }
 
+__thread internal::task_freelist internal::tl_task_freelist;
+
 void schedule(std::unique_ptr<task> t) {
     engine().add_task(std::move(t));
 }
@@ -3669,18 +4359,32 @@ reactor::get_options_description(std::chrono::duration<double> default_task_quot
         ("poll-mode", "poll continuously (100% cpu use)")
         ("idle-poll-time-us", bpo::value<unsigned>()->default_value(calculate_poll_time() / 1us),
                 "idle polling time in microseconds (reduce for overprovisioned environments or laptops)")
+        ("work-stealing", "let idle shards run the stealable tasks of busy ones (see submit_stealable())")
+        ("smp-poll-window-us", bpo::value<unsigned>()->default_value(20),
+                "maximum time in microseconds to keep polling for cross-shard messages after the last one, instead of sleeping")
         ("poll-aio", bpo::value<bool>()->default_value(true),
                 "busy-poll for disk I/O (reduces latency and increases throughput)")
+        ("reactor-backend", bpo::value<std::string>()->default_value(reactor_backend_selector::default_backend().name()),
+                "internal reactor implementation (valid values: epoll, io_uring)")
         ("task-quota-ms", bpo::value<double>()->default_value(default_task_quota / 1ms), "Max time (ms) between polls")
         ("max-task-backlog", bpo::value<unsigned>()->default_value(1000), "Maximum number of task backlog to allow; above this we ignore I/O")
         ("blocked-reactor-notify-ms", bpo::value<unsigned>()->default_value(2000), "threshold in miliseconds over which the reactor is considered blocked if no progress is made")
         ("blocked-reactor-reports-per-minute", bpo::value<unsigned>()->default_value(5), "Maximum number of backtraces reported by stall detector per minute")
         ("relaxed-dma", "allow using buffered I/O if DMA is not available (reduces performance)")
         ("unsafe-bypass-fsync", bpo::value<bool>()->default_value(false), "Bypass fsync(), may result in data loss. Use for testing on consumer drives")
+        ("syscall-threads", bpo::value<unsigned>()->default_value(1),
+                "number of threads per shard executing blocking system calls (open, stat, fsync, ...)")
+        ("syscall-work-stealing", "let idle syscall threads run the blocking system calls of shards whose syscall threads are all busy")
+        ("io-queue-balancing", bpo::value<bool>()->default_value(true),
+                "send disk requests to another IO queue, if any, with spare capacity when the shard's own one is backlogged")
+        ("cross-cpu-free-batch", bpo::value<unsigned>()->default_value(64),
+                "number of objects freed on behalf of another shard which are handed over to it at once (0: hand over each one)")
         ("overprovisioned", "run in an overprovisioned environment (such as docker or a laptop); equivalent to --idle-poll-time-us 0 --thread-affinity 0 --poll-aio 0")
         ("abort-on-seastar-bad-alloc", "abort when seastar allocator cannot allocate memory")
 #ifdef SEASTAR_HEAPPROF
         ("heapprof", "enable seastar heap profiling")
+        ("heapprof-sample-period", bpo::value<size_t>()->default_value(memory::default_heap_profiling_sample_period),
+                "mean number of bytes allocated between two allocations sampled by the heap profiler (0: record every allocation)")
 #endif
         ;
     opts.add(network_stack_registry::options_description());
@@ -3698,14 +4402,23 @@ smp::get_options_description()
         ("memory,m", bpo::value<std::string>(), "memory to use, in bytes (ex: 4G) (default: all)")
         ("reserve-memory", bpo::value<std::string>(), "memory reserved to OS (if --memory not specified)")
         ("hugepages", bpo::value<std::string>(), "path to accessible hugetlbfs mount (typically /dev/hugepages/something)")
+        ("thp", bpo::value<bool>()->default_value(true), "back memory with transparent huge pages when --hugepages is not given")
         ("lock-memory", bpo::value<bool>(), "lock all memory (prevents swapping)")
         ("thread-affinity", bpo::value<bool>()->default_value(true), "pin threads to their cpus (disable for overprovisioning)")
 #ifdef HAVE_HWLOC
         ("num-io-queues", bpo::value<unsigned>(), "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of IO queues")
+        ("io-queue-per-numa-node", bpo::value<bool>()->default_value(false), "Add an IO queue on every NUMA node that --num-io-queues leaves without one, so that no cpu submits IO across nodes. --max-io-requests is then split evenly among all the IO queues")
 #else
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of processors")
 #endif
+        ("io-direct-submit", bpo::value<bool>()->default_value(false), "Submit disk I/O from every shard, against the --max-io-requests capacity and --max-iops/--max-io-bandwidth limits shared by all, instead of through the IO queues' coordinator shards. Class limits are then split evenly among the shards")
+        ("max-io-bandwidth", bpo::value<uint64_t>(), "Maximum disk throughput in bytes per second, shared among the IO queues. Defaults to unlimited")
+        ("max-iops", bpo::value<uint64_t>(), "Maximum disk throughput in requests per second, shared among the IO queues. Defaults to unlimited")
+        ("io-read-iops", bpo::value<uint64_t>(), "Small random read IOPS of the disk, as measured by iotune. Used to weigh requests by the device time they take")
+        ("io-read-bandwidth", bpo::value<uint64_t>(), "Read bandwidth of the disk with large requests, in bytes per second, as measured by iotune")
+        ("io-write-iops", bpo::value<uint64_t>(), "Small random write IOPS of the disk, as measured by iotune")
+        ("io-write-bandwidth", bpo::value<uint64_t>(), "Write bandwidth of the disk with large requests, in bytes per second, as measured by iotune")
         ("mbind", bpo::value<bool>()->default_value(true), "enable mbind")
 #ifndef NO_EXCEPTION_HACK
         ("enable-glibc-exception-scaling-workaround", bpo::value<bool>()->default_value(true), "enable workaround for glibc/gcc c++ exception scalablity problem")
@@ -3734,6 +4447,8 @@ std::vector<std::function<void ()>> smp::_thread_loops;
 std::experimental::optional<boost::barrier> smp::_all_event_loops_done;
 std::vector<reactor*> smp::_reactors;
 std::unique_ptr<smp_message_queue*[], smp::qs_deleter> smp::_qs;
+std::vector<unsigned> smp::_shard_to_node;
+std::unique_ptr<fair_queue_shared_capacity> smp::_shared_io_capacity;
 std::thread::id smp::_tmain;
 unsigned smp::count = 1;
 bool smp::poll_mode = false;
@@ -3749,6 +4464,39 @@ void smp::start_all_queues()
     alien::smp::_qs[engine().cpu_id()].start();
 }
 
+// Called on the receiving shard, so that the queues are allocated from its
+// memory, on its NUMA node: senders only write work items pointers, while
+// the receiver polls the queues continuously.
+void smp::allocate_queues(unsigned receiver)
+{
+    _qs[receiver] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
+    for (unsigned j = 0; j < smp::count; ++j) {
+        new (&_qs[receiver][j]) smp_message_queue(_reactors[j], _reactors[receiver]);
+    }
+}
+
+uint64_t smp::remote_node_sent_messages() {
+    uint64_t sent = 0;
+    auto me = engine().cpu_id();
+    for (unsigned c = 0; c < count; c++) {
+        if (node_of(c) != node_of(me)) {
+            sent += _qs[c][me]._sent;
+        }
+    }
+    return sent;
+}
+
+uint64_t smp::remote_node_received_messages() {
+    uint64_t received = 0;
+    auto me = engine().cpu_id();
+    for (unsigned c = 0; c < count; c++) {
+        if (node_of(c) != node_of(me)) {
+            received += _qs[me][c]._received;
+        }
+    }
+    return received;
+}
+
 #ifdef HAVE_DPDK
 
 int dpdk_thread_adaptor(void* f)
@@ -3786,7 +4534,7 @@ void smp::arrive_at_event_loop_end() {
     }
 }
 
-void smp::allocate_reactor(unsigned id) {
+void smp::allocate_reactor(unsigned id, reactor_backend_selector rbs) {
     assert(!reactor_holder);
 
     // we cannot just write "local_engin = new reactor" since reactor's constructor
@@ -3795,7 +4543,7 @@ void smp::allocate_reactor(unsigned id) {
     int r = posix_memalign(&buf, cache_line_size, sizeof(reactor));
     assert(r == 0);
     local_engine = reinterpret_cast<reactor*>(buf);
-    new (buf) reactor(id);
+    new (buf) reactor(id, std::move(rbs));
     reactor_holder.reset(local_engine);
 }
 
@@ -3865,6 +4613,9 @@ static void siguser_action() noexcept {
 
 void smp::qs_deleter::operator()(smp_message_queue** qs) const {
     for (unsigned i = 0; i < smp::count; i++) {
+        if (!qs[i]) {
+            continue;
+        }
         for (unsigned j = 0; j < smp::count; j++) {
             qs[i][j].~smp_message_queue();
         }
@@ -3914,6 +4665,19 @@ void smp::configure(boost::program_options::variables_map configuration)
         mbind = false;
     }
 
+    auto backend_selector = reactor_backend_selector(configuration["reactor-backend"].as<std::string>());
+    auto backends = reactor_backend_selector::available();
+    if (std::none_of(backends.begin(), backends.end(), [&] (const reactor_backend_selector& rbs) {
+            return rbs.name() == backend_selector.name();
+    })) {
+        if (backend_selector.name() != "io_uring") {
+            throw std::runtime_error(sprint("unknown reactor backend %s", backend_selector.name()));
+        }
+        print("warning: io_uring is not supported on this system, using --reactor-backend %s\n",
+                reactor_backend_selector::default_backend().name());
+        backend_selector = reactor_backend_selector::default_backend();
+    }
+
     smp::count = 1;
     smp::_tmain = std::this_thread::get_id();
     auto nr_cpus = resource::nr_processing_units();
@@ -3928,6 +4692,9 @@ void smp::configure(boost::program_options::variables_map configuration)
     } else {
         nr_cpus = cpu_set.size();
     }
+    if (nr_cpus > shard_set::max_shards) {
+        throw std::runtime_error(sprint("at most %u shards are supported", unsigned(shard_set::max_shards)));
+    }
     smp::count = nr_cpus;
     _reactors.resize(nr_cpus);
     resource::configuration rc;
@@ -3961,6 +4728,7 @@ void smp::configure(boost::program_options::variables_map configuration)
     if (configuration.count("hugepages")) {
         hugepages_path = configuration["hugepages"].as<std::string>();
     }
+    auto thp = configuration["thp"].as<bool>();
     auto mlock = false;
     if (configuration.count("lock-memory")) {
         mlock = configuration["lock-memory"].as<bool>();
@@ -3982,19 +4750,27 @@ void smp::configure(boost::program_options::variables_map configuration)
     if (configuration.count("num-io-queues")) {
         rc.io_queues = configuration["num-io-queues"].as<unsigned>();
     }
+    if (configuration.count("io-queue-per-numa-node")) {
+        rc.io_queue_per_node = configuration["io-queue-per-numa-node"].as<bool>();
+    }
 
     auto resources = resource::allocate(rc);
     std::vector<resource::cpu> allocations = std::move(resources.cpus);
     if (thread_affinity) {
         smp::pin(allocations[0].cpu_id);
     }
-    memory::configure(allocations[0].mem, mbind, hugepages_path);
+    memory::configure(allocations[0].mem, mbind, hugepages_path, thp);
 
     if (configuration.count("abort-on-seastar-bad-alloc")) {
         memory::enable_abort_on_allocation_failure();
     }
 
     bool heapprof_enabled = configuration.count("heapprof");
+    size_t heapprof_sample_period = memory::default_heap_profiling_sample_period;
+    if (configuration.count("heapprof-sample-period")) {
+        heapprof_sample_period = configuration["heapprof-sample-period"].as<size_t>();
+    }
+    memory::set_heap_profiling_sample_period(heapprof_sample_period);
     memory::set_heap_profiling_enabled(heapprof_enabled);
 
 #ifdef HAVE_DPDK
@@ -4013,13 +4789,58 @@ void smp::configure(boost::program_options::variables_map configuration)
     static boost::barrier smp_queues_constructed(smp::count);
     static boost::barrier inited(smp::count);
 
+    _shard_to_node.clear();
+    for (auto&& a : allocations) {
+        _shard_to_node.push_back(a.nodeid);
+    }
+    // Each shard fills in the queues it receives from
+    smp::_qs = decltype(smp::_qs){new smp_message_queue* [smp::count](), qs_deleter{}};
+
     auto io_info = std::move(resources.io_queues);
 
+    // In direct-submit mode every shard has an IO queue of its own, and they
+    // all draw from the same in-flight capacity.
+    auto direct_io = configuration["io-direct-submit"].as<bool>();
     std::vector<io_queue*> all_io_queues;
-    all_io_queues.resize(io_info.coordinators.size());
+    all_io_queues.resize(direct_io ? smp::count : io_info.coordinators.size());
     io_queue::fill_shares_array();
 
-    auto alloc_io_queue = [io_info, &all_io_queues] (unsigned shard) {
+    fair_queue_limits device_limits;
+    if (configuration.count("max-iops")) {
+        device_limits.ops_per_second = configuration["max-iops"].as<uint64_t>();
+    }
+    if (configuration.count("max-io-bandwidth")) {
+        device_limits.bytes_per_second = configuration["max-io-bandwidth"].as<uint64_t>();
+    }
+    auto measured = [&configuration] (const char* name) -> uint64_t {
+        return configuration.count(name) ? configuration[name].as<uint64_t>() : 0;
+    };
+    io_cost_model cost_model(
+            io_cost_model::throughput{measured("io-read-iops"), measured("io-read-bandwidth")},
+            io_cost_model::throughput{measured("io-write-iops"), measured("io-write-bandwidth")});
+    // Throughput limits are split among the IO queues like their capacity,
+    // except for the device ones in direct-submit mode, which all queues share.
+    size_t total_io_capacity = 0;
+    for (auto& coordinator: io_info.coordinators) {
+        total_io_capacity += coordinator.capacity;
+    }
+
+    if (direct_io) {
+        _shared_io_capacity = std::make_unique<fair_queue_shared_capacity>(total_io_capacity, smp::count, [] (unsigned shard) {
+            _reactors[shard]->wakeup();
+        });
+        // Any single shard may then use the whole of the device limits.
+        _shared_io_capacity->set_limits(device_limits);
+    }
+
+    auto alloc_io_queue = [io_info, &all_io_queues, device_limits, cost_model, total_io_capacity, direct_io] (unsigned shard) {
+        if (direct_io) {
+            std::vector<shard_id> topology(smp::count);
+            std::iota(topology.begin(), topology.end(), 0);
+            all_io_queues[shard] = new io_queue(io_queue::config{shard, total_io_capacity, std::move(topology),
+                    fair_queue_limits{}, 1.0 / smp::count, cost_model, _shared_io_capacity.get()});
+            return int(shard);
+        }
         auto cid = io_info.shard_to_coordinator[shard];
         int vec_idx = 0;
         for (auto& coordinator: io_info.coordinators) {
@@ -4028,19 +4849,25 @@ void smp::configure(boost::program_options::variables_map configuration)
                 continue;
             }
             if (shard == cid) {
-                all_io_queues[vec_idx] = new io_queue(coordinator.id, coordinator.capacity, io_info.shard_to_coordinator);
+                all_io_queues[vec_idx] = new io_queue(io_queue::config{coordinator.id, coordinator.capacity,
+                        io_info.shard_to_coordinator, device_limits, double(coordinator.capacity) / total_io_capacity,
+                        cost_model});
             }
             return vec_idx;
         }
         assert(0); // Impossible
     };
 
-    auto assign_io_queue = [&all_io_queues] (shard_id id, int queue_idx) {
+    auto assign_io_queue = [&all_io_queues, direct_io] (shard_id id, int queue_idx) {
         if (all_io_queues[queue_idx]->coordinator() == id) {
             engine().my_io_queue.reset(all_io_queues[queue_idx]);
         }
         engine()._io_queue = all_io_queues[queue_idx];
         engine()._io_coordinator = all_io_queues[queue_idx]->coordinator();
+        // Requests never leave the shard in direct-submit mode.
+        if (!direct_io) {
+            engine()._all_io_queues = all_io_queues;
+        }
     };
 
     _all_event_loops_done.emplace(smp::count);
@@ -4048,13 +4875,14 @@ void smp::configure(boost::program_options::variables_map configuration)
     unsigned i;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, mbind] {
+        create_thread([configuration, hugepages_path, thp, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, heapprof_sample_period, mbind, backend_selector] {
             auto thread_name = seastar::format("reactor-{}", i);
             pthread_setname_np(pthread_self(), thread_name.c_str());
             if (thread_affinity) {
                 smp::pin(allocation.cpu_id);
             }
-            memory::configure(allocation.mem, mbind, hugepages_path);
+            memory::configure(allocation.mem, mbind, hugepages_path, thp);
+            memory::set_heap_profiling_sample_period(heapprof_sample_period);
             memory::set_heap_profiling_enabled(heapprof_enabled);
             sigset_t mask;
             sigfillset(&mask);
@@ -4063,10 +4891,11 @@ void smp::configure(boost::program_options::variables_map configuration)
             }*/
             auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
             throw_pthread_error(r);
-            allocate_reactor(i);
+            allocate_reactor(i, backend_selector);
             _reactors[i] = &engine();
             auto queue_idx = alloc_io_queue(i);
             reactors_registered.wait();
+            allocate_queues(i);
             smp_queues_constructed.wait();
             start_all_queues();
             assign_io_queue(i, queue_idx);
@@ -4076,7 +4905,7 @@ void smp::configure(boost::program_options::variables_map configuration)
         });
     }
 
-    allocate_reactor(0);
+    allocate_reactor(0, backend_selector);
     _reactors[0] = &engine();
     auto queue_idx = alloc_io_queue(0);
 
@@ -4090,15 +4919,10 @@ void smp::configure(boost::program_options::variables_map configuration)
 #endif
 
     reactors_registered.wait();
-    smp::_qs = decltype(smp::_qs){new smp_message_queue* [smp::count], qs_deleter{}};
-    for(unsigned i = 0; i < smp::count; i++) {
-        smp::_qs[i] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
-        for (unsigned j = 0; j < smp::count; ++j) {
-            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i]);
-        }
-    }
+    allocate_queues(0);
 
     alien::smp::_qs = alien::smp::create_qs(_reactors);
+    internal::configure_work_stealing(_reactors);
     smp_queues_constructed.wait();
     start_all_queues();
     assign_io_queue(0, queue_idx);
@@ -4109,35 +4933,76 @@ void smp::configure(boost::program_options::variables_map configuration)
     engine()._lowres_clock_impl = std::unique_ptr<lowres_clock_impl>(new lowres_clock_impl);
 }
 
+// Hands the batched requests and responses over to their shards, and
+// returns the number of shards some of them could not be handed to
+// because their queues are full.
+size_t smp::flush_queues() {
+    auto& r = engine();
+    auto me = r._id;
+    size_t unflushed = 0;
+    r._smp_polling.unflushed.for_each([&] (unsigned i) {
+        auto& rxq = _qs[me][i];
+        rxq.flush_response_batch();
+        auto& txq = _qs[i][me];
+        txq.flush_request_batch();
+        if (rxq.has_unflushed_responses() || txq.has_unflushed_requests()) {
+            ++unflushed;
+        } else {
+            r._smp_polling.unflushed.clear(i);
+        }
+    });
+    return unflushed;
+}
+
+void smp::deliver_wakeups() {
+    auto& polling = engine()._smp_polling;
+    polling.pending_wakeups.consume([&] (unsigned i) {
+        auto remote = _reactors[i];
+        // Another shard may have woken it up already
+        if (remote->_sleeping.load(std::memory_order_relaxed)) {
+            // We are free to clear it, because we're sending a signal now
+            remote->_sleeping.store(false, std::memory_order_relaxed);
+            remote->wakeup();
+            ++polling.wakeups;
+        } else {
+            ++polling.coalesced_wakeups;
+        }
+    });
+}
+
 bool smp::poll_queues() {
-    size_t got = 0;
-    for (unsigned i = 0; i < count; i++) {
-        if (engine().cpu_id() != i) {
-            auto& rxq = _qs[engine().cpu_id()][i];
-            rxq.flush_response_batch();
-            got += rxq.has_unflushed_responses();
-            got += rxq.process_incoming();
-            auto& txq = _qs[i][engine()._id];
-            txq.flush_request_batch();
-            got += txq.process_completions();
+    auto& r = engine();
+    auto& polling = r._smp_polling;
+    auto me = r._id;
+    polling.in_poll = true;
+    size_t got = flush_queues();
+    r._smp_doorbell.answer([&] (unsigned i) {
+        auto& rxq = _qs[me][i];
+        auto& txq = _qs[i][me];
+        auto nr = rxq.process_incoming() + txq.process_completions();
+        if (!nr) {
+            ++polling.wasted_polls;
         }
+        ++polling.doorbell_polls;
+        got += nr;
+    });
+    // Responses to the requests just processed are flushed on the next poll,
+    // so that they are batched with those of the tasks they ran.
+    polling.in_poll = false;
+    deliver_wakeups();
+    if (got) {
+        polling.last_message = reactor::sched_clock::now();
     }
     return got != 0;
 }
 
 bool smp::pure_poll_queues() {
-    for (unsigned i = 0; i < count; i++) {
-        if (engine().cpu_id() != i) {
-            auto& rxq = _qs[engine().cpu_id()][i];
-            rxq.flush_response_batch();
-            auto& txq = _qs[i][engine()._id];
-            txq.flush_request_batch();
-            if (rxq.pure_poll_rx() || txq.pure_poll_tx() || rxq.has_unflushed_responses()) {
-                return true;
-            }
-        }
-    }
-    return false;
+    auto& r = engine();
+    r._smp_polling.in_poll = true;
+    auto unflushed = flush_queues();
+    r._smp_polling.in_poll = false;
+    deliver_wakeups();
+    return unflushed || r._smp_doorbell.rung();
 }
 
 __thread bool g_need_preempt;
@@ -4168,6 +5033,336 @@ reactor_backend_epoll::make_reactor_notifier() {
     return std::make_unique<reactor_notifier_epoll>();
 }
 
+#ifdef HAVE_IO_URING
+
+class reactor_backend_uring::poll_completion final : public reactor_backend_uring::completion {
+    reactor_backend_uring& _backend;
+public:
+    // Reset to nullptr when the fd is forgotten while the poll is in flight;
+    // the completion still arrives (as -ECANCELED or a late event) and only
+    // frees this object.
+    pollable_fd_state* pfd;
+    int event;
+public:
+    poll_completion(reactor_backend_uring& backend, pollable_fd_state& pfd, int event)
+        : _backend(backend), pfd(&pfd), event(event) {}
+    virtual void complete(int res) noexcept override {
+        std::unique_ptr<poll_completion> self(this);
+        if (pfd) {
+            _backend.complete_poll(*pfd, event, res);
+        }
+    }
+};
+
+static inline
+unsigned uring_poll_slot(int event) {
+    return event == EPOLLIN ? 0 : 1;
+}
+
+static inline
+promise<> pollable_fd_state::* uring_poll_promise(int event) {
+    return event == EPOLLIN ? &pollable_fd_state::pollin : &pollable_fd_state::pollout;
+}
+
+reactor_backend_uring::reactor_backend_uring()
+        : reactor_backend_uring(::io_uring_params{}) {
+}
+
+reactor_backend_uring::reactor_backend_uring(::io_uring_params params)
+        : _ringfd(file_desc::io_uring_setup(queue_depth, params))
+        , _sq_area(_ringfd.map(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, IORING_OFF_SQ_RING))
+        , _cq_area(_ringfd.map(params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, IORING_OFF_CQ_RING))
+        , _sqe_area(_ringfd.map(params.sq_entries * sizeof(::io_uring_sqe),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, IORING_OFF_SQES)) {
+    auto sq = _sq_area.get();
+    _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sq_entries = params.sq_entries;
+    // sqes are consumed in order, so the indirection array is the identity
+    auto array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < _sq_entries; ++i) {
+        array[i] = i;
+    }
+    auto cq = _cq_area.get();
+    _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+    _sqes = reinterpret_cast<::io_uring_sqe*>(_sqe_area.get());
+}
+
+reactor_backend_uring::~reactor_backend_uring() {
+    for (auto&& p : _polls) {
+        for (auto c : p.second) {
+            delete c;
+        }
+    }
+}
+
+bool reactor_backend_uring::available() {
+    try {
+        ::io_uring_params params = {};
+        auto ring = file_desc::io_uring_setup(1, params);
+        // We rely on the kernel never dropping completions, and on
+        // waiting with a timeout without queueing one in the ring
+        auto required_features = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+        if ((params.features & required_features) != required_features) {
+            return false;
+        }
+        // and on supporting every operation we submit.
+        static constexpr unsigned max_ops = 256;
+        std::vector<char> buf(sizeof(::io_uring_probe) + max_ops * sizeof(::io_uring_probe_op));
+        auto probe = reinterpret_cast<::io_uring_probe*>(buf.data());
+        if (::syscall(__NR_io_uring_register, ring.get(), IORING_REGISTER_PROBE, probe, max_ops) == -1) {
+            return false;
+        }
+        static constexpr uint8_t required_ops[] = {
+            IORING_OP_NOP, IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_FSYNC,
+            IORING_OP_STATX, IORING_OP_FALLOCATE,
+        };
+        return std::all_of(std::begin(required_ops), std::end(required_ops), [probe] (uint8_t op) {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        });
+    } catch (std::system_error&) {
+        return false;
+    }
+}
+
+::io_uring_sqe* reactor_backend_uring::get_sqe(completion* c) {
+    while (*_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries) {
+        // The ring is full; hand what we have to the kernel. If it can't take
+        // it right now, the completion queue is backed up, so drain it.
+        if (!enter(0, nullptr)) {
+            reap_completions();
+        }
+    }
+    auto tail = *_sq_tail;
+    auto sqe = &_sqes[tail & _sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = reinterpret_cast<uintptr_t>(c);
+    // No SQPOLL thread, so the kernel only looks at the sqe during
+    // io_uring_enter(), after the caller has finished filling it in.
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++_sq_pending;
+    engine().start_epoll();
+    return sqe;
+}
+
+bool reactor_backend_uring::enter(unsigned min_complete, const sigset_t* active_sigmask, const ::__kernel_timespec* timeout) {
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    long r;
+    if (timeout) {
+        ::io_uring_getevents_arg arg = {};
+        arg.sigmask = reinterpret_cast<uintptr_t>(active_sigmask);
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uintptr_t>(timeout);
+        r = ::syscall(__NR_io_uring_enter, _ringfd.get(), _sq_pending, min_complete, flags | IORING_ENTER_EXT_ARG,
+                &arg, sizeof(arg));
+    } else {
+        r = ::syscall(__NR_io_uring_enter, _ringfd.get(), _sq_pending, min_complete, flags,
+                active_sigmask, _NSIG / 8);
+    }
+    if (r == -1) {
+        // EINTR: woken up by a signal (this is how other shards wake us);
+        // ETIME: the timeout expired;
+        // EAGAIN/EBUSY: out of resources or completions backed up, retry later.
+        if (errno == EINTR || errno == ETIME || errno == EAGAIN || errno == EBUSY) {
+            return false;
+        }
+        throw std::system_error(errno, std::system_category(), "io_uring_enter");
+    }
+    _sq_pending -= r;
+    return true;
+}
+
+unsigned reactor_backend_uring::reap_completions() {
+    auto head = *_cq_head;
+    auto tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    auto nr = tail - head;
+    while (head != tail) {
+        auto& cqe = _cqes[head++ & _cq_mask];
+        auto c = reinterpret_cast<completion*>(uintptr_t(cqe.user_data));
+        auto res = cqe.res;
+        __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+        if (c) {
+            c->complete(res);
+        }
+    }
+    return nr;
+}
+
+bool
+reactor_backend_uring::wait_and_process(int timeout, const sigset_t* active_sigmask) {
+    auto have_completions = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) != *_cq_head;
+    if (timeout != 0 && !have_completions) {
+        // The timeout is passed to io_uring_enter() itself rather than queued
+        // as an IORING_OP_TIMEOUT, which would outlive a wait that ended early.
+        ::__kernel_timespec ts;
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        enter(1, active_sigmask, timeout > 0 ? &ts : nullptr);
+    } else if (_sq_pending) {
+        enter(0, nullptr);
+    }
+    return reap_completions();
+}
+
+future<> reactor_backend_uring::get_poll_future(pollable_fd_state& pfd,
+        promise<> pollable_fd_state::*pr, int event) {
+    if (pfd.events_known & event) {
+        pfd.events_known &= ~event;
+        return make_ready_future();
+    }
+    pfd.events_requested |= event;
+    if (!(pfd.events_epoll & event)) {
+        auto c = std::make_unique<poll_completion>(*this, pfd, event);
+        auto sqe = get_sqe(c.get());
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = pfd.fd.get();
+        sqe->poll_events = event;
+        _polls[&pfd][uring_poll_slot(event)] = c.release();
+        pfd.events_epoll |= event;
+    }
+    pfd.*pr = promise<>();
+    return (pfd.*pr).get_future();
+}
+
+void reactor_backend_uring::complete_poll(pollable_fd_state& pfd, int event, int res) {
+    auto i = _polls.find(&pfd);
+    i->second[uring_poll_slot(event)] = nullptr;
+    if (!i->second[0] && !i->second[1]) {
+        _polls.erase(i);
+    }
+    pfd.events_epoll &= ~event;
+    // Polls are one-shot. Any completion, including an error such as a bad
+    // fd, wakes the waiter, which then learns the outcome from the actual
+    // I/O operation just like it would with epoll reporting EPOLLERR.
+    if (pfd.events_requested & event) {
+        auto pr = uring_poll_promise(event);
+        pfd.events_requested &= ~event;
+        pfd.events_known &= ~event;
+        (pfd.*pr).set_value();
+        pfd.*pr = promise<>();
+    }
+}
+
+void reactor_backend_uring::cancel_poll(pollable_fd_state& pfd, int event) {
+    // Grab the sqe first: waiting for ring space may reap the very poll
+    // we're about to cancel.
+    auto sqe = get_sqe(nullptr);
+    pfd.events_epoll &= ~event;
+    auto i = _polls.find(&pfd);
+    auto c = i != _polls.end() ? i->second[uring_poll_slot(event)] : nullptr;
+    if (!c) {
+        sqe->opcode = IORING_OP_NOP;
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = reinterpret_cast<uintptr_t>(c);
+    c->pfd = nullptr;
+    i->second[uring_poll_slot(event)] = nullptr;
+    if (!i->second[0] && !i->second[1]) {
+        _polls.erase(i);
+    }
+}
+
+void reactor_backend_uring::abort_fd(pollable_fd_state& pfd, std::exception_ptr ex,
+                                     promise<> pollable_fd_state::* pr, int event) {
+    if (pfd.events_epoll & event) {
+        cancel_poll(pfd, event);
+    }
+    if (pfd.events_requested & event) {
+        pfd.events_requested &= ~event;
+        (pfd.*pr).set_exception(std::move(ex));
+    }
+    pfd.events_known &= ~event;
+}
+
+future<> reactor_backend_uring::readable(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollin, EPOLLIN);
+}
+
+future<> reactor_backend_uring::writeable(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollin, EPOLLIN);
+}
+
+void reactor_backend_uring::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::forget(pollable_fd_state& fd) {
+    if (fd.events_epoll & EPOLLIN) {
+        cancel_poll(fd, EPOLLIN);
+    }
+    if (fd.events_epoll & EPOLLOUT) {
+        cancel_poll(fd, EPOLLOUT);
+    }
+}
+
+bool reactor_backend_uring::forget_fd(int fd) {
+    // Nothing is registered per fd; in-flight polls go away with their
+    // pollable_fd_state.
+    return true;
+}
+
+future<> reactor_backend_uring::notified(reactor_notifier *n) {
+    std::cout << "reactor_backend_uring does not yet support notifiers!\n";
+    abort();
+}
+
+int
+reactor_backend_uring::get_fd() {
+    return _ringfd.get();
+}
+
+std::unique_ptr<reactor_notifier>
+reactor_backend_uring::make_reactor_notifier() {
+    return std::make_unique<reactor_notifier_epoll>();
+}
+
+#endif
+
+std::unique_ptr<reactor_backend>
+reactor_backend_selector::create() const {
+#ifdef HAVE_OSV
+    return std::make_unique<reactor_backend_osv>();
+#else
+#ifdef HAVE_IO_URING
+    // No per-shard fallback: file I/O may be submitted on another shard's
+    // ring, so all shards must agree on the backend. smp::configure() has
+    // already checked that io_uring is available.
+    if (_name == "io_uring") {
+        return std::make_unique<reactor_backend_uring>();
+    }
+#endif
+    return std::make_unique<reactor_backend_epoll>();
+#endif
+}
+
+reactor_backend_selector
+reactor_backend_selector::default_backend() {
+    return reactor_backend_selector("epoll");
+}
+
+std::vector<reactor_backend_selector>
+reactor_backend_selector::available() {
+    std::vector<reactor_backend_selector> ret;
+    ret.push_back(default_backend());
+#ifdef HAVE_IO_URING
+    if (reactor_backend_uring::available()) {
+        ret.push_back(reactor_backend_selector("io_uring"));
+    }
+#endif
+    return ret;
+}
+
 #ifdef HAVE_OSV
 class reactor_notifier_osv :
         public reactor_notifier, private osv::newpoll::pollable {
@@ -4278,6 +5473,24 @@ reactor_backend_osv::forget(pollable_fd_state& fd) {
     abort();
 }
 
+void
+reactor_backend_osv::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_reader() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_writer() shouldn't have been called!\n";
+    abort();
+}
+
+bool
+reactor_backend_osv::forget_fd(int fd) {
+    std::cout << "reactor_backend_osv does not support file descriptors - forget_fd() shouldn't have been called!\n";
+    abort();
+}
+
 void
 reactor_backend_osv::enable_timer(steady_clock_type::time_point when) {
     _poller.set_timer(when);
@@ -4546,6 +5759,13 @@ scheduling_group::set_shares(float shares) {
     engine()._task_queues[_id]->set_shares(shares);
 }
 
+static_assert(max_scheduling_groups() <= memory::max_allocation_contexts, "every scheduling group needs an allocation context");
+
+int64_t
+scheduling_group::allocated_memory() const {
+    return memory::get_allocation_context_stats(_id).live_bytes();
+}
+
 future<scheduling_group>
 create_scheduling_group(sstring name, float shares) {
     static std::atomic<unsigned> last{2}; // 0=main, 1=atexit
@@ -51,6 +51,7 @@
 #include <atomic>
 #include <experimental/optional>
 #include <boost/lockfree/spsc_queue.hpp>
+#include <boost/lockfree/queue.hpp>
 #include <boost/optional.hpp>
 #include <boost/program_options.hpp>
 #include <boost/thread/barrier.hpp>
@@ -78,6 +79,8 @@
 #include "lowres_clock.hh"
 #include "manual_clock.hh"
 #include "core/metrics_registration.hh"
+#include "core/metrics_types.hh"
+#include "bitops.hh"
 #include "scheduling.hh"
 #include "posix.hh"
 
@@ -98,6 +101,10 @@ namespace alien {
 class message_queue;
 }
 
+namespace internal {
+class work_stealing;
+}
+
 class reactor;
 class pollable_fd;
 class pollable_fd_state;
@@ -152,6 +159,9 @@ class pollable_fd {
     future<> write_all(const uint8_t* buffer, size_t size);
     future<size_t> write_some(net::packet& p);
     future<> write_all(net::packet& p);
+    /// Sends up to \c len bytes of the file \c in_fd from \c offset,
+    /// without copying them through userspace.
+    future<size_t> sendfile(int in_fd, uint64_t offset, size_t len);
     future<> readable();
     future<> writeable();
     void abort_reader(std::exception_ptr ex);
@@ -249,13 +259,20 @@ class smp;
 class syscall_work_queue {
     static constexpr size_t queue_length = 128;
     struct work_item;
-    using lf_queue = boost::lockfree::spsc_queue<work_item*,
+    // Both queues are multi-producer/multi-consumer: requests are picked up by
+    // any of the pool's worker threads, or stolen by an idle worker of another
+    // shard's pool, and completed by whichever thread ran them.
+    using lf_queue = boost::lockfree::queue<work_item*,
                             boost::lockfree::capacity<queue_length>>;
     lf_queue _pending;
     lf_queue _completed;
     writeable_eventfd _start_eventfd;
     semaphore _queue_has_room = { queue_length };
     struct work_item {
+        using clock_type = std::chrono::steady_clock;
+        clock_type::time_point _submitted;
+        clock_type::duration _queued;  // from submission until a worker picked it up
+        clock_type::duration _service; // time spent running on the worker
         virtual ~work_item() {}
         virtual void process() = 0;
         virtual void complete() = 0;
@@ -280,19 +297,87 @@ class syscall_work_queue {
         return fut;
     }
 private:
-    void work();
-    // Scans the _completed queue, that contains the requests already handled by the syscall thread,
-    // effectively opening up space for more requests to be submitted. One consequence of this is
-    // that from the reactor's point of view, a request is not considered handled until it is
-    // removed from the _completed queue.
-    //
-    // Returns the number of requests handled.
-    unsigned complete();
     void submit_item(std::unique_ptr<syscall_work_queue::work_item> wi);
 
     friend class thread_pool;
 };
 
+// A set of shards, as a bitmap small enough to scan in one cache line.
+class shard_set {
+public:
+    static constexpr unsigned max_shards = 256;
+private:
+    static constexpr unsigned bits_per_word = 64;
+    uint64_t _words[max_shards / bits_per_word] = {};
+public:
+    void set(unsigned shard) {
+        _words[shard / bits_per_word] |= uint64_t(1) << (shard % bits_per_word);
+    }
+    void clear(unsigned shard) {
+        _words[shard / bits_per_word] &= ~(uint64_t(1) << (shard % bits_per_word));
+    }
+    bool test(unsigned shard) const {
+        return _words[shard / bits_per_word] & (uint64_t(1) << (shard % bits_per_word));
+    }
+    bool empty() const {
+        return std::all_of(std::begin(_words), std::end(_words), [] (uint64_t w) { return !w; });
+    }
+    // Calls func on each shard of a snapshot of the set, so func may modify it.
+    template <typename Func>
+    void for_each(Func func) const {
+        for (unsigned i = 0; i < max_shards / bits_per_word; ++i) {
+            for (auto w = _words[i]; w; w &= w - 1) {
+                func(i * bits_per_word + __builtin_ctzll(w));
+            }
+        }
+    }
+    // Like for_each(), and empties the set.
+    template <typename Func>
+    void consume(Func func) {
+        for (unsigned i = 0; i < max_shards / bits_per_word; ++i) {
+            for (auto w = std::exchange(_words[i], 0); w; w &= w - 1) {
+                func(i * bits_per_word + __builtin_ctzll(w));
+            }
+        }
+    }
+};
+
+// Rung by shards after they hand messages over to this one, so that it
+// only polls the queues of the shards that rang instead of all of them.
+//
+// A shard rings after every batch it pushes, and this shard clears the
+// bits before it pops, so no batch can be left behind without its bit set.
+class alignas(seastar::cache_line_size) smp_doorbell {
+    static constexpr unsigned bits_per_word = 64;
+    std::atomic<uint64_t> _words[shard_set::max_shards / bits_per_word];
+public:
+    smp_doorbell() {
+        for (auto& w : _words) {
+            w.store(0, std::memory_order_relaxed);
+        }
+    }
+    void ring(unsigned shard) {
+        _words[shard / bits_per_word].fetch_or(uint64_t(1) << (shard % bits_per_word), std::memory_order_release);
+    }
+    bool rung() const {
+        return std::any_of(std::begin(_words), std::end(_words), [] (const std::atomic<uint64_t>& w) {
+            return w.load(std::memory_order_relaxed);
+        });
+    }
+    // Calls func on each shard which rang since the last call
+    template <typename Func>
+    void answer(Func func) {
+        for (unsigned i = 0; i < shard_set::max_shards / bits_per_word; ++i) {
+            if (!_words[i].load(std::memory_order_relaxed)) {
+                continue;
+            }
+            for (auto w = _words[i].exchange(0, std::memory_order_acquire); w; w &= w - 1) {
+                func(i * bits_per_word + __builtin_ctzll(w));
+            }
+        }
+    }
+};
+
 class smp_message_queue {
     static constexpr size_t queue_length = 128;
     static constexpr size_t batch_size = 16;
@@ -306,6 +391,7 @@ class smp_message_queue {
     // use inheritence to control placement order
     struct lf_queue : lf_queue_remote, lf_queue_base {
         lf_queue(reactor* remote) : lf_queue_remote{remote} {}
+        // Rings the remote's doorbell, and wakes it up if it sleeps
         void maybe_wakeup();
     };
     lf_queue _pending;
@@ -327,10 +413,39 @@ class smp_message_queue {
         size_t _last_rcv_batch = 0;
     };
     struct work_item {
+        unsigned _size_class; // in work_item_cache
         virtual ~work_item() {}
         virtual future<> process() = 0;
         virtual void complete() = 0;
     };
+    // Work items are allocated and freed by the sending shard only, and
+    // recycled through this cache, so that once a queue has seen its peak
+    // number of calls in flight, calls no longer go through the allocator.
+    class work_item_cache {
+        static constexpr size_t min_item_size = 64;
+        static constexpr unsigned nr_size_classes = 4;
+        static constexpr unsigned max_cached = 2 * queue_length; // per size class
+        struct free_item {
+            free_item* next;
+        };
+        std::array<free_item*, nr_size_classes> _free = {};
+        std::array<unsigned, nr_size_classes> _nr_free = {};
+    public:
+        // Items larger than the largest size class are not cached
+        static constexpr unsigned uncached = nr_size_classes;
+        static constexpr unsigned size_class(size_t size) {
+            return size <= min_item_size ? 0
+                    : size <= min_item_size * 2 ? 1
+                    : size <= min_item_size * 4 ? 2
+                    : size <= min_item_size * 8 ? 3
+                    : uncached;
+        }
+        work_item_cache() = default;
+        work_item_cache(const work_item_cache&) = delete;
+        ~work_item_cache();
+        void* allocate(unsigned size_class, size_t size);
+        void free(void* item, unsigned size_class);
+    };
     template <typename Func>
     struct async_work_item : work_item {
         Func _func;
@@ -370,7 +485,8 @@ class smp_message_queue {
         ~tx_side() {}
         void init() { new (&a) aa; }
         struct aa {
-            std::deque<work_item*> pending_fifo;
+            circular_buffer<work_item*> pending_fifo;
+            work_item_cache items;
         } a;
     } _tx;
     std::vector<work_item*> _completed_fifo;
@@ -379,9 +495,19 @@ class smp_message_queue {
     ~smp_message_queue();
     template <typename Func>
     futurize_t<std::result_of_t<Func()>> submit(Func&& func) {
-        auto wi = std::make_unique<async_work_item<Func>>(std::forward<Func>(func));
+        using item_type = async_work_item<Func>;
+        constexpr auto size_class = work_item_cache::size_class(sizeof(item_type));
+        auto mem = _tx.a.items.allocate(size_class, sizeof(item_type));
+        item_type* wi;
+        try {
+            wi = new (mem) item_type(std::forward<Func>(func));
+        } catch (...) {
+            _tx.a.items.free(mem, size_class);
+            throw;
+        }
+        wi->_size_class = size_class;
         auto fut = wi->get_future();
-        submit_item(std::move(wi));
+        submit_item(wi);
         return fut;
     }
     void start(unsigned cpuid);
@@ -392,38 +518,132 @@ class smp_message_queue {
     void stop();
 private:
     void work();
-    void submit_item(std::unique_ptr<work_item> wi);
+    void submit_item(work_item* wi);
+    void free_item(work_item* wi);
     void respond(work_item* wi);
     void move_pending();
     void flush_request_batch();
     void flush_response_batch();
     bool has_unflushed_responses() const;
-    bool pure_poll_rx() const;
-    bool pure_poll_tx() const;
+    bool has_unflushed_requests() const;
 
     friend class smp;
 };
 
+// A histogram with power-of-two bucket bounds (1, 2, 4, ...), cheap enough to
+// be updated for every request and exported as a metrics::histogram.
+class log2_histogram {
+    static constexpr unsigned nr_buckets = 22; // the last bucket is +Inf
+    std::array<uint64_t, nr_buckets> _buckets = {};
+    uint64_t _count = 0;
+    uint64_t _sum = 0;
+public:
+    void add(uint64_t v) {
+        ++_buckets[std::min<unsigned>(log2ceil(std::max<uint64_t>(v, 1)), nr_buckets - 1)];
+        ++_count;
+        _sum += v;
+    }
+    metrics::histogram get() const;
+};
+
+// Decides when the iocbs accumulated by the reactor are worth an io_submit().
+//
+// Submitting each request on its own costs a system call per request, while
+// holding requests back to build larger batches delays them. The controller
+// lets a batch grow as long as the expected time to fill it, derived from the
+// recent submission rate, stays a small fraction of the observed device
+// latency. Batches are not built while requests wait in the IO queue, and
+// whatever remains is flushed by the aio poller.
+class aio_batch_controller {
+public:
+    using clock_type = std::chrono::steady_clock;
+private:
+    // Extra delay we accept to build a batch, relative to device latency.
+    static constexpr double max_delay_fraction = 0.1;
+    static constexpr double ewma_weight = 0.1;
+    // Longer gaps between flushes all mean the disk was idle.
+    static constexpr std::chrono::microseconds max_flush_interval{10000};
+    double _latency_us = 0;
+    double _rate = 0; // requests per microsecond
+    size_t _target = 1;
+    size_t _submitted_since_flush = 0;
+    clock_type::time_point _last_flush;
+    uint64_t _flushes = 0;
+    log2_histogram _batch_sizes;
+    log2_histogram _latencies;
+public:
+    void submitted() { ++_submitted_since_flush; }
+    // Whether \c pending iocbs should be submitted right away; \c max_batch
+    // bounds the batch so that the device is never left idle waiting for it.
+    bool should_flush(size_t pending, size_t max_batch) const {
+        return pending >= std::min(_target, max_batch);
+    }
+    void flushed(clock_type::time_point now, size_t batch);
+    void completed(clock_type::duration latency);
+    size_t target() const { return _target; }
+    uint64_t flushes() const { return _flushes; }
+    metrics::histogram batch_sizes() const { return _batch_sizes.get(); }
+    metrics::histogram latencies() const { return _latencies.get(); }
+};
+
 class thread_pool {
     uint64_t _aio_threaded_fallbacks = 0;
 #ifndef HAVE_OSV
     // FIXME: implement using reactor_notifier abstraction we used for SMP
     syscall_work_queue inter_thread_wq;
-    posix_thread _worker_thread;
+    sstring _name;
+    std::vector<posix_thread> _worker_threads;
     std::atomic<bool> _stopped = { false };
     std::atomic<bool> _main_thread_idle = { false };
+    // Whether idle workers of other pools steal from us, and ours from them
+    std::atomic<bool> _stealing = { false };
+    // Number of our workers blocked waiting for requests; when it drops to
+    // zero, submitters ask an idle worker of another pool to steal from us.
+    std::atomic<unsigned> _idle_workers = { 0 };
+    // Number of workers of other pools currently running one of our requests.
+    std::atomic<unsigned> _stealers = { 0 };
+    std::atomic<uint64_t> _stolen = { 0 };
     pthread_t _notify;
+    // Reactor-side accounting, updated on submit and completion.
+    uint64_t _queue_length = 0;
+    log2_histogram _queue_latency;
+    log2_histogram _service_latency;
 public:
     explicit thread_pool(sstring thread_name);
     ~thread_pool();
+    // Grows the pool to \c nr_workers threads. The pool starts with a single one.
+    void set_workers(unsigned nr_workers);
+    // Lets this pool and the other pools which enabled stealing run each
+    // other's requests when all workers of one of them are busy. Requests
+    // may then run on another shard's CPU.
+    void enable_work_stealing();
     template <typename T, typename Func>
     future<T> submit(Func func) {
         ++_aio_threaded_fallbacks;
-        return inter_thread_wq.submit<T>(std::move(func));
+        ++_queue_length;
+        auto fut = inter_thread_wq.submit<T>(std::move(func));
+        if (_stealing.load(std::memory_order_relaxed) && !_idle_workers.load(std::memory_order_relaxed)) {
+            request_stealers();
+        }
+        return fut;
     }
     uint64_t operation_count() const { return _aio_threaded_fallbacks; }
-
-    unsigned complete() { return inter_thread_wq.complete(); }
+    // Requests submitted but not yet completed, including those waiting for
+    // room in the submission queue.
+    uint64_t queue_length() const { return _queue_length; }
+    // Requests of this shard that were run by another shard's worker.
+    uint64_t stolen_count() const { return _stolen.load(std::memory_order_relaxed); }
+    unsigned workers() const { return _worker_threads.size(); }
+    metrics::histogram queue_latency() const { return _queue_latency.get(); }
+    metrics::histogram service_latency() const { return _service_latency.get(); }
+
+    // Scans the _completed queue, that contains the requests already handled by the syscall threads,
+    // effectively opening up space for more requests to be submitted. One consequence of this is
+    // that from the reactor's point of view, a request is not considered handled until it is
+    // removed from the _completed queue.
+    //
+    // Returns the number of requests handled.
+    unsigned complete();
     // Before we enter interrupt mode, we must make sure that the syscall thread will properly
     // generate signals to wake us up. This means we need to make sure that all modifications to
     // the pending and completed fields in the inter_thread_wq are visible to all threads.
@@ -443,11 +663,23 @@ class thread_pool {
 #endif
 private:
     void work(sstring thread_name);
+#ifndef HAVE_OSV
+    // Wakes an idle worker of another pool so it can steal from our queue.
+    void request_stealers();
+    // Runs one request from our own queue, returns false if it was empty.
+    bool run_one();
+    // Runs one request of another pool that is short of workers.
+    bool steal_one();
+    void run(syscall_work_queue::work_item* wi);
+    struct registry;
+    static registry& pools();
+#endif
 };
 
 // The "reactor_backend" interface provides a method of waiting for various
 // basic events on one thread. We have one implementation based on epoll and
-// file-descriptors (reactor_backend_epoll) and one implementation based on
+// file-descriptors (reactor_backend_epoll), one based on io_uring
+// (reactor_backend_uring) and one implementation based on
 // OSv-specific file-descriptor-less mechanisms (reactor_backend_osv).
 class reactor_backend {
 public:
@@ -464,6 +696,11 @@ class reactor_backend {
     virtual future<> readable(pollable_fd_state& fd) = 0;
     virtual future<> writeable(pollable_fd_state& fd) = 0;
     virtual void forget(pollable_fd_state& fd) = 0;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    // Stops watching a file descriptor that is about to be closed behind
+    // the back of its pollable_fd_state. Returns false on failure.
+    virtual bool forget_fd(int fd) = 0;
     // Methods that allow polling on a reactor_notifier. This is currently
     // used only for reactor_backend_osv, but in the future it should really
     // replace the above functions.
@@ -497,9 +734,103 @@ class reactor_backend_epoll : public reactor_backend {
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
-    void abort_reader(pollable_fd_state& fd, std::exception_ptr ex);
-    void abort_writer(pollable_fd_state& fd, std::exception_ptr ex);
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual bool forget_fd(int fd) override;
+    int get_fd() override;
+};
+
+#ifdef HAVE_IO_URING
+// reactor backend using one io_uring per shard. File descriptor readiness
+// is requested with one-shot IORING_OP_POLL_ADD submissions; other users of
+// the ring (e.g. disk I/O) queue their own submissions with get_sqe().
+// Everything queued is pushed to the kernel, and completions are reaped,
+// by a single io_uring_enter() per wait_and_process(). Completions that are
+// already in the ring are reaped without entering the kernel at all.
+class reactor_backend_uring : public reactor_backend {
+public:
+    // Completion callback for a submission queued on the ring. It is stored
+    // in the sqe's user_data and invoked with the cqe's res field.
+    class completion {
+    public:
+        virtual ~completion() {}
+        virtual void complete(int res) noexcept = 0;
+    };
+private:
+    class poll_completion;
+    static constexpr unsigned queue_depth = 256;
+    file_desc _ringfd;
+    mmap_area _sq_area;
+    mmap_area _cq_area;
+    mmap_area _sqe_area;
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned _cq_mask;
+    ::io_uring_sqe* _sqes;
+    ::io_uring_cqe* _cqes;
+    // sqes filled in but not yet handed to the kernel
+    unsigned _sq_pending = 0;
+    // in-flight fd polls, indexed by pollable_fd_state; [0] is POLLIN, [1] is POLLOUT
+    std::unordered_map<pollable_fd_state*, std::array<poll_completion*, 2>> _polls;
+private:
+    future<> get_poll_future(pollable_fd_state& fd,
+            promise<> pollable_fd_state::* pr, int event);
+    void complete_poll(pollable_fd_state& fd, int event, int res);
+    void cancel_poll(pollable_fd_state& fd, int event);
+    void abort_fd(pollable_fd_state& fd, std::exception_ptr ex,
+            promise<> pollable_fd_state::* pr, int event);
+    bool enter(unsigned min_complete, const sigset_t* active_sigmask, const ::__kernel_timespec* timeout = nullptr);
+    unsigned reap_completions();
+    explicit reactor_backend_uring(::io_uring_params params);
+public:
+    reactor_backend_uring();
+    virtual ~reactor_backend_uring() override;
+    virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
+    virtual future<> readable(pollable_fd_state& fd) override;
+    virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual void forget(pollable_fd_state& fd) override;
+    virtual future<> notified(reactor_notifier *n) override;
+    virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual bool forget_fd(int fd) override;
     int get_fd() override;
+    // Returns a zeroed submission entry whose completion will be delivered
+    // to c (which may be null if the result is not interesting). The entry
+    // is handed to the kernel on the next wait_and_process().
+    ::io_uring_sqe* get_sqe(completion* c);
+    // Whether io_uring is usable on this kernel
+    static bool available();
+};
+
+// Carries a function that fills in an io_uring_sqe through io_queue to the
+// coordinator shard, like the iocb-preparing functions used for linux-aio.
+template <typename Func>
+struct uring_request {
+    Func prepare;
+};
+
+template <typename Func>
+inline
+uring_request<Func> make_uring_request(Func prepare) {
+    return uring_request<Func>{std::move(prepare)};
+}
+#endif
+
+// Chooses, by name, which reactor_backend implementation each reactor uses.
+// Selected once at startup with --reactor-backend.
+class reactor_backend_selector {
+    std::string _name;
+public:
+    explicit reactor_backend_selector(std::string name) : _name(std::move(name)) {}
+    const std::string& name() const { return _name; }
+    std::unique_ptr<reactor_backend> create() const;
+    static reactor_backend_selector default_backend();
+    static std::vector<reactor_backend_selector> available();
 };
 
 #ifdef HAVE_OSV
@@ -520,6 +851,9 @@ class reactor_backend_osv : public reactor_backend {
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
     virtual void forget(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual bool forget_fd(int fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
     void enable_timer(steady_clock_type::time_point when);
@@ -541,11 +875,54 @@ inline open_flags operator|(open_flags a, open_flags b) {
     return open_flags(static_cast<unsigned int>(a) | static_cast<unsigned int>(b));
 }
 
+// Weighs disk requests by the device time they take, from the IOPS of small
+// requests and the bandwidth of large ones iotune measured for reads and for
+// writes. Weights are relative to a read carrying no data, so a device whose
+// throughput is not known keeps the historical weight of 1 + len/16KB for
+// both directions.
+class io_cost_model {
+public:
+    enum class direction { read, write };
+    struct throughput {
+        uint64_t iops = 0;
+        uint64_t bandwidth = 0;
+    };
+private:
+    fair_queue_cost _read;
+    fair_queue_cost _write;
+public:
+    io_cost_model();
+    io_cost_model(throughput read, throughput write);
+    const fair_queue_cost& cost(direction dir) const {
+        return dir == direction::read ? _read : _write;
+    }
+};
+
 class io_queue {
+public:
+    struct config {
+        shard_id coordinator;
+        size_t capacity;
+        std::vector<shard_id> topology;
+        // The node-wide throughput model of the disk, of which this queue
+        // enforces \c limits_fraction, as it does for class limits.
+        fair_queue_limits device_limits = {};
+        double limits_fraction = 1;
+        io_cost_model cost_model = {};
+        // When set, the in-flight limit of the disk, which queues on all
+        // shards take from directly instead of funnelling through coordinators.
+        // It then enforces the throughput limits of the disk by itself, and
+        // \c device_limits are left empty.
+        fair_queue_shared_capacity* shared_capacity = nullptr;
+    };
 private:
     shard_id _coordinator;
     size_t _capacity;
     std::vector<shard_id> _io_topology;
+    // The share of the node-wide throughput limits enforced by this queue.
+    double _limits_fraction;
+    io_cost_model _cost_model;
+    bool _shares_capacity;
 
     struct priority_class_data {
         priority_class_ptr ptr;
@@ -559,24 +936,33 @@ class io_queue {
 
     std::unordered_map<unsigned, lw_shared_ptr<priority_class_data>> _priority_classes;
     fair_queue _fq;
+    // Requests held by this queue, waiting or executing, as last published by
+    // the coordinator for the shards deciding where to send their requests.
+    std::atomic<unsigned> _load = { 0 };
 
     static constexpr unsigned _max_classes = 1024;
     static std::array<std::atomic<uint32_t>, _max_classes> _registered_shares;
     static std::array<sstring, _max_classes> _registered_names;
+    // Node-wide limits of each class, zero meaning unlimited.
+    static std::array<std::atomic<uint64_t>, _max_classes> _registered_ops_limits;
+    static std::array<std::atomic<uint64_t>, _max_classes> _registered_bytes_limits;
 
     static io_priority_class register_one_priority_class(sstring name, uint32_t shares);
+    static void set_class_limits(const io_priority_class& pc, fair_queue_limits limits);
+    void update_class_limits(const io_priority_class& pc);
+    fair_queue_limits local_limits(fair_queue_limits limits) const;
 
     priority_class_data& find_or_create_class(const io_priority_class& pc, shard_id owner);
     static void fill_shares_array();
     friend smp;
 public:
 
-    io_queue(shard_id coordinator, size_t capacity, std::vector<shard_id> topology);
+    explicit io_queue(config cfg);
     ~io_queue();
 
     template <typename Func>
     static future<io_event>
-    queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, Func do_io);
+    queue_request(shard_id coordinator, const io_priority_class& pc, io_cost_model::direction dir, size_t len, Func do_io);
 
     size_t capacity() const {
         return _capacity;
@@ -586,6 +972,45 @@ class io_queue {
         return _fq.waiters();
     }
 
+    // Refreshes what load() returns. Called on the coordinator.
+    void publish_load() {
+        unsigned load = _fq.waiters() + _fq.requests_executing();
+        if (_load.load(std::memory_order_relaxed) != load) {
+            _load.store(load, std::memory_order_relaxed);
+        }
+    }
+    unsigned load() const {
+        return _load.load(std::memory_order_relaxed);
+    }
+    // Whether requests wait in this queue for want of capacity.
+    bool backlogged() const {
+        return load() > _capacity;
+    }
+    bool has_spare_capacity() const {
+        return load() < _capacity;
+    }
+
+    bool shares_capacity() const {
+        return _shares_capacity;
+    }
+    // With shared capacity, requests wait for other shards to return some,
+    // and have to be polled for. Returns whether any was dispatched.
+    bool dispatch_waiting() {
+        return _fq.dispatch_waiting();
+    }
+    // Whether requests wait here, and some capacity is available for them.
+    bool can_dispatch() const {
+        return _fq.waiters() && _fq.has_capacity();
+    }
+    // Before the reactor sleeps: whether something will wake it up for
+    // requests waiting on shared capacity.
+    bool wait_for_capacity() {
+        return _fq.wait_for_capacity();
+    }
+    void stop_waiting_for_capacity() {
+        _fq.stop_waiting_for_capacity();
+    }
+
     shard_id coordinator() const {
         return _coordinator;
     }
@@ -633,6 +1058,8 @@ class reactor {
     class epoll_pollfn;
     class syscall_pollfn;
     class execution_stage_pollfn;
+    class io_queue_load_pollfn;
+    class io_queue_dispatch_pollfn;
     friend io_pollfn;
     friend signal_pollfn;
     friend aio_batch_submit_pollfn;
@@ -680,6 +1107,7 @@ class reactor {
         uint64_t aio_read_bytes = 0;
         uint64_t aio_writes = 0;
         uint64_t aio_write_bytes = 0;
+        uint64_t io_redirected = 0;
         uint64_t fstream_reads = 0;
         uint64_t fstream_read_bytes = 0;
         uint64_t fstream_reads_blocked = 0;
@@ -688,16 +1116,13 @@ class reactor {
         uint64_t fstream_read_ahead_discarded_bytes = 0;
     };
 private:
-    // FIXME: make _backend a unique_ptr<reactor_backend>, not a compile-time #ifdef.
+    std::unique_ptr<reactor_backend> _backend;
 #ifdef HAVE_OSV
-    reactor_backend_osv _backend;
     sched::thread _timer_thread;
     sched::thread *_engine_thread;
     mutable mutex _timer_mutex;
     condvar _timer_cond;
     s64 _timer_due = 0;
-#else
-    reactor_backend_epoll _backend;
 #endif
     sigset_t _active_sigmask; // holds sigmask while sleeping with sig disabled
     std::vector<pollfn*> _pollers;
@@ -713,7 +1138,13 @@ class reactor {
     // separately saves us the pointer access.
     shard_id _io_coordinator;
     io_queue* _io_queue;
+    // All the IO queues. When our coordinator is backlogged, requests go to
+    // another one that has spare capacity, if balancing is enabled.
+    std::vector<io_queue*> _all_io_queues;
+    unsigned _next_io_candidate = 0;
+    bool _io_balancing = true;
     friend io_queue;
+    unsigned _cross_cpu_free_batch = 64;
 
     std::vector<std::function<future<> ()>> _exit_funcs;
     unsigned _id = 0;
@@ -742,8 +1173,20 @@ class reactor {
     timer_set<timer<manual_clock>, &timer<manual_clock>::_link> _manual_timers;
     timer_set<timer<manual_clock>, &timer<manual_clock>::_link>::timer_list_t _expired_manual_timers;
     io_context_t _io_context;
+    // Carried in iocb::data from submission to completion.
+    struct aio_completion {
+        promise<io_event> pr;
+        aio_batch_controller::clock_type::time_point submitted;
+    };
     std::vector<struct ::iocb> _pending_aio;
+    aio_batch_controller _aio_batching;
     semaphore _io_context_available;
+#ifdef HAVE_IO_URING
+    // Set when the backend is io_uring; file I/O then goes through the
+    // same ring instead of _io_context.
+    reactor_backend_uring* _uring = nullptr;
+    class uring_io_completion;
+#endif
     io_stats _io_stats;
     uint64_t _fsyncs = 0;
     uint64_t _cxx_exceptions = 0;
@@ -790,11 +1233,29 @@ class reactor {
     const bool _reuseport;
     circular_buffer<double> _loads;
     double _load = 0;
+    // Measured once at startup: reading /proc/self/smaps walks the page
+    // tables under the mmap lock, stalling page faults on every shard.
+    memory::huge_page_coverage _huge_page_coverage;
     sched_clock::duration _total_idle;
     sched_clock::time_point _start_time = sched_clock::now();
     std::chrono::nanoseconds _max_poll_time = calculate_poll_time();
     circular_buffer<output_stream<char>* > _flush_batching;
     std::atomic<bool> _sleeping alignas(seastar::cache_line_size);
+    smp_doorbell _smp_doorbell;
+    struct {
+        shard_set unflushed; // shards with messages batched for them
+        shard_set pending_wakeups; // sleeping shards to wake at the end of the poll
+        bool in_poll = false; // wakeups are deferred to the end of the poll only while set
+        std::chrono::nanoseconds poll_window{0}; // polling for messages after the last one
+        std::chrono::nanoseconds max_poll_window{0};
+        sched_clock::time_point last_message;
+        sched_clock::time_point sleep_start;
+        bool slept = false; // set when the reactor actually went to sleep
+        uint64_t doorbell_polls = 0;
+        uint64_t wasted_polls = 0;
+        uint64_t wakeups = 0;
+        uint64_t coalesced_wakeups = 0;
+    } _smp_polling;
     pthread_t _thread_id alignas(seastar::cache_line_size) = pthread_self();
     bool _strict_o_direct = true;
     bool _bypass_fsync = false;
@@ -806,6 +1267,7 @@ class reactor {
     static void block_notifier(int);
     void wakeup();
     bool flush_pending_aio();
+    shard_id pick_io_coordinator();
     bool flush_tcp_batches();
     bool do_expire_lowres_timers();
     bool do_check_lowres_timers() const;
@@ -867,7 +1329,7 @@ class reactor {
     uint64_t min_vruntime() const;
 public:
     static boost::program_options::options_description get_options_description(std::chrono::duration<double> default_task_quota);
-    explicit reactor(unsigned id);
+    reactor(unsigned id, reactor_backend_selector rbs);
     reactor(const reactor&) = delete;
     ~reactor();
     void operator=(const reactor&) = delete;
@@ -880,6 +1342,12 @@ class reactor {
         return io_queue::register_one_priority_class(std::move(name), shares);
     }
 
+    /// Puts absolute throughput ceilings on an I/O priority class, on top of its shares.
+    ///
+    /// The limits apply to the whole node and are split among the I/O queues
+    /// like their capacity is. Zero fields mean unlimited.
+    future<> update_io_priority_class_limits(const io_priority_class& pc, fair_queue_limits limits);
+
     void configure(boost::program_options::variables_map config);
 
     server_socket listen(socket_address sa, listen_options opts = {});
@@ -903,6 +1371,8 @@ class reactor {
 
     future<> write_all(pollable_fd_state& fd, const void* buffer, size_t size);
 
+    future<size_t> sendfile(pollable_fd_state& fd, int in_fd, uint64_t offset, size_t len);
+
     future<file> open_file_dma(sstring name, open_flags flags, file_open_options options = {});
     future<file> open_directory(sstring name);
     future<> make_directory(sstring name);
@@ -924,6 +1394,17 @@ class reactor {
     future<io_event> submit_io_read(const io_priority_class& priority_class, size_t len, Func prepare_io);
     template <typename Func>
     future<io_event> submit_io_write(const io_priority_class& priority_class, size_t len, Func prepare_io);
+#ifdef HAVE_IO_URING
+    template <typename Func>
+    future<io_event> submit_io(uring_request<Func> req);
+    // For operations linux-aio can't express (fdatasync, fallocate, statx).
+    // Only valid if uring_file_io() is true.
+    template <typename Func>
+    future<io_event> submit_io_uring(const io_priority_class& priority_class, Func prepare_sqe);
+    bool uring_file_io() const {
+        return _uring;
+    }
+#endif
 
     int run();
     void exit(int ret);
@@ -995,14 +1476,8 @@ class reactor {
                 std::cerr << "Write error, disconnect the connection." << std::endl;
                 chan->set_channel_broken();
 
-                // ev_del is a param that will be ignored by EPOLL_CTL_DEL
-                // so the last param in epoll_ctl can be null, but
-                // in kernel versions before 2.6.9, the EPOLL_CTL_DEL operation required
-                // a non-null pointer in event, even though this argument is ignored.
-                // so we use a empty param here.
-                struct epoll_event ev_del;
-                if (epoll_ctl(_backend.get_fd(), EPOLL_CTL_DEL, out->get_fd(), &ev_del) < 0) {
-                    std::cerr << "Epoll delete fd error." << std::endl;
+                if (!_backend->forget_fd(out->get_fd())) {
+                    std::cerr << "Reactor backend delete fd error." << std::endl;
                     return make_ready_future();
                 }
                 close(out->get_fd());
@@ -1072,6 +1547,7 @@ class reactor {
     future<> run_exit_tasks();
     void stop();
     friend class alien::message_queue;
+    friend class internal::work_stealing;
     friend class pollable_fd;
     friend class pollable_fd_state;
     friend class posix_file_impl;
@@ -1090,30 +1566,30 @@ class reactor {
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
 public:
     bool wait_and_process(int timeout = 0, const sigset_t* active_sigmask = nullptr) {
-        return _backend.wait_and_process(timeout, active_sigmask);
+        return _backend->wait_and_process(timeout, active_sigmask);
     }
 
     future<> readable(pollable_fd_state& fd) {
-        return _backend.readable(fd);
+        return _backend->readable(fd);
     }
     future<> writeable(pollable_fd_state& fd) {
-        return _backend.writeable(fd);
+        return _backend->writeable(fd);
     }
     void forget(pollable_fd_state& fd) {
-        _backend.forget(fd);
+        _backend->forget(fd);
     }
     future<> notified(reactor_notifier *n) {
-        return _backend.notified(n);
+        return _backend->notified(n);
     }
     void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_reader(fd, std::move(ex));
+        return _backend->abort_reader(fd, std::move(ex));
     }
     void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_writer(fd, std::move(ex));
+        return _backend->abort_writer(fd, std::move(ex));
     }
     void enable_timer(steady_clock_type::time_point when);
     std::unique_ptr<reactor_notifier> make_reactor_notifier() {
-        return _backend.make_reactor_notifier();
+        return _backend->make_reactor_notifier();
     }
     /// Sets the "Strict DMA" flag.
     ///
@@ -1169,6 +1645,8 @@ class smp {
       void operator()(smp_message_queue** qs) const;
     };
     static std::unique_ptr<smp_message_queue*[], qs_deleter> _qs;
+    static std::vector<unsigned> _shard_to_node;
+    static std::unique_ptr<fair_queue_shared_capacity> _shared_io_capacity;
     static std::thread::id _tmain;
     static bool _using_dpdk;
 
@@ -1219,8 +1697,62 @@ class smp {
             return _qs[t][engine().cpu_id()].submit(std::forward<Func>(func));
         }
     }
+    /// Returns the NUMA node of the processor shard \c t runs on.
+    static unsigned node_of(unsigned t) {
+        return t < _shard_to_node.size() ? _shard_to_node[t] : 0;
+    }
+    /// Chooses the shard nearest to this one among \c shards: this shard
+    /// if it is one of them, otherwise one on the same NUMA node, spreading
+    /// the shards of a node over the candidates, otherwise the first one.
+    ///
+    /// \param shards a non-empty range of shard ids
+    template <typename Range>
+    static unsigned nearest_shard(const Range& shards) {
+        return nearest_shard(shards, engine().cpu_id(), [] (unsigned t) { return node_of(t); });
+    }
+    /// \cond internal
+    // nearest_shard() as seen from shard \c me, with the NUMA node of each
+    // shard given by \c node, so that it can be tested on any topology.
+    template <typename Range, typename NodeOf>
+    static unsigned nearest_shard(const Range& shards, unsigned me, NodeOf node) {
+        unsigned local = 0;
+        for (unsigned t : shards) {
+            if (t == me) {
+                return t;
+            }
+            local += node(t) == node(me);
+        }
+        if (local) {
+            auto pick = me % local;
+            for (unsigned t : shards) {
+                if (node(t) == node(me) && !pick--) {
+                    return t;
+                }
+            }
+        }
+        return *std::begin(shards);
+    }
+    /// \endcond
+    /// Runs a function on whichever of several equivalent shards is nearest
+    /// to this one, such as one of the replicas of some data.
+    ///
+    /// \param shards a non-empty range of shard ids, any of which can run \c func
+    /// \param func a callable to run, as with submit_to()
+    /// \see nearest_shard()
+    template <typename Range, typename Func>
+    static futurize_t<std::result_of_t<Func()>> submit_to_nearest(const Range& shards, Func&& func) {
+        return submit_to(nearest_shard(shards), std::forward<Func>(func));
+    }
+    /// Total number of messages this shard sent to shards on other NUMA nodes.
+    static uint64_t remote_node_sent_messages();
+    /// Total number of messages this shard received from shards on other NUMA nodes.
+    static uint64_t remote_node_received_messages();
     static bool poll_queues();
     static bool pure_poll_queues();
+private:
+    static size_t flush_queues();
+    static void deliver_wakeups();
+public:
     static boost::integer_range<unsigned> all_cpus() {
         return boost::irange(0u, count);
     }
@@ -1237,8 +1769,9 @@ class smp {
     }
 private:
     static void start_all_queues();
+    static void allocate_queues(unsigned receiver);
     static void pin(unsigned cpu_id);
-    static void allocate_reactor(unsigned id);
+    static void allocate_reactor(unsigned id, reactor_backend_selector rbs);
     static void create_thread(std::function<void ()> thread_loop);
 public:
     static unsigned count;
@@ -1402,6 +1935,11 @@ future<> pollable_fd::write_all(net::packet& p) {
     });
 }
 
+inline
+future<size_t> pollable_fd::sendfile(int in_fd, uint64_t offset, size_t len) {
+    return engine().sendfile(*_s, in_fd, offset, len);
+}
+
 inline
 future<> pollable_fd::readable() {
     return engine().readable(*_s);
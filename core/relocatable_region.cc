@@ -0,0 +1,234 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#include "core/relocatable_region.hh"
+#include "core/align.hh"
+#include "util/defer.hh"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+namespace seastar {
+
+// Lives at the start of each segment, which is aligned to its size.
+struct relocatable_region::segment {
+    relocatable_region* region;
+    size_t used; // offset of the first unallocated byte
+    size_t live; // bytes of live objects, headers included
+    unsigned idx; // in _segments
+};
+
+// Precedes each object. A null owner marks a freed object.
+struct relocatable_region::object_header {
+    relocatable_handle* owner;
+    uint32_t size;
+    uint32_t offset; // from the start of the segment
+};
+
+relocatable_handle::relocatable_handle(relocatable_handle&& x) noexcept
+        : _obj(std::exchange(x._obj, nullptr)) {
+    if (_obj) {
+        relocatable_region::header_of(_obj)->owner = this;
+    }
+}
+
+relocatable_handle& relocatable_handle::operator=(relocatable_handle&& x) noexcept {
+    if (this != &x) {
+        this->~relocatable_handle();
+        new (this) relocatable_handle(std::move(x));
+    }
+    return *this;
+}
+
+relocatable_handle::~relocatable_handle() {
+    if (_obj) {
+        auto h = relocatable_region::header_of(_obj);
+        relocatable_region::segment_of(h)->region->free(_obj);
+    }
+}
+
+size_t relocatable_handle::size() const {
+    return relocatable_region::header_of(_obj)->size;
+}
+
+relocatable_region::relocatable_region(size_t segment_size)
+        : _segment_size(segment_size)
+        , _reclaimer([this] { return reclaim(); }, memory::reclaimer_scope::sync) {
+    assert(segment_size >= memory::page_size && !(segment_size & (segment_size - 1)));
+}
+
+relocatable_region::~relocatable_region() {
+    for (auto s : _segments) {
+        ::operator delete[](reinterpret_cast<char*>(s), with_alignment(_segment_size));
+    }
+}
+
+relocatable_region::object_header* relocatable_region::header_of(void* obj) {
+    return reinterpret_cast<object_header*>(reinterpret_cast<char*>(obj) - object_alignment);
+}
+
+relocatable_region::segment* relocatable_region::segment_of(object_header* h) {
+    return reinterpret_cast<segment*>(reinterpret_cast<char*>(h) - h->offset);
+}
+
+size_t relocatable_region::payload_start() const {
+    return align_up(sizeof(segment), object_alignment);
+}
+
+size_t relocatable_region::max_object_size() const {
+    return _segment_size - payload_start() - object_alignment;
+}
+
+relocatable_region::segment* relocatable_region::open_segment() {
+    _segments.reserve(_segments.size() + 1);
+    auto s = reinterpret_cast<segment*>(new (with_alignment(_segment_size)) char[_segment_size]);
+    s->region = this;
+    s->used = payload_start();
+    s->live = 0;
+    s->idx = _segments.size();
+    _segments.push_back(s);
+    return s;
+}
+
+void relocatable_region::free_segment(segment* s) {
+    auto last = _segments.back();
+    last->idx = s->idx;
+    _segments[s->idx] = last;
+    _segments.pop_back();
+    if (s == _open) {
+        _open = nullptr;
+    }
+    ::operator delete[](reinterpret_cast<char*>(s), with_alignment(_segment_size));
+}
+
+relocatable_handle relocatable_region::allocate(size_t size) {
+    if (size > max_object_size()) {
+        throw std::invalid_argument("object too large for relocatable_region");
+    }
+    static_assert(sizeof(object_header) <= object_alignment, "object_header must fit before the aligned object");
+    auto total = align_up(object_alignment + size, object_alignment);
+    if (!_open || _open->used + total > _segment_size) {
+        // Opening a segment may reclaim, but must not compact under our feet.
+        auto prev_compacting = std::exchange(_compacting, true);
+        auto restore = defer([&] { _compacting = prev_compacting; });
+        auto old = _open;
+        _open = open_segment();
+        if (old && !old->live) {
+            free_segment(old);
+        }
+    }
+    auto s = _open;
+    auto h = reinterpret_cast<object_header*>(reinterpret_cast<char*>(s) + s->used);
+    s->used += total;
+    s->live += total;
+    _used += total;
+    relocatable_handle ret;
+    ret._obj = reinterpret_cast<char*>(h) + object_alignment;
+    h->owner = &ret;
+    h->size = size;
+    h->offset = reinterpret_cast<char*>(h) - reinterpret_cast<char*>(s);
+    return ret;
+}
+
+void relocatable_region::free(void* obj) {
+    auto h = header_of(obj);
+    auto s = segment_of(h);
+    auto total = align_up(object_alignment + h->size, object_alignment);
+    h->owner = nullptr;
+    s->live -= total;
+    _used -= total;
+    if (!s->live) {
+        if (s == _open) {
+            s->used = payload_start();
+        } else {
+            free_segment(s);
+        }
+    }
+}
+
+// Moves the live objects of s to the open segment, and frees s.
+bool relocatable_region::evacuate(segment* s) {
+    auto pos = payload_start();
+    while (pos < s->used) {
+        auto h = reinterpret_cast<object_header*>(reinterpret_cast<char*>(s) + pos);
+        auto total = align_up(object_alignment + h->size, object_alignment);
+        pos += total;
+        if (!h->owner) {
+            continue;
+        }
+        if (!_open || _open == s || _open->used + total > _segment_size) {
+            try {
+                _open = open_segment();
+            } catch (std::bad_alloc&) {
+                return false;
+            }
+        }
+        auto d = _open;
+        auto nh = reinterpret_cast<object_header*>(reinterpret_cast<char*>(d) + d->used);
+        std::memcpy(nh, h, total);
+        nh->offset = reinterpret_cast<char*>(nh) - reinterpret_cast<char*>(d);
+        nh->owner->_obj = reinterpret_cast<char*>(nh) + object_alignment;
+        h->owner = nullptr;
+        d->used += total;
+        d->live += total;
+        s->live -= total;
+        _moved_bytes += total;
+    }
+    assert(!s->live);
+    free_segment(s);
+    ++_compactions;
+    return true;
+}
+
+size_t relocatable_region::compact(float max_occupancy) {
+    if (_compacting || _compaction_locks) {
+        return 0;
+    }
+    _compacting = true;
+    auto restore = defer([this] { _compacting = false; });
+    auto payload = _segment_size - payload_start();
+    std::vector<segment*> candidates;
+    for (auto s : _segments) {
+        if (s != _open && s->live <= max_occupancy * payload) {
+            candidates.push_back(s);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [] (segment* a, segment* b) {
+        return a->live < b->live;
+    });
+    auto before = total_memory();
+    for (auto s : candidates) {
+        if (!evacuate(s)) {
+            break;
+        }
+    }
+    auto after = total_memory();
+    return before > after ? before - after : 0;
+}
+
+memory::reclaiming_result relocatable_region::reclaim() {
+    // Segments emptier than this are worth moving to defragment memory
+    return compact(0.75) ? memory::reclaiming_result::reclaimed_something : memory::reclaiming_result::reclaimed_nothing;
+}
+
+}
@@ -0,0 +1,146 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// Memory whose objects the allocator may move, so that long-lived data,
+// such as cache contents, does not fragment the shard's memory.
+
+#include "core/memory.hh"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace seastar {
+
+/// \addtogroup memory-module
+/// @{
+
+class relocatable_region;
+
+/// \brief Owning handle to an object in a \ref relocatable_region
+///
+/// The object may be moved to another address whenever its region is
+/// compacted, which happens when memory is allocated or reclaimed, unless
+/// a \ref relocatable_region::compaction_lock is held. Pointers returned
+/// by get() must therefore not be kept across allocations or preemption
+/// points.
+class relocatable_handle {
+    void* _obj = nullptr;
+    friend class relocatable_region;
+public:
+    relocatable_handle() = default;
+    relocatable_handle(relocatable_handle&& x) noexcept;
+    relocatable_handle& operator=(relocatable_handle&& x) noexcept;
+    relocatable_handle(const relocatable_handle&) = delete;
+    relocatable_handle& operator=(const relocatable_handle&) = delete;
+    /// Frees the object.
+    ~relocatable_handle();
+    /// Current address of the object.
+    void* get() const { return _obj; }
+    /// Size the object was allocated with.
+    size_t size() const;
+    explicit operator bool() const { return _obj; }
+};
+
+/// \brief A region of objects that can be moved in memory
+///
+/// Objects are bump-allocated in segments, large aligned allocations
+/// from the seastar allocator. Freed objects leave holes in their
+/// segments; compaction copies the live objects of the sparsest
+/// segments into the open segment, updates their handles, and returns
+/// the emptied segments, so that the memory they leave behind coalesces
+/// into large free spans.
+///
+/// Compaction runs when compact() is called, and as a reclaimer when the
+/// shard cannot find a free span for an allocation or runs low on memory.
+///
+/// Objects are moved with memcpy(); only trivially relocatable data may
+/// be stored.  The region must outlive its handles.
+class relocatable_region {
+public:
+    static constexpr size_t default_segment_size = 128 << 10;
+    static constexpr size_t object_alignment = 16;
+    /// Prevents compaction of the region while alive, so that pointers
+    /// to its objects stay valid.
+    class compaction_lock {
+        relocatable_region& _region;
+    public:
+        explicit compaction_lock(relocatable_region& r) : _region(r) { ++_region._compaction_locks; }
+        ~compaction_lock() { --_region._compaction_locks; }
+    };
+private:
+    struct segment;
+    struct object_header;
+    size_t _segment_size;
+    std::vector<segment*> _segments;
+    segment* _open = nullptr;
+    size_t _used = 0;
+    unsigned _compaction_locks = 0;
+    bool _compacting = false;
+    uint64_t _compactions = 0;
+    uint64_t _moved_bytes = 0;
+    memory::reclaimer _reclaimer;
+public:
+    /// \param segment_size power of two, at least a page
+    explicit relocatable_region(size_t segment_size = default_segment_size);
+    ~relocatable_region();
+    relocatable_region(const relocatable_region&) = delete;
+    relocatable_region& operator=(const relocatable_region&) = delete;
+
+    /// Allocates an object of \c size bytes.
+    ///
+    /// Throws std::bad_alloc if no memory is available, and
+    /// std::invalid_argument if \c size exceeds max_object_size().
+    relocatable_handle allocate(size_t size);
+
+    /// Moves the live objects out of the segments at most \c max_occupancy
+    /// full and frees those segments.
+    ///
+    /// \returns the number of bytes given back to the allocator
+    size_t compact(float max_occupancy = 0.5);
+
+    size_t max_object_size() const;
+    /// Bytes used by live objects, including their headers.
+    size_t used_memory() const { return _used; }
+    /// Bytes held in segments.
+    size_t total_memory() const { return _segments.size() * _segment_size; }
+    /// Number of segments freed by compaction.
+    uint64_t compactions() const { return _compactions; }
+    /// Bytes of objects moved by compaction.
+    uint64_t moved_bytes() const { return _moved_bytes; }
+private:
+    static object_header* header_of(void* obj);
+    static segment* segment_of(object_header* h);
+    size_t payload_start() const;
+    segment* open_segment();
+    void free_segment(segment* s);
+    void free(void* obj);
+    bool evacuate(segment* s);
+    memory::reclaiming_result reclaim();
+    friend class relocatable_handle;
+};
+
+/// @}
+
+}
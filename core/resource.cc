@@ -227,14 +227,45 @@ allocate_io_queues(hwloc_topology_t& topology, configuration c, std::vector<cpu>
         numa_nodes[node_id].erase(io_coordinator);
     }
 
+    // If asked to, give every node a coordinator of its own, so that no shard has
+    // its requests submitted, and its completions polled, across nodes. The disk
+    // capacity is then split among more queues than iotune measured it for.
+    if (c.io_queue_per_node) {
+        for (auto& node: numa_nodes) {
+            if (node_coordinators.count(node.first) || node.second.empty()) {
+                continue;
+            }
+            auto io_coordinator = *node.second.begin();
+            print("Warning: no IO queue on NUMA node %d; adding one on cpu %d.\n", node.first, cpus[io_coordinator].cpu_id);
+            ret.coordinators.emplace_back(io_queue{io_coordinator, 0});
+            ret.shard_to_coordinator[io_coordinator] = io_coordinator;
+            node_coordinators[node.first].push_back(io_coordinator);
+            node.second.erase(io_coordinator);
+        }
+        for (auto& coordinator : ret.coordinators) {
+            coordinator.capacity = std::max(max_io_requests / unsigned(ret.coordinators.size()), 1u);
+        }
+    }
+
     // If there are more processors than coordinators, we will have to assign them to existing
-    // coordinators. We always do that within the same NUMA node.
+    // coordinators. We do that within the same NUMA node, unless it has none.
+    std::vector<unsigned> all_coordinators;
+    for (auto& coordinator : ret.coordinators) {
+        all_coordinators.push_back(coordinator.id);
+    }
     for (auto& node: numa_nodes) {
+        if (node.second.empty()) {
+            continue;
+        }
+        auto it = node_coordinators.find(node.first);
+        if (it == node_coordinators.end()) {
+            print("Warning: no IO queue on NUMA node %d; its cpus will submit IO through other nodes.\n", node.first);
+        }
+        auto& candidates = it != node_coordinators.end() ? it->second : all_coordinators;
         auto cid_idx = 0;
         for (auto& remaining_shard: node.second) {
-            auto idx = cid_idx++ % node_coordinators.at(node.first).size();
-            auto io_coordinator = node_coordinators.at(node.first)[idx];
-            ret.shard_to_coordinator[remaining_shard] = io_coordinator;
+            auto idx = cid_idx++ % candidates.size();
+            ret.shard_to_coordinator[remaining_shard] = candidates[idx];
         }
     }
 
@@ -295,6 +326,7 @@ resources allocate(configuration c) {
         auto node = hwloc_get_ancestor_obj_by_depth(topology, depth, pu);
         cpu this_cpu;
         this_cpu.cpu_id = cpu_id;
+        this_cpu.nodeid = hwloc_bitmap_first(node->nodeset);
         remain = mem_per_proc - alloc_from_node(this_cpu, node, topo_used_mem, mem_per_proc);
 
         remains.emplace_back(std::move(this_cpu), remain);
@@ -47,6 +47,8 @@ struct configuration {
     optional<cpuset> cpu_set;
     optional<unsigned> max_io_requests;
     optional<unsigned> io_queues;
+    // Add IO queues beyond io_queues, so that every NUMA node has one.
+    bool io_queue_per_node = false;
 };
 
 struct memory {
@@ -71,6 +73,7 @@ struct io_queue_topology {
 struct cpu {
     unsigned cpu_id;
     std::vector<memory> mem;
+    unsigned nodeid = 0; // NUMA node of the processor
 };
 
 struct resources {
@@ -74,6 +74,10 @@ class scheduling_group {
     /// \param shares number of shares allotted to the group. Use numbers
     ///               in the 1-1000 range.
     void set_shares(float shares);
+    /// Bytes allocated on this shard by tasks running in the group and not
+    /// yet freed, by whichever group or shard frees them.
+    /// See \ref memory::allocation_context_stats.
+    int64_t allocated_memory() const;
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
     friend class reactor;
 };
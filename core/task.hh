@@ -22,19 +22,100 @@
 #pragma once
 
 #include <memory>
+#include "memory.hh"
 #include "scheduling.hh"
 
 namespace seastar {
 
+namespace internal {
+
+// Tasks freed by this shard, kept by size, so that allocating a
+// continuation is usually just popping one of them: continuations are
+// allocated and freed at a high rate, and almost always by the same shard.
+//
+// Cached tasks remain allocated as far as memory::stats() and allocation
+// contexts are concerned.
+struct task_freelist {
+    static constexpr size_t granularity = 16;
+    static constexpr size_t max_size = 256;
+    static constexpr unsigned nr_classes = max_size / granularity;
+    // Bounds the memory held by each size class
+    static constexpr size_t max_cached_bytes = 32 << 10;
+    struct entry {
+        entry* next;
+    };
+    entry* heads[nr_classes];
+    unsigned counts[nr_classes];
+
+    static constexpr unsigned size_class(size_t size) {
+        return (size - 1) / granularity;
+    }
+    [[gnu::always_inline]]
+    static void* allocate(size_t size);
+    [[gnu::always_inline]]
+    static void free(void* ptr, size_t size);
+};
+
+extern __thread task_freelist tl_task_freelist;
+
+}
+
 class task {
     scheduling_group _sg;
 public:
     explicit task(scheduling_group sg = current_scheduling_group()) : _sg(sg) {}
     virtual ~task() noexcept {}
     virtual void run() noexcept = 0;
+    // Runs the task and destroys it.  Tasks which are not owned by the
+    // task queue, such as those embedded in a coroutine frame, override it.
+    virtual void run_and_dispose() noexcept {
+        run();
+        delete this;
+    }
     scheduling_group group() const { return _sg; }
+    // Tasks are allocated with sizes known at compile time; let the
+    // allocator pick their size class at compile time too.
+    static void* operator new(size_t size) { return internal::task_freelist::allocate(size); }
+    static void operator delete(void* ptr, size_t size) { internal::task_freelist::free(ptr, size); }
 };
 
+namespace internal {
+
+inline void* task_freelist::allocate(size_t size) {
+#ifndef DEFAULT_ALLOCATOR
+    if (size <= max_size) {
+        auto idx = size_class(size);
+        auto& fl = tl_task_freelist;
+        if (auto e = fl.heads[idx]) {
+            fl.heads[idx] = e->next;
+            --fl.counts[idx];
+            return e;
+        }
+        return memory::allocate_sized((idx + 1) * granularity);
+    }
+#endif
+    return memory::allocate_sized(size);
+}
+
+inline void task_freelist::free(void* ptr, size_t size) {
+#ifndef DEFAULT_ALLOCATOR
+    if (size <= max_size) {
+        auto idx = size_class(size);
+        auto& fl = tl_task_freelist;
+        if (fl.counts[idx] < max_cached_bytes / ((idx + 1) * granularity)) {
+            fl.heads[idx] = new (ptr) entry{fl.heads[idx]};
+            ++fl.counts[idx];
+            return;
+        }
+        memory::free_sized(ptr, (idx + 1) * granularity);
+        return;
+    }
+#endif
+    memory::free_sized(ptr, size);
+}
+
+}
+
 void schedule(std::unique_ptr<task> t);
 void schedule_urgent(std::unique_ptr<task> t);
 
@@ -0,0 +1,212 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#include "core/work_stealing.hh"
+#include "core/cacheline.hh"
+#include "core/task.hh"
+#include <cassert>
+#include <cstdlib>
+#include <boost/lockfree/queue.hpp>
+
+namespace seastar {
+
+namespace internal {
+
+// Each shard publishes its stealable tasks in a queue which any shard may
+// pop from. For every task it also schedules a runner, which pops a task
+// from the queue and runs it, so that tasks run even if nobody steals them;
+// a runner finding the queue empty means its task was stolen.
+class work_stealing {
+    static constexpr size_t queue_length = 1024;
+    struct alignas(seastar::cache_line_size) queue {
+        boost::lockfree::queue<stealable_task*> tasks{queue_length};
+        std::atomic<size_t> size{0};
+        // Whether the shard owning the queue steals tasks when idle
+        std::atomic<bool> thief{false};
+        bool push(stealable_task* t) {
+            if (!tasks.bounded_push(t)) {
+                return false;
+            }
+            size.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        stealable_task* pop() {
+            stealable_task* t;
+            if (!tasks.pop(t)) {
+                return nullptr;
+            }
+            size.fetch_sub(1, std::memory_order_relaxed);
+            return t;
+        }
+    };
+    class runner final : public task {
+        queue* _q;
+        stealable_task* _task = nullptr;
+    public:
+        explicit runner(queue* q) : _q(q) {}
+        void set_task(stealable_task* t) { _task = t; }
+        virtual void run() noexcept override {
+            auto t = _task ? _task : _q->pop();
+            if (t) {
+                t->run();
+                t->complete();
+            }
+        }
+    };
+    // queue is over-aligned, which operator new[] does not honour before C++17
+    struct queues_deleter {
+        size_t nr_queues = 0;
+        void operator()(queue* qs) const;
+    };
+    static std::unique_ptr<queue[], queues_deleter> _queues;
+    static std::vector<reactor*> _reactors;
+    static thread_local uint64_t _stolen;
+    static void wake_idle_shard();
+public:
+    static void configure(const std::vector<reactor*>& reactors);
+    static void submit(std::unique_ptr<stealable_task> t);
+    static bool steal(reactor::work_waiting_on_reactor work_waiting);
+    static void stop_stealing();
+    static uint64_t stolen() { return _stolen; }
+};
+
+std::unique_ptr<work_stealing::queue[], work_stealing::queues_deleter> work_stealing::_queues;
+std::vector<reactor*> work_stealing::_reactors;
+thread_local uint64_t work_stealing::_stolen;
+
+void work_stealing::configure(const std::vector<reactor*>& reactors) {
+    if (reactors.size() < 2) {
+        return;
+    }
+    _reactors = reactors;
+    void* buf;
+    int r = posix_memalign(&buf, cache_line_size, sizeof(queue) * reactors.size());
+    assert(r == 0);
+    auto qs = reinterpret_cast<queue*>(buf);
+    for (unsigned i = 0; i < reactors.size(); ++i) {
+        new (&qs[i]) queue;
+    }
+    _queues = std::unique_ptr<queue[], queues_deleter>(qs, queues_deleter{reactors.size()});
+}
+
+void work_stealing::queues_deleter::operator()(queue* qs) const {
+    for (unsigned i = 0; i < nr_queues; ++i) {
+        qs[i].~queue();
+    }
+    ::free(qs);
+}
+
+// Wakes up a sleeping thief, preferably on this NUMA node, to steal some
+// of the tasks this shard cannot keep up with.
+void work_stealing::wake_idle_shard() {
+    auto me = engine().cpu_id();
+    auto nr = _reactors.size();
+    for (auto same_node : {true, false}) {
+        for (unsigned n = 1; n < nr; ++n) {
+            auto shard = (me + n) % nr;
+            if ((smp::node_of(shard) == smp::node_of(me)) != same_node) {
+                continue;
+            }
+            auto r = _reactors[shard];
+            if (_queues[shard].thief.load(std::memory_order_relaxed) && r->_sleeping.load(std::memory_order_relaxed)) {
+                r->_sleeping.store(false, std::memory_order_relaxed);
+                r->wakeup();
+                return;
+            }
+        }
+    }
+}
+
+void work_stealing::submit(std::unique_ptr<stealable_task> t) {
+    auto q = _queues ? &_queues[engine().cpu_id()] : nullptr;
+    auto r = std::make_unique<runner>(q);
+    if (!q || !q->push(t.get())) {
+        r->set_task(t.get());
+    } else if (q->size.load(std::memory_order_relaxed) > 1) {
+        // Tasks are piling up
+        wake_idle_shard();
+    }
+    t.release();
+    schedule(std::move(r));
+}
+
+bool work_stealing::steal(reactor::work_waiting_on_reactor work_waiting) {
+    if (!_queues) {
+        return false;
+    }
+    auto me = engine().cpu_id();
+    auto nr = _reactors.size();
+    _queues[me].thief.store(true, std::memory_order_relaxed);
+    for (auto same_node : {true, false}) {
+        for (unsigned n = 1; n < nr && !work_waiting(); ++n) {
+            auto shard = (me + n) % nr;
+            if ((smp::node_of(shard) == smp::node_of(me)) != same_node) {
+                continue;
+            }
+            auto t = _queues[shard].pop();
+            if (t) {
+                t->run();
+                ++_stolen;
+                smp::submit_to(t->origin(), [t] {
+                    t->complete();
+                });
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void work_stealing::stop_stealing() {
+    if (_queues) {
+        _queues[engine().cpu_id()].thief.store(false, std::memory_order_relaxed);
+    }
+}
+
+stealable_task::stealable_task() : _origin(engine().cpu_id()) {
+}
+
+void submit_stealable_task(std::unique_ptr<stealable_task> t) {
+    work_stealing::submit(std::move(t));
+}
+
+void configure_work_stealing(const std::vector<reactor*>& reactors) {
+    work_stealing::configure(reactors);
+}
+
+void stop_stealing() {
+    work_stealing::stop_stealing();
+}
+
+uint64_t stolen_tasks() {
+    return work_stealing::stolen();
+}
+
+}
+
+reactor::idle_cpu_handler_result steal_tasks(reactor::work_waiting_on_reactor work_waiting) {
+    // Run a single task, and let the reactor poll before the next one.
+    return internal::work_stealing::steal(work_waiting)
+            ? reactor::idle_cpu_handler_result::interrupted_by_higher_priority_task
+            : reactor::idle_cpu_handler_result::no_more_work;
+}
+
+}
@@ -0,0 +1,130 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#pragma once
+
+/// \file
+
+// Lets idle shards run pure computations on behalf of busy ones.
+
+#include "core/future.hh"
+#include "core/reactor.hh"
+#include <experimental/optional>
+#include <memory>
+#include <vector>
+
+namespace seastar {
+
+namespace internal {
+
+class stealable_task {
+    unsigned _origin;
+public:
+    stealable_task();
+    virtual ~stealable_task() = default;
+    // Shard which submitted the task, and on which it must complete
+    unsigned origin() const { return _origin; }
+    // Runs the function; may be called on any shard
+    virtual void run() noexcept = 0;
+    // Delivers the result and destroys the task; called on the origin shard
+    virtual void complete() noexcept = 0;
+};
+
+template <typename Func>
+class lambda_stealable_task final : public stealable_task {
+    using futurator = futurize<std::result_of_t<Func()>>;
+    using future_type = typename futurator::type;
+    using value_type = typename future_type::value_type;
+    Func _func;
+    std::experimental::optional<value_type> _result;
+    std::exception_ptr _ex; // if !_result
+    typename futurator::promise_type _promise;
+public:
+    explicit lambda_stealable_task(Func&& func) : _func(std::move(func)) {}
+    virtual void run() noexcept override {
+        auto f = futurator::apply(_func);
+        try {
+            _result = f.get();
+        } catch (...) {
+            _ex = std::current_exception();
+        }
+    }
+    virtual void complete() noexcept override {
+        if (_result) {
+            _promise.set_value(std::move(*_result));
+        } else {
+            _promise.set_exception(std::move(_ex));
+        }
+        delete this;
+    }
+    future_type get_future() { return _promise.get_future(); }
+};
+
+void submit_stealable_task(std::unique_ptr<stealable_task> t);
+void configure_work_stealing(const std::vector<reactor*>& reactors);
+// Stops waking this shard up to steal tasks; called before every run of the
+// idle cpu handler, which marks the shard a thief again if it still steals.
+void stop_stealing();
+// Number of tasks of other shards this shard ran
+uint64_t stolen_tasks();
+
+}
+
+/// \addtogroup smp-module
+/// @{
+
+/// Runs a function on this shard, or on an idle shard which steals it.
+///
+/// The function is run by a task of the current scheduling group, unless
+/// another shard steals it first: shards which have no work of their own
+/// steal with \c --work-stealing, or when their idle cpu handler calls
+/// steal_tasks(), which spreads the load of a busy shard over the idle ones.
+/// A busy shard also wakes up sleeping thieves as its tasks pile up. The
+/// result is delivered back to this shard either way.
+///
+/// Meant for pure computations, such as compression, checksumming or
+/// rendering a response, which make up an embarrassingly parallel job.
+///
+/// \param func a synchronous callable, which must not access any
+///        shard-local state, including futures, timers and sharded
+///        services, since it may run on another shard. Memory it
+///        allocates may be freed on any shard.
+/// \return a future holding whatever \c func returns, or the exception
+///         it throws
+template <typename Func>
+futurize_t<std::result_of_t<Func()>> submit_stealable(Func&& func) {
+    static_assert(!is_future<std::result_of_t<Func()>>::value, "stealable functions must not return futures");
+    using task_type = internal::lambda_stealable_task<std::decay_t<Func>>;
+    auto t = std::make_unique<task_type>(std::decay_t<Func>(std::forward<Func>(func)));
+    auto f = t->get_future();
+    internal::submit_stealable_task(std::move(t));
+    return f;
+}
+
+/// An idle cpu handler which runs a task stolen from the other shards.
+///
+/// This is the default idle cpu handler with \c --work-stealing; custom
+/// handlers may call it to keep stealing.
+reactor::idle_cpu_handler_result steal_tasks(reactor::work_waiting_on_reactor work_waiting);
+
+/// @}
+
+}
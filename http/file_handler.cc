@@ -102,6 +102,22 @@ future<std::unique_ptr<reply>> file_interaction_handler::read(
     rep->set_content_type(extension);
     return open_file_dma(file_name, open_flags::ro).then(
             [rep = std::move(rep), extension, this, req = std::move(req)](file f) mutable {
+                if (transformer == nullptr) {
+                    // Nothing to change in the content: have the connection
+                    // send it straight from the file.
+                    return f.size().then([rep = std::move(rep), extension, f] (uint64_t size) mutable {
+                        rep->write_body(extension, size, [f, size] (output_stream<char>&& s) {
+                            return do_with(output_stream<char>(std::move(s)), file(f), [size] (output_stream<char>& out, file& f) {
+                                return write_file(out, f, 0, size).finally([&out] {
+                                    return out.close();
+                                }).finally([&f] {
+                                    return f.close();
+                                });
+                            });
+                        });
+                        return make_ready_future<std::unique_ptr<reply>>(std::move(rep));
+                    });
+                }
                 std::shared_ptr<reader> r = std::make_shared<reader>(std::move(f), std::move(rep));
 
                 return r->is.consume(*r).then([r, extension, this, req = std::move(req)]() {
@@ -89,6 +89,9 @@ future<> connection::start_response() {
                 f.ignore_ready_future();
                 return make_ready_future<>();
             }
+            if (_resp->_body_length) {
+                return make_ready_future<>();
+            }
             return _write_buf.write("0\r\n\r\n", 5);
         }).then_wrapped([this ] (auto f) {
             if (f.failed()) {
@@ -30,6 +30,7 @@
 //
 #include "reply.hh"
 #include "core/print.hh"
+#include "core/fstream.hh"
 #include "httpd.hh"
 
 namespace seastar {
@@ -99,7 +100,7 @@ sstring reply::response_line() {
     return "HTTP/" + _version + status_strings::to_string(_status);
 }
 
-class http_chunked_data_sink_impl : public data_sink_impl {
+class http_chunked_data_sink_impl : public file_range_data_sink_impl {
     output_stream<char>& _out;
 
     future<> write_size(size_t s) {
@@ -123,6 +124,18 @@ class http_chunked_data_sink_impl : public data_sink_impl {
             return _out.write("\r\n", 2);
         });
     }
+    // The whole range goes in one chunk, so the file must not be shorter
+    // than offset + len.
+    virtual future<> put(file f, uint64_t offset, uint64_t len) override {
+        if (len == 0) {
+            return make_ready_future<>();
+        }
+        return write_size(len).then([this, f = std::move(f), offset, len] () mutable {
+            return write_file(_out, std::move(f), offset, len);
+        }).then([this] () mutable {
+            return _out.write("\r\n", 2);
+        });
+    }
     virtual future<> close() {
         return  make_ready_future<>();
     }
@@ -139,10 +152,48 @@ static output_stream<char> make_http_chunked_output_stream(output_stream<char>&
     return output_stream<char>(http_chunked_data_sink(out), 32000, true);
 }
 
+// Writes a body of a known length to the connection as is.
+class http_content_length_data_sink_impl : public file_range_data_sink_impl {
+    output_stream<char>& _out;
+public:
+    http_content_length_data_sink_impl(output_stream<char>& out) : _out(out) {
+    }
+    virtual future<> put(net::packet data) override {
+        return _out.write(std::move(data));
+    }
+    virtual future<> put(temporary_buffer<char> buf) override {
+        return _out.write(std::move(buf));
+    }
+    virtual future<> put(file f, uint64_t offset, uint64_t len) override {
+        return write_file(_out, std::move(f), offset, len);
+    }
+    virtual future<> close() {
+        return make_ready_future<>();
+    }
+};
+
+class http_content_length_data_sink : public data_sink {
+public:
+    http_content_length_data_sink(output_stream<char>& out)
+        : data_sink(std::make_unique<http_content_length_data_sink_impl>(
+                out)) {}
+};
+
+static output_stream<char> make_http_content_length_output_stream(output_stream<char>& out) {
+    return output_stream<char>(http_content_length_data_sink(out), 32000, true);
+}
+
 
 void reply::write_body(const sstring& content_type, std::function<future<>(output_stream<char>&&)>&& body_writer) {
     set_content_type(content_type);
     _body_writer  = std::move(body_writer);
+    _body_length = {};
+}
+
+void reply::write_body(const sstring& content_type, uint64_t content_length, std::function<future<>(output_stream<char>&&)>&& body_writer) {
+    set_content_type(content_type);
+    _body_writer = std::move(body_writer);
+    _body_length = content_length;
 }
 
 void reply::write_body(const sstring& content_type, const sstring& content) {
@@ -151,12 +202,19 @@ void reply::write_body(const sstring& content_type, const sstring& content) {
 }
 
 future<> reply::write_reply_to_connection(connection& con) {
-    add_header("Transfer-Encoding", "chunked");
+    if (_body_length) {
+        add_header("Content-Length", to_sstring(*_body_length));
+    } else {
+        add_header("Transfer-Encoding", "chunked");
+    }
     return con.out().write(response_line()).then([this, &con] () mutable {
         return write_reply_headers(con);
     }).then([&con] () mutable {
         return con.out().write("\r\n", 2);
     }).then([this, &con] () mutable {
+        if (_body_length) {
+            return _body_writer(make_http_content_length_output_stream(con.out()));
+        }
         return _body_writer(make_http_chunked_output_stream(con.out()));
     });
 
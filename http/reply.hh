@@ -36,6 +36,7 @@
 #include "http/mime_types.hh"
 #include "core/future-util.hh"
 #include "core/iostream.hh"
+#include <experimental/optional>
 
 namespace seastar {
 
@@ -154,6 +155,17 @@ struct reply {
 
     void write_body(const sstring& content_type, std::function<future<>(output_stream<char>&&)>&& body_writer);
 
+    /*!
+     * \brief use an output stream to write a message body of a known length
+     *
+     * Like the above, but the body is sent as is after a Content-Length
+     * header, instead of with chunked transfer encoding.
+     *
+     * \param content_length - the length of the body, which the function must
+     *   write exactly. If it fails, the connection is closed.
+     */
+    void write_body(const sstring& content_type, uint64_t content_length, std::function<future<>(output_stream<char>&&)>&& body_writer);
+
     /*!
      * \brief Write a string as the reply
      *
@@ -170,6 +182,8 @@ struct reply {
     future<> write_reply_headers(connection& connection);
 
     std::function<future<>(output_stream<char>&&)> _body_writer;
+    // Set if the body writer writes a body of a known length, unchunked
+    std::experimental::optional<uint64_t> _body_length;
     friend class routes;
     friend class connection;
 };
@@ -353,6 +353,47 @@ posix_data_sink_impl::put(packet p) {
     return _fd->write_all(_p).then([this] { _p.reset(); });
 }
 
+future<>
+posix_data_sink_impl::put(file f, uint64_t offset, uint64_t len) {
+    auto in_fd = f.get_fd();
+    if (in_fd < 0) {
+        return put_buffers(std::move(f), offset, len);
+    }
+    // Bounds the time a syscall thread spends on a single call.
+    static constexpr uint64_t sendfile_chunk = 4 << 20;
+    struct transfer {
+        file f;
+        uint64_t offset;
+        uint64_t len;
+        bool started = false;
+    };
+    return do_with(transfer{std::move(f), offset, len}, [this, in_fd] (transfer& t) {
+        return repeat([this, in_fd, &t] {
+            return _fd->sendfile(in_fd, t.offset, std::min(t.len, sendfile_chunk)).then([&t] (size_t n) {
+                if (!n) {
+                    // The file is shorter than the range we promised to send
+                    throw file::eof_error();
+                }
+                t.started = true;
+                t.offset += n;
+                t.len -= n;
+                return stop_iteration(!t.len);
+            });
+        }).handle_exception([this, &t] (std::exception_ptr ep) {
+            // Files the kernel cannot splice from fail right away; send them
+            // the slow way.
+            try {
+                std::rethrow_exception(ep);
+            } catch (std::system_error& e) {
+                if (!t.started && (e.code().value() == EINVAL || e.code().value() == ENOSYS)) {
+                    return put_buffers(t.f, t.offset, t.len);
+                }
+                throw;
+            }
+        });
+    });
+}
+
 future<>
 posix_data_sink_impl::close() {
     _fd->shutdown(SHUT_WR);
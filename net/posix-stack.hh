@@ -24,6 +24,7 @@
 
 #include "core/reactor.hh"
 #include "core/sharded.hh"
+#include "core/fstream.hh"
 #include "stack.hh"
 #include <boost/program_options.hpp>
 
@@ -109,13 +110,14 @@ class posix_data_source_impl final : public data_source_impl {
     future<> close() override;
 };
 
-class posix_data_sink_impl : public data_sink_impl {
+class posix_data_sink_impl : public file_range_data_sink_impl {
     lw_shared_ptr<pollable_fd> _fd;
     packet _p;
 public:
     explicit posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
+    future<> put(file f, uint64_t offset, uint64_t len) override;
     future<> close() override;
     int get_fd() override;
 };
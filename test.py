@@ -34,6 +34,9 @@ boost_tests = [
     'output_stream_test',
     'httpd',
     'fstream_test',
+    'block_cache_test',
+    'relocatable_region_test',
+    'work_stealing_test',
     'foreign_ptr_test',
     'semaphore_test',
     'expiring_fifo_test',
@@ -103,6 +106,8 @@ if __name__ == "__main__":
             test_to_run.append((os.path.join(prefix, test),'boost'))
         test_to_run.append(('tests/memcached/test.py --mode ' + mode + (' --fast' if args.fast else ''),'other'))
         test_to_run.append((os.path.join(prefix, 'distributed_test') + ' -c 2','other'))
+        # Skips its io_uring test case on kernels that lack it
+        test_to_run.append((os.path.join(prefix, 'fileiotest') + ' -- --reactor-backend io_uring','boost'))
 
 
         allocator_test_path = os.path.join(prefix, 'allocator_test')
@@ -133,8 +138,13 @@ if __name__ == "__main__":
            mode = 'release'
            if test[0].startswith(os.path.join('build','debug')):
               mode = 'debug'
-           xmlout = args.jenkins+"."+mode+"."+os.path.basename(test[0])+".boost.xml"
-           path = path + " --output_format=XML --log_level=all --report_level=no --log_sink=" + xmlout
+           # Boost options go before the seastar ones, which follow '--'
+           binary, _, seastar_args = test[0].partition(' -- ')
+           suffix = re.sub('[^A-Za-z0-9_]+', '.', ' ' + seastar_args) if seastar_args else ''
+           xmlout = args.jenkins+"."+mode+"."+os.path.basename(binary)+suffix+".boost.xml"
+           path = binary + " --output_format=XML --log_level=all --report_level=no --log_sink=" + xmlout
+           if seastar_args:
+              path = path + " -- " + seastar_args
            print(path)
         if os.path.isfile('tmp.out'):
            os.remove('tmp.out')
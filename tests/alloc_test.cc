@@ -22,6 +22,7 @@
 #include "tests/test-utils.hh"
 #include "core/memory.hh"
 #include "core/reactor.hh"
+#include "core/thread.hh"
 #include <vector>
 
 using namespace seastar;
@@ -61,3 +62,49 @@ SEASTAR_TEST_CASE(test_live_objects_counter_with_cross_cpu_free) {
         BOOST_REQUIRE(memory::stats().live_objects() < std::numeric_limits<size_t>::max() / 2);
     });
 }
+
+SEASTAR_TEST_CASE(test_cross_shard_calls_reuse_work_items) {
+    return seastar::async([] {
+        constexpr unsigned nr_calls = 64;
+        auto fan_out = [] {
+            std::vector<future<unsigned>> results;
+            results.reserve(nr_calls);
+            for (unsigned i = 0; i < nr_calls; ++i) {
+                results.push_back(smp::submit_to(1, [i] { return i; }));
+            }
+            for (unsigned i = 0; i < nr_calls; ++i) {
+                BOOST_REQUIRE_EQUAL(results[i].get0(), i);
+            }
+        };
+        fan_out();
+        auto before = memory::stats().mallocs();
+        for (unsigned i = 0; i < 100; ++i) {
+            fan_out();
+        }
+        // Only the vector of results and waiting for them allocate.
+        BOOST_REQUIRE_LT(memory::stats().mallocs() - before, 100u * 4);
+    });
+}
+
+SEASTAR_TEST_CASE(test_continuations_reuse_freed_tasks) {
+    return seastar::async([] {
+        auto chain = [] {
+            promise<int> pr;
+            auto f = pr.get_future().then([] (int x) {
+                return x + 1;
+            }).then([] (int x) {
+                return x * 2;
+            });
+            pr.set_value(1);
+            BOOST_REQUIRE_EQUAL(f.get0(), 4);
+        };
+        chain();
+        auto before = memory::stats().mallocs();
+        for (unsigned i = 0; i < 1000; ++i) {
+            chain();
+        }
+        // The continuations, and the task waking up this thread, are
+        // allocated from the tasks freed by the previous iteration.
+        BOOST_REQUIRE_LT(memory::stats().mallocs() - before, 100u);
+    });
+}
@@ -29,6 +29,8 @@
 #include <cassert>
 #include <memory>
 #include <chrono>
+#include <thread>
+#include <atomic>
 #include <boost/program_options.hpp>
 
 using namespace seastar;
@@ -44,6 +46,225 @@ void test_aligned_allocator() {
     }
 }
 
+template <size_t N>
+void test_size_class_allocation() {
+    std::vector<char*> v;
+    for (unsigned i = 0; i < 1000; ++i) {
+        auto p = static_cast<char*>(memory::allocate_sized(N));
+        std::fill_n(p, N, char(i));
+        v.push_back(p);
+    }
+    for (unsigned i = 0; i < v.size(); ++i) {
+        assert(std::all_of(v[i], v[i] + N, [i] (char c) { return c == char(i); }));
+        // Objects of a compile-time size class may be freed by size or not.
+        if (i % 2) {
+            memory::free_sized(v[i], N);
+        } else {
+            ::operator delete(v[i]);
+        }
+    }
+}
+
+// Allocates and frees objects in patterns which cross the boundaries of
+// the small pool magazines.
+template <size_t N>
+void test_magazine_boundaries() {
+    for (unsigned n : {1, 63, 64, 65, 127, 128, 129, 1000, 10000}) {
+        if (n * N > (8 << 20)) {
+            // stay well within the memory of an unconfigured allocator
+            break;
+        }
+        std::vector<std::unique_ptr<char[]>> v;
+        for (unsigned i = 0; i < n; ++i) {
+            v.emplace_back(new char[N]);
+            std::fill_n(v.back().get(), N, char(i));
+        }
+        for (unsigned i = 0; i < n; i += 2) {
+            v[i].reset();
+        }
+        for (unsigned i = 0; i < n; i += 2) {
+            v[i].reset(new char[N]);
+            std::fill_n(v[i].get(), N, char(i));
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            assert(std::all_of(v[i].get(), v[i].get() + N, [i] (char c) { return c == char(i); }));
+        }
+        // free in reverse order of allocation, too
+        while (!v.empty()) {
+            v.pop_back();
+        }
+    }
+}
+
+template <size_t N>
+void test_magazines_return_memory() {
+    test_magazine_boundaries<N>();
+    auto before = memory::stats();
+    test_magazine_boundaries<N>();
+    // Whatever the magazines cached in the first pass is reused, and all
+    // the other spans were given back.
+    assert(memory::stats().allocated_memory() == before.allocated_memory());
+}
+
+// Objects freed on behalf of another thread reach it in chains of at
+// most the batch size.
+void test_cross_cpu_free_batching() {
+    constexpr unsigned nr_objects = 1000;
+    constexpr unsigned batch_size = 64;
+    std::vector<char*> objects;
+    std::atomic<int> step{0};
+    std::thread owner([&] {
+        for (unsigned i = 0; i < nr_objects; ++i) {
+            objects.push_back(new char[64]);
+        }
+        auto before = memory::stats();
+        step.store(1);
+        while (step.load() != 2) {
+        }
+        memory::drain_cross_cpu_freelist();
+        assert(memory::stats().frees() == before.frees() + nr_objects);
+    });
+    while (step.load() != 1) {
+    }
+    memory::set_cross_cpu_free_batching(batch_size);
+    auto before = memory::stats();
+    for (auto o : objects) {
+        delete[] o;
+    }
+    auto batches = memory::stats().cross_cpu_free_batches() - before.cross_cpu_free_batches();
+    assert(batches == nr_objects / batch_size);
+    assert(memory::flush_cross_cpu_frees());
+    auto after = memory::stats();
+    assert(after.cross_cpu_frees() == before.cross_cpu_frees() + nr_objects);
+    assert(after.cross_cpu_free_batches() == before.cross_cpu_free_batches() + (nr_objects + batch_size - 1) / batch_size);
+    memory::set_cross_cpu_free_batching(0);
+    step.store(2);
+    owner.join();
+}
+
+// Memory is charged to the context it is allocated in, and credited to
+// that context wherever it is freed.
+void test_allocation_contexts() {
+    constexpr unsigned context = memory::max_allocation_contexts - 1;
+    constexpr unsigned other_context = memory::max_allocation_contexts - 2;
+    auto before = memory::get_allocation_context_stats(context);
+    std::vector<std::unique_ptr<char[]>> objects;
+    objects.reserve(101);
+    {
+        memory::scoped_allocation_context ctx(context);
+        for (unsigned i = 0; i < 100; ++i) {
+            objects.emplace_back(new char[1000]);
+        }
+        objects.emplace_back(new char[1 << 20]);
+        auto stats = memory::get_allocation_context_stats(context);
+        assert(stats.allocated_bytes - before.allocated_bytes >= 100 * 1000 + (1 << 20));
+        assert(stats.allocated_bytes - before.allocated_bytes < 100 * 2000 + (1 << 20) + memory::page_size);
+        assert(stats.live_bytes() - before.live_bytes() == int64_t(stats.allocated_bytes - before.allocated_bytes));
+        objects.resize(50);
+        objects.shrink_to_fit();
+    }
+    assert(memory::get_allocation_context() == 0);
+    auto other_before = memory::get_allocation_context_stats(other_context);
+    auto live = memory::get_allocation_context_stats(context).live_bytes() - before.live_bytes();
+    assert(live > 0);
+    {
+        memory::scoped_allocation_context ctx(other_context);
+        objects.clear();
+        objects.shrink_to_fit();
+    }
+    assert(memory::get_allocation_context_stats(other_context).freed_bytes == other_before.freed_bytes);
+    assert(memory::get_allocation_context_stats(context).live_bytes() == before.live_bytes());
+
+    // Freed by another thread, and drained in the default context
+    objects.reserve(100);
+    std::atomic<int> step{0};
+    std::thread owner([&] {
+        auto owner_before = memory::get_allocation_context_stats(context);
+        {
+            memory::scoped_allocation_context ctx(context);
+            for (unsigned i = 0; i < 100; ++i) {
+                objects.emplace_back(new char[1000]);
+            }
+        }
+        step.store(1);
+        while (step.load() != 2) {
+        }
+        memory::drain_cross_cpu_freelist();
+        assert(memory::get_allocation_context_stats(context).live_bytes() == owner_before.live_bytes());
+    });
+    while (step.load() != 1) {
+    }
+    objects.clear();
+    step.store(2);
+    owner.join();
+}
+
+#ifdef SEASTAR_HEAPPROF
+
+// The heap profiler estimates the memory held by a site from the few
+// allocations it samples.
+void test_heap_profile_sampling() {
+    constexpr size_t object_size = 1024;
+    constexpr size_t nr_objects = 8192;
+    memory::set_heap_profiling_sample_period(64 << 10);
+    memory::set_heap_profiling_enabled(true);
+    std::vector<std::unique_ptr<char[]>> objects;
+    objects.reserve(nr_objects);
+    for (size_t i = 0; i < nr_objects; ++i) {
+        objects.emplace_back(new char[object_size]);
+    }
+    memory::set_heap_profiling_enabled(false);
+    auto largest_site = [] {
+        memory::heap_profile_site largest;
+        for (auto& site : memory::get_heap_profile()) {
+            if (site.allocated_bytes > largest.allocated_bytes) {
+                largest = site;
+            }
+        }
+        return largest;
+    };
+    auto site = largest_site();
+    assert(!site.backtrace.empty());
+    assert(site.live_bytes > nr_objects * object_size / 2 && site.live_bytes < nr_objects * object_size * 2);
+    assert(site.live_objects > nr_objects / 2 && site.live_objects < nr_objects * 2);
+    objects.clear();
+    site = largest_site();
+    assert(site.live_bytes == 0);
+    assert(site.allocated_bytes > nr_objects * object_size / 2);
+    memory::set_heap_profiling_sample_period(memory::default_heap_profiling_sample_period);
+}
+
+#endif
+
+template <typename Alloc, typename Free>
+double measure_alloc_free(Alloc alloc, Free free) {
+    constexpr unsigned batch = 100;
+    constexpr unsigned rounds = 20000;
+    void* objects[batch];
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; ++r) {
+        for (auto& o : objects) {
+            o = alloc();
+        }
+        for (auto& o : objects) {
+            free(o);
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (batch * rounds);
+}
+
+// Small allocations of the sizes futures and continuations use, through
+// the runtime and the compile-time size class paths.
+void bench_small_allocations() {
+    volatile size_t size = 64;
+    auto runtime = measure_alloc_free([&] { return ::operator new(size); }, [] (void* p) { ::operator delete(p); });
+    auto constant = measure_alloc_free([] { return memory::allocate_sized(64); }, [] (void* p) { memory::free_sized(p, 64); });
+    std::cout << std::fixed << std::setprecision(1)
+            << "alloc+free of 64 bytes: " << runtime << " ns (runtime size), "
+            << constant << " ns (compile-time size class)\n";
+}
+
 struct allocation {
     size_t n;
     std::unique_ptr<char[]> data;
@@ -87,6 +308,19 @@ int main(int ac, char** av) {
     test_aligned_allocator<1>();
     test_aligned_allocator<4>();
     test_aligned_allocator<80>();
+    test_size_class_allocation<8>();
+    test_size_class_allocation<72>();
+    test_size_class_allocation<1000>();
+    test_size_class_allocation<16384>();
+    test_magazines_return_memory<16>();
+    test_magazines_return_memory<200>();
+    test_magazines_return_memory<5000>();
+    test_cross_cpu_free_batching();
+    test_allocation_contexts();
+#ifdef SEASTAR_HEAPPROF
+    test_heap_profile_sampling();
+#endif
+    bench_small_allocations();
     std::default_random_engine random_engine;
     std::exponential_distribution<> distr(0.2);
     std::uniform_int_distribution<> type(0, 1);
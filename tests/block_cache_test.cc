@@ -0,0 +1,208 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#include "core/block_cache.hh"
+#include "core/fstream.hh"
+#include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/thread.hh"
+#include "core/aligned_buffer.hh"
+#include "test-utils.hh"
+
+using namespace seastar;
+
+static file write_test_file(sstring name, size_t size) {
+    auto f = open_file_dma(name, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto buf = allocate_aligned_buffer<char>(size, 4096);
+    for (size_t i = 0; i < size; ++i) {
+        buf.get()[i] = char(i / 4096 + i);
+    }
+    f.dma_write(0, buf.get(), size).get();
+    return f;
+}
+
+static bool has_pattern(const char* data, uint64_t pos, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        if (data[i] != char((pos + i) / 4096 + pos + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SEASTAR_TEST_CASE(test_block_cache_hits) {
+    return seastar::async([] {
+        block_cache::config cfg;
+        cfg.max_cached_read = 32 << 10;
+        block_cache cache(cfg);
+        auto f = make_cached_file(write_test_file("block_cache.tmp", 64 << 10), cache);
+
+        auto buf = f.dma_read_bulk<char>(4096, 8192).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 8192u);
+        BOOST_REQUIRE(has_pattern(buf.get(), 4096, 8192));
+        BOOST_REQUIRE_EQUAL(cache.misses(), 1u);
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 2u);
+
+        buf = f.dma_read_bulk<char>(4096, 4096).get0();
+        BOOST_REQUIRE(has_pattern(buf.get(), 4096, 4096));
+        buf = f.dma_read_bulk<char>(4096, 8192).get0();
+        BOOST_REQUIRE(has_pattern(buf.get(), 4096, 8192));
+        auto out = allocate_aligned_buffer<char>(4096, 4096);
+        BOOST_REQUIRE_EQUAL(f.dma_read(8192, out.get(), 4096).get0(), 4096u);
+        BOOST_REQUIRE(has_pattern(out.get(), 8192, 4096));
+        BOOST_REQUIRE_EQUAL(cache.hits(), 3u);
+        BOOST_REQUIRE_EQUAL(cache.misses(), 1u);
+
+        // Too large to be cached.
+        f.dma_read_bulk<char>(0, 64 << 10, default_priority_class()).get();
+        BOOST_REQUIRE_EQUAL(cache.misses(), 1u);
+        f.close().get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 0u);
+    });
+}
+
+SEASTAR_TEST_CASE(test_block_cache_writes_invalidate) {
+    return seastar::async([] {
+        block_cache cache;
+        auto f = make_cached_file(write_test_file("block_cache.tmp", 16 << 10), cache);
+
+        auto buf = f.dma_read_bulk<char>(0, 16 << 10).get0();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 4u);
+        auto data = allocate_aligned_buffer<char>(4096, 4096);
+        memset(data.get(), 'x', 4096);
+        f.dma_write(4096, data.get(), 4096).get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 3u);
+
+        buf = f.dma_read_bulk<char>(4096, 4096).get0();
+        BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [] (char c) { return c == 'x'; }));
+
+        f.truncate(8192).get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 2u);
+        buf = f.dma_read_bulk<char>(8192, 4096).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 0u);
+        f.close().get();
+    });
+}
+
+// Closing or truncating a file only drops its own blocks.
+SEASTAR_TEST_CASE(test_block_cache_invalidate_one_file) {
+    return seastar::async([] {
+        block_cache cache;
+        auto f1 = make_cached_file(write_test_file("block_cache.tmp", 16 << 10), cache);
+        auto f2 = make_cached_file(write_test_file("block_cache2.tmp", 16 << 10), cache);
+
+        f1.dma_read_bulk<char>(0, 16 << 10).get();
+        f2.dma_read_bulk<char>(0, 16 << 10).get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 8u);
+
+        f2.truncate(4096).get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 5u);
+        f1.close().get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 1u);
+
+        auto buf = f2.dma_read_bulk<char>(0, 4096).get0();
+        BOOST_REQUIRE(has_pattern(buf.get(), 0, 4096));
+        BOOST_REQUIRE_EQUAL(cache.hits(), 1u);
+        f2.close().get();
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 0u);
+        remove_file("block_cache2.tmp").get();
+    });
+}
+
+// Blocks replaced with larger data still fit in the capacity, and files
+// whose blocks all went away are not remembered.
+SEASTAR_TEST_CASE(test_block_cache_replace_and_forget) {
+    return seastar::async([] {
+        block_cache::config cfg;
+        cfg.capacity = 4 * 4096;
+        block_cache cache(cfg);
+        for (uint64_t file_id = 0; file_id < 4; ++file_id) {
+            cache.insert(file_id, 0, temporary_buffer<uint8_t>(1024));
+        }
+        BOOST_REQUIRE_EQUAL(cache.files(), 4u);
+        for (uint64_t file_id = 0; file_id < 4; ++file_id) {
+            cache.insert(file_id, 0, temporary_buffer<uint8_t>(4096 + 1024));
+            BOOST_REQUIRE_LE(cache.bytes(), cfg.capacity);
+            BOOST_REQUIRE(cache.find(file_id, 0));
+        }
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 3u);
+        BOOST_REQUIRE_EQUAL(cache.files(), 3u);
+
+        // Too large to be cached at all: the stale block goes away
+        cache.insert(3, 0, temporary_buffer<uint8_t>(cfg.capacity + 1));
+        BOOST_REQUIRE(!cache.find(3, 0));
+        BOOST_REQUIRE_EQUAL(cache.files(), 2u);
+
+        cache.invalidate(2, 0, std::numeric_limits<uint64_t>::max());
+        BOOST_REQUIRE_EQUAL(cache.files(), 1u);
+        for (uint64_t file_id = 4; file_id < 100; ++file_id) {
+            cache.insert(file_id, 0, temporary_buffer<uint8_t>(4096));
+        }
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 4u);
+        BOOST_REQUIRE_EQUAL(cache.files(), 4u);
+        BOOST_REQUIRE_LE(cache.bytes(), cfg.capacity);
+    });
+}
+
+SEASTAR_TEST_CASE(test_block_cache_eof) {
+    return seastar::async([] {
+        block_cache cache;
+        auto f = make_cached_file(write_test_file("block_cache.tmp", 8192), cache);
+        f.truncate(8192 + 100).get();
+
+        auto buf = f.dma_read_bulk<char>(4096, 8192).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 4096u + 100);
+        buf = f.dma_read_bulk<char>(8192, 4096).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 100u);
+        BOOST_REQUIRE_EQUAL(cache.misses(), 1u);
+
+        // Growing the file drops its stale last block.
+        auto data = allocate_aligned_buffer<char>(4096, 4096);
+        memset(data.get(), 'y', 4096);
+        f.dma_write(12288, data.get(), 4096).get();
+        buf = f.dma_read_bulk<char>(8192, 4096).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), 4096u);
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_block_cache_eviction) {
+    return seastar::async([] {
+        block_cache::config cfg;
+        cfg.capacity = 4 * 4096;
+        block_cache cache(cfg);
+        auto f = make_cached_file(write_test_file("block_cache.tmp", 64 << 10), cache);
+
+        for (uint64_t pos = 0; pos < (64 << 10); pos += 4096) {
+            auto buf = f.dma_read_bulk<char>(pos, 4096).get0();
+            BOOST_REQUIRE(has_pattern(buf.get(), pos, 4096));
+            BOOST_REQUIRE_LE(cache.bytes(), cfg.capacity);
+        }
+        BOOST_REQUIRE_EQUAL(cache.blocks(), 4u);
+
+        // The referenced blocks survive a pass of the clock.
+        f.dma_read_bulk<char>(60 << 10, 4096).get();
+        f.dma_read_bulk<char>(0, 4096).get();
+        f.dma_read_bulk<char>(60 << 10, 4096).get();
+        BOOST_REQUIRE_EQUAL(cache.hits(), 2u);
+        f.close().get();
+    });
+}
@@ -24,6 +24,9 @@
 #include "core/semaphore.hh"
 #include "core/file.hh"
 #include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/thread.hh"
+#include "core/aligned_buffer.hh"
 
 using namespace seastar;
 
@@ -70,4 +73,38 @@ SEASTAR_TEST_CASE(test1) {
     });
 }
 
+// Runs the file operations the io_uring backend submits on its ring. test.py
+// runs this test with --reactor-backend io_uring, which falls back to epoll
+// on kernels without io_uring; the test is skipped then.
+SEASTAR_TEST_CASE(test_io_uring_file_io) {
+    return seastar::async([] {
+#ifdef HAVE_IO_URING
+        auto uring = engine().uring_file_io();
+#else
+        auto uring = false;
+#endif
+        if (!uring) {
+            std::cout << "io_uring file I/O is not in use, skipping\n";
+            return;
+        }
+        auto f = open_file_dma("uringtest.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = allocate_aligned_buffer<char>(8192, 4096);
+        std::fill(wbuf.get(), wbuf.get() + 4096, 'a');
+        std::fill(wbuf.get() + 4096, wbuf.get() + 8192, 'b');
+        BOOST_REQUIRE_EQUAL(f.dma_write(0, wbuf.get(), 8192).get0(), 8192u);
+        f.flush().get();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), 8192u);
+
+        auto rbuf = allocate_aligned_buffer<char>(4096, 4096);
+        BOOST_REQUIRE_EQUAL(f.dma_read(4096, rbuf.get(), 4096).get0(), 4096u);
+        BOOST_REQUIRE(std::equal(rbuf.get(), rbuf.get() + 4096, wbuf.get() + 4096));
+        // Short read at the end of the file
+        BOOST_REQUIRE_EQUAL(f.dma_read(8192, rbuf.get(), 4096).get0(), 0u);
 
+        f.allocate(0, 16384).get();
+        f.truncate(4096).get();
+        BOOST_REQUIRE_EQUAL(f.stat().get0().st_size, 4096);
+        f.close().get();
+        remove_file("uringtest.tmp").get();
+    });
+}
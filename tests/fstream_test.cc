@@ -30,6 +30,7 @@
 #include "core/seastar.hh"
 #include "test-utils.hh"
 #include "core/thread.hh"
+#include "core/aligned_buffer.hh"
 #include "util/defer.hh"
 #include <random>
 #include <boost/range/adaptor/transformed.hpp>
@@ -425,3 +426,233 @@ SEASTAR_TEST_CASE(test_fstream_slow_start) {
         read_while_file_at_full_speed(make_fstream());
     });
 }
+
+SEASTAR_TEST_CASE(test_fstream_strided_read_ahead) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 64 * 1024 * 1024;
+        static constexpr size_t buffer_size = 64 * 1024;
+        static constexpr size_t stride_read = buffer_size;
+        static constexpr size_t stride_skip = 3 * buffer_size;
+
+        auto mock_file = make_shared<mock_read_only_file>(file_size);
+        mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+
+        auto history = make_lw_shared<file_input_stream_history>();
+        file_input_stream_options options{};
+        options.buffer_size = buffer_size;
+        options.dynamic_adjustments = history;
+        options.max_read_ahead_bytes = 1024 * 1024;
+
+        auto in = make_file_input_stream(file(mock_file), 0, file_size, options);
+        uint64_t wasted = 0;
+        for (unsigned i = 0; i < 128; ++i) {
+            size_t consumed = 0;
+            while (consumed < stride_read) {
+                auto buf = in.read_up_to(stride_read - consumed).get0();
+                BOOST_REQUIRE(buf.size());
+                consumed += buf.size();
+            }
+            in.skip(stride_skip).get();
+            if (i == 64) {
+                BOOST_REQUIRE(history->access_pattern() == file_access_pattern::strided);
+                wasted = history->wasted_read_ahead_bytes();
+            }
+        }
+        // Once the stride is known, only the bytes consumed are read.
+        BOOST_REQUIRE_EQUAL(history->wasted_read_ahead_bytes(), wasted);
+        in.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_access_pattern) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 8 * 1024 * 1024;
+        static constexpr size_t chunk_size = 1024 * 1024;
+
+        auto mock_file = make_shared<mock_read_only_file>(file_size);
+        mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+
+        auto history = make_lw_shared<file_input_stream_history>();
+        file_input_stream_options options{};
+        options.buffer_size = 128 * 1024;
+        options.dynamic_adjustments = history;
+        options.max_read_ahead_bytes = 1024 * 1024;
+
+        auto read_chunk = [&] (uint64_t offset) {
+            auto in = make_file_input_stream(file(mock_file), offset, chunk_size, options);
+            auto pattern = history->access_pattern();
+            BOOST_REQUIRE_EQUAL(history->concurrent_streams(), 1u);
+            uint64_t total = 0;
+            while (auto buf = in.read().get0()) {
+                total += buf.size();
+            }
+            BOOST_REQUIRE_EQUAL(total, chunk_size);
+            in.close().get();
+            return pattern;
+        };
+
+        BOOST_REQUIRE(read_chunk(chunk_size) == file_access_pattern::unknown);
+        BOOST_REQUIRE(read_chunk(2 * chunk_size) == file_access_pattern::sequential);
+        BOOST_REQUIRE(read_chunk(0) == file_access_pattern::backward);
+        BOOST_REQUIRE(read_chunk(3 * chunk_size + 4096) == file_access_pattern::random);
+        BOOST_REQUIRE_EQUAL(history->concurrent_streams(), 0u);
+        BOOST_REQUIRE_EQUAL(history->total_read_bytes(), 4 * chunk_size);
+    });
+}
+
+// The read-ahead budget is left alone while the device keeps up. Once reads queue up in
+// the device, it follows the bandwidth-delay product measured before, and queueing more
+// reads does not grow it.
+SEASTAR_TEST_CASE(test_fstream_read_ahead_budget) {
+    using namespace std::chrono_literals;
+    using clock = std::chrono::steady_clock;
+    static constexpr uint64_t max_bytes = 64 * 1024 * 1024;
+    static constexpr uint64_t read_size = 128 * 1024;
+
+    // Rounds of depth reads issued together, which the device completes after latency.
+    auto feed = [] (file_input_stream_history& h, clock::time_point& now, unsigned depth, clock::duration latency, unsigned rounds) {
+        for (unsigned r = 0; r < rounds; ++r) {
+            for (unsigned i = 0; i < depth; ++i) {
+                h.read_issued(now);
+            }
+            auto issued = now;
+            now += latency;
+            for (unsigned i = 0; i < depth; ++i) {
+                h.read_completed(issued, now, read_size);
+            }
+        }
+    };
+    auto near = [] (uint64_t value, uint64_t expected) {
+        return value >= expected * 99 / 100 && value <= expected * 101 / 100;
+    };
+
+    // 128KB per millisecond, one read at a time
+    file_input_stream_history slow;
+    auto now = clock::now();
+    feed(slow, now, 1, 1ms, 128);
+    BOOST_REQUIRE(near(slow.bandwidth_delay_product(), read_size));
+    BOOST_REQUIRE_EQUAL(slow.read_ahead_budget(max_bytes), max_bytes);
+
+    // Four times the reads in flight only make them take four times longer.
+    feed(slow, now, 4, 4ms, 8);
+    auto saturated_budget = slow.read_ahead_budget(max_bytes);
+    BOOST_REQUIRE(near(saturated_budget, read_size * 5 / 4));
+    feed(slow, now, 8, 8ms, 16);
+    BOOST_REQUIRE(slow.read_ahead_budget(max_bytes) <= saturated_budget * 101 / 100);
+
+    // A device completing two reads per millisecond keeps twice as many bytes in flight.
+    file_input_stream_history fast;
+    feed(fast, now, 2, 1ms, 64);
+    BOOST_REQUIRE(near(fast.bandwidth_delay_product(), 2 * read_size));
+    BOOST_REQUIRE_EQUAL(fast.read_ahead_budget(max_bytes), max_bytes);
+    feed(fast, now, 8, 4ms, 4);
+    BOOST_REQUIRE(near(fast.read_ahead_budget(max_bytes), 2 * saturated_budget));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_file_appender) {
+    return seastar::async([] {
+        static constexpr unsigned producers = 8;
+        static constexpr unsigned records = 500;
+        auto record = [] (unsigned p, unsigned i) {
+            return sprint("%d:%d;", p, i);
+        };
+
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto head = allocate_aligned_buffer<char>(4096, 4096);
+        std::fill_n(head.get(), 4096, 0);
+        std::copy_n("head", 4, head.get());
+        f.dma_write(0, head.get(), 4096).get();
+        f.truncate(4).get();
+        file_appender_options options;
+        options.buffer_size = 16 * 1024;
+        options.preallocation_size = 64 * 1024;
+        auto app = make_file_appender(std::move(f), options).get0();
+        BOOST_REQUIRE_EQUAL(app.size(), 4u);
+
+        std::vector<std::pair<uint64_t, sstring>> appended;
+        unsigned sync_calls = 0;
+        parallel_for_each(boost::irange(0u, producers), [&] (unsigned p) {
+            auto range = boost::irange(0u, records);
+            return do_for_each(range.begin(), range.end(), [&, p] (unsigned i) {
+                auto r = record(p, i);
+                return app.append(r.data(), r.size()).then([&, r, i] (uint64_t pos) {
+                    appended.emplace_back(pos, r);
+                    if (i % 50 == 49) {
+                        ++sync_calls;
+                        return app.sync();
+                    }
+                    return make_ready_future<>();
+                });
+            });
+        }).get();
+        BOOST_REQUIRE_LT(app.syncs(), sync_calls);
+        BOOST_REQUIRE_LT(app.writes(), app.syncs() + app.size() / options.buffer_size + 1);
+        auto size = app.size();
+        app.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), size);
+        auto in = make_file_input_stream(f);
+        sstring contents;
+        while (auto buf = in.read().get0()) {
+            contents += sstring(buf.get(), buf.size());
+        }
+        in.close().get();
+        BOOST_REQUIRE_EQUAL(contents.size(), size);
+        BOOST_REQUIRE(contents.substr(0, 4) == "head");
+        for (auto& a : appended) {
+            BOOST_REQUIRE(contents.substr(a.first, a.second.size()) == a.second);
+        }
+
+        // Appending to the unaligned end of an existing file
+        f = open_file_dma("testfile.tmp", open_flags::rw).get0();
+        app = make_file_appender(std::move(f), options).get0();
+        BOOST_REQUIRE_EQUAL(app.append("tail", 4).get0(), size);
+        app.sync().get();
+        app.close().get();
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), size + 4);
+        auto buf = f.dma_read_exactly<char>(0, size + 4).get0();
+        BOOST_REQUIRE(sstring(buf.get(), buf.size()) == contents + "tail");
+        f.close().get();
+
+        // Closing right after a write which preallocates
+        f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::truncate).get0();
+        app = make_file_appender(std::move(f), options).get0();
+        sstring block(options.buffer_size, 'x');
+        app.append(block.data(), block.size()).get();
+        app.close().get();
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), block.size());
+        f.close().get();
+    });
+}
+
+// A write fails while the others are in flight: close() reports the error,
+// but only closes the file once all of them have completed.
+SEASTAR_TEST_CASE(test_file_appender_write_failure) {
+    using namespace std::chrono_literals;
+    return seastar::async([] {
+        file_appender_options options;
+        options.buffer_size = 4096;
+        options.write_behind = 4;
+        options.preallocation_size = 0;
+        auto mock = make_shared<mock_failing_write_file>(4096);
+        auto app = make_file_appender(file(mock), options).get0();
+        sstring block(options.buffer_size, 'x');
+        std::vector<future<uint64_t>> appended;
+        for (unsigned i = 0; i < 4; ++i) {
+            appended.push_back(app.append(block.data(), block.size()));
+        }
+        // The first two writes are done, the second one failed, and the
+        // error is recorded before the last two writes complete.
+        sleep(5ms).get();
+        BOOST_REQUIRE_THROW(app.sync().get(), std::runtime_error);
+        BOOST_REQUIRE_EQUAL(mock->writes_in_flight(), 2u);
+        BOOST_REQUIRE_THROW(app.close().get(), std::runtime_error);
+        BOOST_REQUIRE(mock->closed());
+        BOOST_REQUIRE_EQUAL(mock->writes_in_flight(), 0u);
+        when_all(appended.begin(), appended.end()).get();
+    });
+}
@@ -29,6 +29,11 @@
 #include "core/thread.hh"
 #include <boost/iterator/counting_iterator.hpp>
 
+#ifdef SEASTAR_COROUTINES_ENABLED
+#include "core/coroutine.hh"
+#include "core/memory.hh"
+#endif
+
 using namespace seastar;
 using namespace std::chrono_literals;
 
@@ -906,3 +911,98 @@ SEASTAR_TEST_CASE(test_when_all_succeed_vector) {
         BOOST_REQUIRE(ret);
     });
 }
+
+#ifdef SEASTAR_COROUTINES_ENABLED
+
+static future<int> add_later(int a, int b) {
+    co_await later();
+    co_return a + b;
+}
+
+static future<> fail_later() {
+    co_await later();
+    throw expected_exception();
+}
+
+static future<int, sstring> two_values() {
+    co_return std::make_tuple(1, sstring("one"));
+}
+
+SEASTAR_TEST_CASE(test_coroutines) {
+    return [] () -> future<> {
+        BOOST_REQUIRE_EQUAL(co_await add_later(1, 2), 3);
+        BOOST_REQUIRE_EQUAL(co_await make_ready_future<int>(42), 42);
+        BOOST_REQUIRE_THROW(co_await fail_later(), expected_exception);
+        BOOST_REQUIRE_THROW(co_await make_exception_future<>(expected_exception()), expected_exception);
+        auto values = co_await two_values();
+        BOOST_REQUIRE_EQUAL(std::get<0>(values), 1);
+        BOOST_REQUIRE_EQUAL(std::get<1>(values), "one");
+
+        promise<sstring> pr;
+        auto f = pr.get_future();
+        (void)later().then([&pr] {
+            pr.set_value("later");
+        });
+        BOOST_REQUIRE_EQUAL(co_await std::move(f), "later");
+    }();
+}
+
+// Runs \c n steps of a loop written with continuations and as a
+// coroutine, and compares their time and allocations per step.
+template <typename Continuations, typename Coroutine>
+static future<> compare_awaits(const char* name, unsigned n, Continuations continuations, Coroutine coroutine) {
+    struct result {
+        double ns;
+        double mallocs;
+    };
+    auto measure = [n] (auto loop) -> future<result> {
+        co_await loop(n / 10);
+        auto mallocs = memory::stats().mallocs();
+        auto start = std::chrono::steady_clock::now();
+        co_await loop(n);
+        auto end = std::chrono::steady_clock::now();
+        co_return result{std::chrono::duration<double, std::nano>(end - start).count() / n,
+                double(memory::stats().mallocs() - mallocs) / n};
+    };
+    auto cont = co_await measure(continuations);
+    auto coro = co_await measure(coroutine);
+    BOOST_TEST_MESSAGE(sprint("%s: continuations %.1f ns, %.3f mallocs; coroutine %.1f ns, %.3f mallocs per step",
+            name, cont.ns, cont.mallocs, coro.ns, coro.mallocs));
+    // A coroutine allocates its frame once, not per step.
+    BOOST_REQUIRE_LT(coro.mallocs, 0.01);
+}
+
+SEASTAR_TEST_CASE(test_coroutine_await_ready_cost) {
+    return compare_awaits("ready", 1000000, [] (unsigned n) {
+        return do_with(0u, [n] (unsigned& i) {
+            return do_until([n, &i] { return i == n; }, [&i] {
+                return make_ready_future<unsigned>(1).then([&i] (unsigned x) {
+                    i += x;
+                });
+            });
+        });
+    }, [] (unsigned n) -> future<> {
+        unsigned i = 0;
+        while (i != n) {
+            i += co_await make_ready_future<unsigned>(1);
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_coroutine_await_suspended_cost) {
+    return compare_awaits("suspended", 100000, [] (unsigned n) {
+        return do_with(0u, [n] (unsigned& i) {
+            return do_until([n, &i] { return i == n; }, [&i] {
+                return later().then([&i] {
+                    ++i;
+                });
+            });
+        });
+    }, [] (unsigned n) -> future<> {
+        for (unsigned i = 0; i != n; ++i) {
+            co_await later();
+        }
+    });
+}
+
+#endif
@@ -10,11 +10,13 @@
 #include "http/routes.hh"
 #include "http/exception.hh"
 #include "http/transformers.hh"
+#include "http/file_handler.hh"
 #include "core/future-util.hh"
 #include "tests/test-utils.hh"
 #include "loopback_socket.hh"
 #include <boost/algorithm/string.hpp>
 #include "core/thread.hh"
+#include "core/fstream.hh"
 
 using namespace seastar;
 using namespace httpd;
@@ -394,3 +396,44 @@ SEASTAR_TEST_CASE(test_http_client_server_full) {
     return test_client_server::run(tests);
 }
 
+SEASTAR_TEST_CASE(test_file_handler_content_length) {
+    return seastar::async([] {
+        sstring contents(100000, 'x');
+        for (unsigned i = 0; i < contents.size(); ++i) {
+            contents[i] = 'a' + i % 26;
+        }
+        auto f = open_file_dma("file_handler.tmp", open_flags::wo | open_flags::create | open_flags::truncate).get0();
+        auto out = make_file_output_stream(std::move(f));
+        out.write(contents).get();
+        out.close().get();
+
+        loopback_connection_factory lcf;
+        http_server server("test");
+        httpd::http_server_tester::listeners(server).emplace_back(lcf.get_server_socket());
+        server._routes.put(GET, "/test", new file_handler("file_handler.tmp", nullptr, false));
+        auto accepts = server.do_accepts(0);
+
+        loopback_socket_impl lsi(lcf);
+        connected_socket c_socket = std::get<connected_socket>(lsi.connect(socket_address(ipv4_addr()), socket_address(ipv4_addr())).get());
+        input_stream<char> input(c_socket.input());
+        output_stream<char> output(c_socket.output());
+        test_client_server::write_request(output).get();
+        sstring res;
+        size_t header_end = sstring::npos;
+        while (header_end == sstring::npos || res.size() < header_end + 4 + contents.size()) {
+            auto buf = input.read().get0();
+            BOOST_REQUIRE(!buf.empty());
+            res += sstring(buf.get(), buf.size());
+            header_end = res.find("\r\n\r\n");
+        }
+        auto headers = res.substr(0, header_end);
+        BOOST_REQUIRE(headers.find("Content-Length: " + to_sstring(contents.size())) != sstring::npos);
+        BOOST_REQUIRE(headers.find("Transfer-Encoding") == sstring::npos);
+        BOOST_REQUIRE(res.substr(header_end + 4) == contents);
+
+        output.close().get();
+        input.close().get();
+        server.stop().get();
+        accepts.ignore_ready_future();
+    });
+}
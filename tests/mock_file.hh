@@ -25,6 +25,7 @@
 
 #include "test-utils.hh"
 #include "core/file.hh"
+#include "core/sleep.hh"
 
 namespace seastar {
 
@@ -110,4 +111,81 @@ class mock_read_only_file final : public file_impl {
     }
 };
 
+// Discards the data written to it. The write at a given position fails at
+// once, while the others take longer the further they are into the file, so
+// that later ones are still in flight when the error is reported.
+class mock_failing_write_file final : public file_impl {
+    bool _closed = false;
+    uint64_t _size = 0;
+    uint64_t _fail_pos;
+    unsigned _writes_in_flight = 0;
+public:
+    explicit mock_failing_write_file(uint64_t fail_pos) noexcept
+        : _fail_pos(fail_pos)
+    { }
+
+    bool closed() const {
+        return _closed;
+    }
+    unsigned writes_in_flight() const {
+        return _writes_in_flight;
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void*, size_t len, const io_priority_class&) override {
+        using namespace std::chrono_literals;
+        BOOST_CHECK(!_closed);
+        ++_writes_in_flight;
+        auto delay = pos == _fail_pos ? 0ms : std::chrono::milliseconds(pos / 4096 * 10);
+        return sleep(delay).then([this, pos, len] {
+            if (pos == _fail_pos) {
+                throw std::runtime_error("mock write failure");
+            }
+            _size = std::max(_size, pos + len);
+            return len;
+        }).finally([this] {
+            --_writes_in_flight;
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t, std::vector<iovec>, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<size_t> read_dma(uint64_t, void*, size_t, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<size_t> read_dma(uint64_t, std::vector<iovec>, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<> flush() override {
+        return make_ready_future<>();
+    }
+    virtual future<struct stat> stat() override {
+        throw std::bad_function_call();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        _size = length;
+        return make_ready_future<>();
+    }
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        throw std::bad_function_call();
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return make_ready_future<>();
+    }
+    virtual future<uint64_t> size() override {
+        return make_ready_future<uint64_t>(_size);
+    }
+    virtual future<> close() override {
+        BOOST_CHECK(!_closed);
+        BOOST_CHECK_EQUAL(_writes_in_flight, 0u);
+        _closed = true;
+        return make_ready_future<>();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)>) override {
+        throw std::bad_function_call();
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t, size_t, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+};
+
 }
@@ -23,10 +23,14 @@
 #include "core/shared_ptr.hh"
 #include "core/reactor.hh"
 #include "core/vector-data-sink.hh"
+#include "core/fstream.hh"
 #include "core/future-util.hh"
 #include "core/sstring.hh"
+#include "core/thread.hh"
+#include "core/aligned_buffer.hh"
 #include "net/packet.hh"
 #include "test-utils.hh"
+#include <random>
 #include <vector>
 
 using namespace seastar;
@@ -129,3 +133,102 @@ SEASTAR_TEST_CASE(test_flush_on_empty_buffer_does_not_push_empty_packet_down_str
         return out->close();
     }).finally([out]{});
 }
+
+static std::pair<file, sstring> make_test_file(size_t size) {
+    auto f = open_file_dma("output_stream_test.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+    auto buf = allocate_aligned_buffer<char>(align_up(size, size_t(4096)), 4096);
+    sstring contents(sstring::initialized_later(), size);
+    for (size_t i = 0; i < size; ++i) {
+        contents[i] = buf.get()[i] = 'a' + i % 23;
+    }
+    f.dma_write(0, buf.get(), align_up(size, size_t(4096))).get();
+    f.truncate(size).get();
+    return {std::move(f), std::move(contents)};
+}
+
+SEASTAR_TEST_CASE(test_write_file_range) {
+    return seastar::async([] {
+        file f;
+        sstring contents;
+        std::tie(f, contents) = make_test_file(64 * 1024 + 100);
+        std::vector<packet> v;
+        output_stream<char> out(data_sink(std::make_unique<vector_data_sink>(v)), 8);
+        out.write("head").get();
+        write_file(out, f, 4096 + 10, 50000).get();
+        write_file(out, f, 60000, contents.size() - 60000).get();
+        out.write("tail").get();
+        out.close().get();
+        sstring res;
+        for (auto& p : v) {
+            res += to_sstring(p);
+        }
+        BOOST_REQUIRE(res == "head" + contents.substr(4096 + 10, 50000) + contents.substr(60000) + "tail");
+
+        // The range must not go past the end of the file.
+        std::vector<packet> v2;
+        output_stream<char> out2(data_sink(std::make_unique<vector_data_sink>(v2)), 8);
+        BOOST_REQUIRE_THROW(write_file(out2, f, 60000, 100000).get(), file::eof_error);
+        out2.close().get();
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_write_file_to_socket) {
+    return seastar::async([] {
+        file f;
+        sstring contents;
+        static constexpr size_t file_size = 8 * 1024 * 1024 + 123;
+        std::tie(f, contents) = make_test_file(file_size);
+
+        std::random_device rnd;
+        auto distr = std::uniform_int_distribution<uint16_t>(12000, 65000);
+        auto sa = make_ipv4_address({"127.0.0.1", distr(rnd)});
+        auto listener = engine().net().listen(sa, listen_options());
+        auto accepted = listener.accept();
+        auto client = engine().net().connect(sa).get0();
+        auto server = std::get<0>(accepted.get());
+
+        auto out = server.output();
+        auto sent = out.write("head").then([&] {
+            return write_file(out, f, 1, file_size - 1);
+        }).then([&] {
+            return out.close();
+        });
+        auto in = client.input();
+        sstring res;
+        while (auto buf = in.read().get0()) {
+            res += sstring(buf.get(), buf.size());
+        }
+        sent.get();
+        BOOST_REQUIRE_EQUAL(res.size(), file_size + 3);
+        BOOST_REQUIRE(res == "head" + contents.substr(1));
+        f.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_write_short_file_to_socket) {
+    return seastar::async([] {
+        file f;
+        sstring contents;
+        std::tie(f, contents) = make_test_file(10000);
+
+        std::random_device rnd;
+        auto distr = std::uniform_int_distribution<uint16_t>(12000, 65000);
+        auto sa = make_ipv4_address({"127.0.0.1", distr(rnd)});
+        auto listener = engine().net().listen(sa, listen_options());
+        auto accepted = listener.accept();
+        auto client = engine().net().connect(sa).get0();
+        auto server = std::get<0>(accepted.get());
+
+        auto out = server.output();
+        BOOST_REQUIRE_THROW(write_file(out, f, 0, 20000).get(), file::eof_error);
+        out.close().get();
+        auto in = client.input();
+        sstring res;
+        while (auto buf = in.read().get0()) {
+            res += sstring(buf.get(), buf.size());
+        }
+        BOOST_REQUIRE(res == contents);
+        f.close().get();
+    });
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#include "core/relocatable_region.hh"
+#include "core/memory.hh"
+#include "core/thread.hh"
+#include "test-utils.hh"
+#include <cstring>
+#include <vector>
+
+using namespace seastar;
+
+static void fill(relocatable_handle& h, unsigned seed) {
+    auto p = static_cast<char*>(h.get());
+    for (size_t i = 0; i < h.size(); ++i) {
+        p[i] = char(seed + i);
+    }
+}
+
+static bool has_pattern(const relocatable_handle& h, unsigned seed) {
+    auto p = static_cast<const char*>(h.get());
+    for (size_t i = 0; i < h.size(); ++i) {
+        if (p[i] != char(seed + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SEASTAR_TEST_CASE(test_relocatable_region_compaction) {
+    return seastar::async([] {
+        relocatable_region region(16 << 10);
+        std::vector<relocatable_handle> objects;
+        for (unsigned i = 0; i < 1000; ++i) {
+            auto h = region.allocate(100 + i % 200);
+            fill(h, i);
+            objects.push_back(std::move(h));
+        }
+        auto used = region.used_memory();
+        auto total = region.total_memory();
+        BOOST_REQUIRE_GE(total, used);
+
+        for (unsigned i = 0; i < objects.size(); i += 2) {
+            objects[i] = relocatable_handle();
+        }
+        BOOST_REQUIRE_LT(region.used_memory(), used);
+        BOOST_REQUIRE_EQUAL(region.total_memory(), total);
+
+        {
+            relocatable_region::compaction_lock lock(region);
+            BOOST_REQUIRE_EQUAL(region.compact(), 0u);
+            BOOST_REQUIRE_EQUAL(region.compactions(), 0u);
+        }
+
+        auto released = region.compact();
+        BOOST_REQUIRE_GT(released, 0u);
+        BOOST_REQUIRE_EQUAL(region.total_memory(), total - released);
+        BOOST_REQUIRE_GT(region.compactions(), 0u);
+        BOOST_REQUIRE_GT(region.moved_bytes(), 0u);
+        for (unsigned i = 1; i < objects.size(); i += 2) {
+            BOOST_REQUIRE_EQUAL(objects[i].size(), 100 + i % 200);
+            BOOST_REQUIRE(has_pattern(objects[i], i));
+        }
+
+        objects.clear();
+        BOOST_REQUIRE_EQUAL(region.used_memory(), 0u);
+        BOOST_REQUIRE_LE(region.total_memory(), size_t(16 << 10));
+    });
+}
+
+SEASTAR_TEST_CASE(test_relocatable_region_limits) {
+    return seastar::async([] {
+        relocatable_region region(memory::page_size);
+        BOOST_REQUIRE_THROW(region.allocate(region.max_object_size() + 1), std::invalid_argument);
+        auto h = region.allocate(region.max_object_size());
+        fill(h, 7);
+        auto h2 = std::move(h);
+        BOOST_REQUIRE(!h);
+        BOOST_REQUIRE(has_pattern(h2, 7));
+        BOOST_REQUIRE_EQUAL(region.total_memory(), memory::page_size);
+    });
+}
+
+SEASTAR_TEST_CASE(test_fragmentation_metrics) {
+    auto free = memory::stats().free_memory();
+    size_t in_classes = 0;
+    for (unsigned i = 0; i < memory::nr_span_classes; ++i) {
+        in_classes += memory::free_memory_in_span_class(i);
+    }
+    BOOST_REQUIRE_EQUAL(in_classes, free);
+    BOOST_REQUIRE_GT(memory::largest_free_span(), 0u);
+    BOOST_REQUIRE_LE(memory::largest_free_span(), free);
+    return make_ready_future<>();
+}
@@ -22,6 +22,12 @@
 #include "core/reactor.hh"
 #include "core/app-template.hh"
 #include "core/print.hh"
+#include "core/future-util.hh"
+#include "core/sleep.hh"
+#include <boost/range/irange.hpp>
+#include <boost/iterator/counting_iterator.hpp>
+#include <numeric>
+#include <vector>
 
 using namespace seastar;
 
@@ -57,6 +63,84 @@ future<bool> test_smp_exception() {
     });
 }
 
+// Sends bursts of messages from this shard to every shard and checks that
+// each one is delivered.  The idle gaps between bursts let the target
+// shards go to sleep, so the bursts also exercise the doorbell wakeups and
+// poll window adaptation.
+static future<bool> flood_from_this_shard() {
+    using namespace std::chrono_literals;
+    static constexpr unsigned rounds = 20;
+    static constexpr unsigned burst = 1000;
+    return do_with(0u, [] (unsigned& delivered) {
+        return do_for_each(boost::make_counting_iterator(0u), boost::make_counting_iterator(rounds), [&delivered] (unsigned) {
+            return parallel_for_each(boost::irange(0u, burst * smp::count), [&delivered] (unsigned i) {
+                return smp::submit_to(i % smp::count, [i] {
+                    return i;
+                }).then([&delivered, i] (unsigned ret) {
+                    delivered += ret == i;
+                });
+            }).then([] {
+                return sleep(1ms);
+            });
+        }).then([&delivered] {
+            return delivered == rounds * burst * smp::count;
+        });
+    });
+}
+
+future<bool> test_smp_flood() {
+    return do_with(true, [] (bool& ok) {
+        return parallel_for_each(boost::irange(0u, smp::count), [&ok] (unsigned shard) {
+            return smp::submit_to(shard, flood_from_this_shard).then([&ok] (bool delivered) {
+                ok &= delivered;
+            });
+        }).then([&ok] {
+            return ok;
+        });
+    });
+}
+
+// nearest_shard() on a synthetic topology of two nodes, 0-3 and 4-7
+future<bool> test_nearest_shard() {
+    auto node = [] (unsigned t) { return t / 4; };
+    auto nearest = [node] (std::vector<unsigned> shards, unsigned me) {
+        return smp::nearest_shard(shards, me, node);
+    };
+    bool ok = true;
+    // This shard, when it is one of them
+    ok &= nearest({5, 1, 6}, 1) == 1;
+    // Otherwise one on the same node
+    ok &= nearest({5, 1, 6}, 2) == 1;
+    ok &= nearest({1, 5}, 6) == 5;
+    // spreading the shards of the node over the local candidates
+    ok &= nearest({0, 1, 4}, 2) == 0;
+    ok &= nearest({0, 1, 4}, 3) == 1;
+    // Otherwise the first one
+    ok &= nearest({5, 6}, 2) == 5;
+    ok &= nearest({1, 2}, 7) == 1;
+    return make_ready_future<bool>(ok);
+}
+
+// With a single NUMA node, all candidates are local, and the shards are
+// spread over them.
+future<bool> test_nearest_shard_one_node() {
+    auto node = [] (unsigned) { return 0u; };
+    std::vector<unsigned> shards{4, 5, 6};
+    std::vector<unsigned> picked;
+    for (unsigned me = 0; me < 4; ++me) {
+        picked.push_back(smp::nearest_shard(shards, me, node));
+    }
+    auto ok = picked == std::vector<unsigned>{4, 5, 6, 4};
+    // The real topology: whichever shard runs the function is one of those asked for
+    std::vector<unsigned> all(smp::count);
+    std::iota(all.begin(), all.end(), 0);
+    return smp::submit_to_nearest(all, [] {
+        return engine().cpu_id();
+    }).then([ok] (unsigned shard) {
+        return ok && shard == engine().cpu_id();
+    });
+}
+
 int tests, fails;
 
 future<>
@@ -72,6 +156,12 @@ int main(int ac, char** av) {
     return app_template().run_deprecated(ac, av, [] {
        return report("smp call", test_smp_call()).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("smp flood", test_smp_flood());
+       }).then([] {
+           return report("nearest shard", test_nearest_shard());
+       }).then([] {
+           return report("nearest shard, one node", test_nearest_shard_one_node());
        }).then([] {
            print("\n%d tests / %d failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
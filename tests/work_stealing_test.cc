@@ -0,0 +1,66 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2026 ScyllaDB
+ */
+
+#include "core/work_stealing.hh"
+#include "core/reactor.hh"
+#include "core/thread.hh"
+#include "core/future-util.hh"
+#include "test-utils.hh"
+
+using namespace seastar;
+
+SEASTAR_TEST_CASE(test_stealable_results) {
+    return seastar::async([] {
+        BOOST_REQUIRE_EQUAL(submit_stealable([] { return 42; }).get0(), 42);
+        submit_stealable([] {}).get();
+        auto s = submit_stealable([] { return sstring(100, 'x'); }).get0();
+        BOOST_REQUIRE_EQUAL(s, sstring(100, 'x'));
+        BOOST_REQUIRE_THROW(submit_stealable([] () -> int { throw std::runtime_error("boom"); }).get(), std::runtime_error);
+    });
+}
+
+SEASTAR_TEST_CASE(test_idle_shards_steal) {
+    if (smp::count < 2) {
+        return make_ready_future<>();
+    }
+    return seastar::async([] {
+        smp::submit_to(1, [] {
+            engine().set_idle_cpu_handler(steal_tasks);
+        }).get();
+        std::vector<future<unsigned>> results;
+        for (unsigned i = 0; i < 100; ++i) {
+            results.push_back(submit_stealable([] { return engine().cpu_id(); }));
+        }
+        // Keep this shard busy, so that its tasks are left for the thief.
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while (std::chrono::steady_clock::now() < deadline) {
+        }
+        auto shards = when_all_succeed(results.begin(), results.end()).get0();
+        BOOST_REQUIRE(std::find(shards.begin(), shards.end(), 1u) != shards.end());
+        BOOST_REQUIRE_GT(smp::submit_to(1, [] { return internal::stolen_tasks(); }).get0(), 0u);
+
+        smp::submit_to(1, [] {
+            engine().set_idle_cpu_handler([] (reactor::work_waiting_on_reactor) {
+                return reactor::idle_cpu_handler_result::no_more_work;
+            });
+        }).get();
+    });
+}